@@ -0,0 +1,137 @@
+/**********************************************************************
+ * Copyright (c) 2017 Artem V. Andreev
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *  
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**********************************************************************/
+
+/** @file
+ * @brief micro-benchmarking helpers
+ *
+ * Benchmarks live in the same source files as the code they measure,
+ * guarded by `DO_BENCHMARKS`, and report their results to stdout as CSV
+ * rows, one per measurement.
+ *
+ * @author Artem V. Andreev <artem@iling.spb.ru>
+ */
+#ifndef BENCH_H
+#define BENCH_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <time.h>
+#include "compiler.h"
+
+/**
+ * Minimum accumulated time of a single measurement, in seconds
+ */
+#define TN_BENCH_MIN_TIME 0.2
+
+/**
+ * Column names for the rows produced by tn_bench_report()
+ */
+#define TN_BENCH_CSV_HEADER \
+    "benchmark,variant,params,iterations,ns_per_op,mb_per_s"
+
+/**
+ * Results of benchmarked code should be stored here, so that
+ * the compiler won't optimize the code away
+ */
+unused static volatile size_t tn_bench_sink;
+
+warn_unused_result
+static inline double
+tn_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Executes @a _body in batches of doubling size until at least
+ * TN_BENCH_MIN_TIME seconds elapse. The total number of executions
+ * is stored into @a _iters and the time taken into @a _elapsed
+ */
+#define TN_BENCH_RUN(_iters, _elapsed, _body)                   \
+    do {                                                        \
+        unsigned long _batch = 1;                               \
+                                                                \
+        (_iters) = 0;                                           \
+        (_elapsed) = 0.0;                                       \
+        while ((_elapsed) < TN_BENCH_MIN_TIME)                  \
+        {                                                       \
+            unsigned long _i;                                   \
+            double _start = tn_bench_now();                     \
+                                                                \
+            for (_i = 0; _i < _batch; _i++)                     \
+            {                                                   \
+                _body;                                          \
+            }                                                   \
+            (_elapsed) += tn_bench_now() - _start;              \
+            (_iters) += _batch;                                 \
+            _batch *= 2;                                        \
+        }                                                       \
+    } while (0)
+
+/**
+ * Prints a CSV row for a measurement
+ *
+ * @param bench   Benchmark name
+ * @param variant Implementation being measured
+ * @param params  Benchmark parameters as `key=value` pairs
+ *                separated by `;`
+ * @param bytes   Number of bytes processed by a single operation
+ * @param iters   Number of operations performed
+ * @param elapsed Total time taken, in seconds
+ */
+warn_null_args(1, 2, 3)
+static inline void
+tn_bench_report(const char *bench, const char *variant, const char *params,
+                size_t bytes, unsigned long iters, double elapsed)
+{
+    printf("%s,%s,%s,%lu,%.3f,%.2f\n", bench, variant, params, iters,
+           elapsed * 1e9 / (double)iters,
+           (double)bytes * (double)iters / elapsed / 1e6);
+}
+
+/**
+ * Like tn_bench_report(), but for operations on @a nelts elements
+ * each, with the time reported per element rather than per operation
+ */
+warn_null_args(1, 2, 3)
+static inline void
+tn_bench_report_elements(const char *bench, const char *variant,
+                         const char *params, size_t bytes, size_t nelts,
+                         unsigned long iters, double elapsed)
+{
+    printf("%s,%s,%s,%lu,%.3f,%.2f\n", bench, variant, params, iters,
+           elapsed * 1e9 / ((double)iters * (double)nelts),
+           (double)bytes * (double)iters / elapsed / 1e6);
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* BENCH_H */
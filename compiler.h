@@ -275,6 +275,16 @@ extern "C"
 #define unused
 #endif
 
+/**
+ * Compiles a function for an instruction set extension
+ * which is not enabled for the whole program. Such functions
+ * may only be called after checking the CPU at run time.
+ * Left undefined if the compiler does not support that
+ */
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__)
+#define target_isa(_isa) __attribute__((__target__(_isa)))
+#endif
+
 /**@}*/
 
 /** @name C99/C11 annotations
@@ -26,9 +26,23 @@
  */
 
 #include <stdarg.h>
+#include <limits.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if PLATFORM_ARCH_IS_amd64
+#include <immintrin.h>
+#endif
 #include "dstring.h"
+#if DO_BENCHMARKS
+#include <stdlib.h>
+#include "bench.h"
+#endif
 
 #if DO_TESTS
 #define TEST_START ((void)(fprintf(stderr, "%s():\n", __FUNCTION__)))
@@ -239,6 +253,735 @@ static void test_straddch(void)
 }
 #endif
 
+/*
+ * Builder buffers are allocated with an extra byte for
+ * the terminating NUL, which is not included into the capacity
+ */
+#define STRBUF_MIN_CAPACITY 16
+
+void
+tn_strbuf_reserve(tn_strbuf *buf, size_t extra)
+{
+    size_t newcap;
+
+    if (buf->capacity - buf->len >= extra && buf->str != NULL)
+        return;
+
+    newcap = buf->capacity * 2;
+    if (newcap < buf->len + extra)
+        newcap = buf->len + extra;
+    if (newcap < STRBUF_MIN_CAPACITY)
+        newcap = STRBUF_MIN_CAPACITY;
+
+    /* GC_REALLOC(NULL, ...) would allocate a scanned object */
+    if (buf->str == NULL)
+        buf->str = tn_alloc_blob(newcap + 1);
+    else
+        buf->str = tn_realloc(buf->str, newcap + 1);
+    buf->capacity = newcap;
+}
+
+void
+tn_strbuf_append(tn_strbuf *buf, tn_string str)
+{
+    if (str.len == 0)
+        return;
+    tn_strbuf_reserve(buf, str.len);
+    memcpy(buf->str + buf->len, str.str, str.len);
+    buf->len += str.len;
+}
+
+/*
+ * printf-like formatting is done natively for the common conversions
+ * (integers, characters and strings), directly into the output
+ * in a single pass. Floating-point conversions are delegated to
+ * snprintf() one at a time. Anything else (e.g. %p, %n, wide
+ * characters or positional arguments) makes the whole format
+ * fall back to vsnprintf().
+ *
+ * The output may start in a caller's stack buffer, which is moved
+ * to the heap if it overflows
+ */
+typedef struct strfmt_sink {
+    tn_strbuf buf;
+    const char *stack;
+} strfmt_sink;
+
+enum strfmt_flags {
+    STRFMT_LEFT = 1,
+    STRFMT_ZERO = 2,
+    STRFMT_PLUS = 4,
+    STRFMT_SPACE = 8,
+    STRFMT_ALT = 16,
+};
+
+typedef struct strfmt_spec {
+    unsigned flags;
+    size_t width;
+    bool has_precision;
+    size_t precision;
+} strfmt_spec;
+
+static void
+strfmt_reserve(strfmt_sink *sink, size_t extra)
+{
+    if (sink->stack != NULL && sink->buf.str == sink->stack)
+    {
+        tn_strbuf heap = TN_STRBUF_INIT;
+
+        if (sink->buf.capacity - sink->buf.len >= extra)
+            return;
+        tn_strbuf_reserve(&heap, sink->buf.len + extra > 2 * sink->buf.capacity ?
+                          sink->buf.len + extra : 2 * sink->buf.capacity);
+        memcpy(heap.str, sink->buf.str, sink->buf.len);
+        heap.len = sink->buf.len;
+        sink->buf = heap;
+    }
+    else
+        tn_strbuf_reserve(&sink->buf, extra);
+}
+
+static inline void
+strfmt_put(strfmt_sink *sink, const char *str, size_t len)
+{
+    if (len == 0)
+        return;
+    if (sink->buf.capacity - sink->buf.len < len)
+        strfmt_reserve(sink, len);
+    memcpy(sink->buf.str + sink->buf.len, str, len);
+    sink->buf.len += len;
+}
+
+static inline void
+strfmt_fill(strfmt_sink *sink, char ch, size_t len)
+{
+    if (len == 0)
+        return;
+    if (sink->buf.capacity - sink->buf.len < len)
+        strfmt_reserve(sink, len);
+    memset(sink->buf.str + sink->buf.len, ch, len);
+    sink->buf.len += len;
+}
+
+static const char strfmt_digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+/* Produces digits backwards, ending at @a end */
+static char *
+strfmt_digits(char *end, uintmax_t value, char conv)
+{
+    const char *hex = conv == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    switch (conv)
+    {
+        case 'x':
+        case 'X':
+            do {
+                *--end = hex[value & 0xf];
+                value >>= 4;
+            } while (value != 0);
+            break;
+        case 'o':
+            do {
+                *--end = (char)('0' + (value & 7));
+                value >>= 3;
+            } while (value != 0);
+            break;
+        default:
+            while (value >= 100)
+            {
+                const char *pair = strfmt_digit_pairs + 2 * (value % 100);
+
+                value /= 100;
+                *--end = pair[1];
+                *--end = pair[0];
+            }
+            if (value >= 10)
+            {
+                *--end = strfmt_digit_pairs[2 * value + 1];
+                *--end = strfmt_digit_pairs[2 * value];
+            }
+            else
+                *--end = (char)('0' + value);
+            break;
+    }
+    return end;
+}
+
+static void
+strfmt_padded(strfmt_sink *sink, const strfmt_spec *spec,
+              const char *prefix, size_t prefix_len, size_t zeros,
+              const char *body, size_t body_len)
+{
+    size_t total = prefix_len + zeros + body_len;
+    size_t pad = spec->width > total ? spec->width - total : 0;
+
+    if (pad != 0 && !(spec->flags & STRFMT_LEFT))
+    {
+        if (spec->flags & STRFMT_ZERO)
+        {
+            zeros += pad;
+            pad = 0;
+        }
+        else
+        {
+            strfmt_fill(sink, ' ', pad);
+            pad = 0;
+        }
+    }
+    strfmt_put(sink, prefix, prefix_len);
+    strfmt_fill(sink, '0', zeros);
+    strfmt_put(sink, body, body_len);
+    strfmt_fill(sink, ' ', pad);
+}
+
+static void
+strfmt_integer(strfmt_sink *sink, strfmt_spec *spec, char conv,
+               uintmax_t value, bool negative)
+{
+    char digits[sizeof(uintmax_t) * 3 + 1];
+    char *end = digits + sizeof(digits);
+    char *start = strfmt_digits(end, value, conv);
+    size_t ndigits = (size_t)(end - start);
+    size_t zeros = 0;
+    char prefix[2];
+    size_t prefix_len = 0;
+
+    if (spec->has_precision)
+    {
+        /* The 0 flag is ignored if a precision is given */
+        spec->flags &= ~(unsigned)STRFMT_ZERO;
+        if (spec->precision == 0 && value == 0)
+            ndigits = 0;
+        if (spec->precision > ndigits)
+            zeros = spec->precision - ndigits;
+    }
+
+    if (conv == 'd' || conv == 'i')
+    {
+        if (negative)
+            prefix[prefix_len++] = '-';
+        else if (spec->flags & STRFMT_PLUS)
+            prefix[prefix_len++] = '+';
+        else if (spec->flags & STRFMT_SPACE)
+            prefix[prefix_len++] = ' ';
+    }
+    else if (spec->flags & STRFMT_ALT)
+    {
+        if (conv == 'o')
+        {
+            if (zeros == 0 && (ndigits == 0 || *start != '0'))
+                zeros = 1;
+        }
+        else if (conv != 'u' && value != 0)
+        {
+            prefix[prefix_len++] = '0';
+            prefix[prefix_len++] = conv;
+        }
+    }
+
+    strfmt_padded(sink, spec, prefix, prefix_len, zeros, end - ndigits,
+                  ndigits);
+}
+
+/*
+ * Formats a single floating-point conversion with snprintf().
+ * Not marked as printf-like for the same reason as
+ * strbuf_strftime()
+ */
+static tn_status
+strfmt_double(strfmt_sink *sink, const strfmt_spec *spec, char conv,
+              bool is_long, long double value)
+{
+#define SNPRINTF ((int (*)(char *, size_t, const char *, ...))snprintf)
+    char fmt[sizeof("%-+ #0*.*Lf")];
+    char *f = fmt;
+    int width = (int)spec->width;
+    int precision = spec->has_precision ? (int)spec->precision : -1;
+    int rc;
+
+    *f++ = '%';
+    if (spec->flags & STRFMT_LEFT)
+        *f++ = '-';
+    if (spec->flags & STRFMT_PLUS)
+        *f++ = '+';
+    if (spec->flags & STRFMT_SPACE)
+        *f++ = ' ';
+    if (spec->flags & STRFMT_ALT)
+        *f++ = '#';
+    if (spec->flags & STRFMT_ZERO)
+        *f++ = '0';
+    *f++ = '*';
+    *f++ = '.';
+    *f++ = '*';
+    if (is_long)
+        *f++ = 'L';
+    *f++ = conv;
+    *f = '\0';
+
+    strfmt_reserve(sink, 32);
+    for (;;)
+    {
+        size_t avail = sink->buf.capacity - sink->buf.len + 1;
+
+        rc = is_long ?
+            SNPRINTF(sink->buf.str + sink->buf.len, avail, fmt,
+                     width, precision, value) :
+            SNPRINTF(sink->buf.str + sink->buf.len, avail, fmt,
+                     width, precision, (double)value);
+        if (rc < 0)
+            return errno;
+        if ((size_t)rc < avail)
+            break;
+        strfmt_reserve(sink, (size_t)rc);
+    }
+    sink->buf.len += (size_t)rc;
+    return 0;
+#undef SNPRINTF
+}
+
+/*
+ * Returns ENOTSUP if the format needs to be handled by vsnprintf()
+ */
+static tn_status
+strfmt_format(strfmt_sink *sink, const char *fmt, va_list args)
+{
+    for (;;)
+    {
+        const char *pct = strchr(fmt, '%');
+        strfmt_spec spec = {.flags = 0, .width = 0,
+                            .has_precision = false, .precision = 0};
+        enum { LEN_INT, LEN_CHAR, LEN_SHORT, LEN_LONG, LEN_LLONG,
+               LEN_SIZE, LEN_INTMAX, LEN_PTRDIFF, LEN_LDOUBLE } length = LEN_INT;
+        uintmax_t value;
+        bool negative = false;
+        char conv;
+
+        if (pct == NULL)
+        {
+            strfmt_put(sink, fmt, strlen(fmt));
+            return 0;
+        }
+        strfmt_put(sink, fmt, (size_t)(pct - fmt));
+        fmt = pct + 1;
+
+        for (;; fmt++)
+        {
+            if (*fmt == '-')
+                spec.flags |= STRFMT_LEFT;
+            else if (*fmt == '0')
+                spec.flags |= STRFMT_ZERO;
+            else if (*fmt == '+')
+                spec.flags |= STRFMT_PLUS;
+            else if (*fmt == ' ')
+                spec.flags |= STRFMT_SPACE;
+            else if (*fmt == '#')
+                spec.flags |= STRFMT_ALT;
+            else
+                break;
+        }
+
+        if (*fmt == '*')
+        {
+            int width = va_arg(args, int);
+
+            if (width < 0)
+            {
+                spec.flags |= STRFMT_LEFT;
+                spec.width = -(size_t)width;
+            }
+            else
+                spec.width = (size_t)width;
+            fmt++;
+        }
+        else
+        {
+            for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+                spec.width = spec.width * 10 + (size_t)(*fmt - '0');
+        }
+        if (*fmt == '$')
+            return ENOTSUP;
+
+        if (*fmt == '.')
+        {
+            fmt++;
+            spec.has_precision = true;
+            if (*fmt == '*')
+            {
+                int precision = va_arg(args, int);
+
+                spec.has_precision = precision >= 0;
+                spec.precision = precision >= 0 ? (size_t)precision : 0;
+                fmt++;
+            }
+            else
+            {
+                for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+                    spec.precision = spec.precision * 10 +
+                        (size_t)(*fmt - '0');
+            }
+        }
+        if (spec.flags & STRFMT_LEFT)
+            spec.flags &= ~(unsigned)STRFMT_ZERO;
+
+        switch (*fmt)
+        {
+            case 'h':
+                length = fmt[1] == 'h' ? LEN_CHAR : LEN_SHORT;
+                fmt += length == LEN_CHAR ? 2 : 1;
+                break;
+            case 'l':
+                length = fmt[1] == 'l' ? LEN_LLONG : LEN_LONG;
+                fmt += length == LEN_LLONG ? 2 : 1;
+                break;
+            case 'z':
+                length = LEN_SIZE;
+                fmt++;
+                break;
+            case 'j':
+                length = LEN_INTMAX;
+                fmt++;
+                break;
+            case 't':
+                length = LEN_PTRDIFF;
+                fmt++;
+                break;
+            case 'L':
+                length = LEN_LDOUBLE;
+                fmt++;
+                break;
+            default:
+                break;
+        }
+
+        conv = *fmt++;
+        switch (conv)
+        {
+            case '%':
+                strfmt_put(sink, "%", 1);
+                break;
+            case 'd':
+            case 'i':
+            {
+                intmax_t svalue;
+
+                switch (length)
+                {
+                    case LEN_INT:
+                        svalue = va_arg(args, int);
+                        break;
+                    case LEN_CHAR:
+                        svalue = (signed char)va_arg(args, int);
+                        break;
+                    case LEN_SHORT:
+                        svalue = (short)va_arg(args, int);
+                        break;
+                    case LEN_LONG:
+                        svalue = va_arg(args, long);
+                        break;
+                    case LEN_LLONG:
+                        svalue = va_arg(args, long long);
+                        break;
+                    case LEN_SIZE:
+                        svalue = va_arg(args, ssize_t);
+                        break;
+                    case LEN_INTMAX:
+                        svalue = va_arg(args, intmax_t);
+                        break;
+                    case LEN_PTRDIFF:
+                        svalue = va_arg(args, ptrdiff_t);
+                        break;
+                    default:
+                        return ENOTSUP;
+                }
+                negative = svalue < 0;
+                value = negative ? -(uintmax_t)svalue : (uintmax_t)svalue;
+                strfmt_integer(sink, &spec, conv, value, negative);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                switch (length)
+                {
+                    case LEN_INT:
+                        value = va_arg(args, unsigned);
+                        break;
+                    case LEN_CHAR:
+                        value = (unsigned char)va_arg(args, unsigned);
+                        break;
+                    case LEN_SHORT:
+                        value = (unsigned short)va_arg(args, unsigned);
+                        break;
+                    case LEN_LONG:
+                        value = va_arg(args, unsigned long);
+                        break;
+                    case LEN_LLONG:
+                        value = va_arg(args, unsigned long long);
+                        break;
+                    case LEN_SIZE:
+                        value = va_arg(args, size_t);
+                        break;
+                    case LEN_INTMAX:
+                        value = va_arg(args, uintmax_t);
+                        break;
+                    case LEN_PTRDIFF:
+                        value = (uintmax_t)va_arg(args, ptrdiff_t);
+                        break;
+                    default:
+                        return ENOTSUP;
+                }
+                strfmt_integer(sink, &spec, conv, value, false);
+                break;
+            case 'c':
+            {
+                char ch;
+
+                if (length != LEN_INT)
+                    return ENOTSUP;
+                ch = (char)va_arg(args, int);
+                spec.flags &= ~(unsigned)STRFMT_ZERO;
+                strfmt_padded(sink, &spec, NULL, 0, 0, &ch, 1);
+                break;
+            }
+            case 's':
+            {
+                const char *str;
+
+                if (length != LEN_INT)
+                    return ENOTSUP;
+                str = va_arg(args, const char *);
+                /* The representation of NULL is up to the C library */
+                if (str == NULL)
+                    return ENOTSUP;
+                spec.flags &= ~(unsigned)STRFMT_ZERO;
+                strfmt_padded(sink, &spec, NULL, 0, 0, str,
+                              spec.has_precision ?
+                              strnlen(str, spec.precision) : strlen(str));
+                break;
+            }
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                tn_status status;
+
+                if (length == LEN_LDOUBLE)
+                    status = strfmt_double(sink, &spec, conv, true,
+                                           va_arg(args, long double));
+                else if (length == LEN_INT || length == LEN_LONG)
+                    status = strfmt_double(sink, &spec, conv, false,
+                                           va_arg(args, double));
+                else
+                    return ENOTSUP;
+                if (status != 0)
+                    return status;
+                break;
+            }
+            default:
+                return ENOTSUP;
+        }
+    }
+}
+
+/* The vsnprintf()-based fallback for tn_strbuf_vprintf() */
+static tn_status
+strbuf_vprintf_libc(tn_strbuf * restrict buf, const char * restrict fmt,
+                    va_list args)
+{
+#define VSNPRINTF ((int (*)(char *, size_t, const char *, va_list))vsnprintf)
+    tn_status status = 0;
+    size_t avail = buf->str == NULL ? 0 : buf->capacity - buf->len + 1;
+    int rc;
+    va_list args2;
+
+    va_copy(args2, args);
+    rc = VSNPRINTF(avail == 0 ? NULL : buf->str + buf->len, avail,
+                   fmt, args);
+    if (rc < 0)
+        status = errno;
+    else if ((size_t)rc >= avail)
+    {
+        int rc2;
+
+        tn_strbuf_reserve(buf, (size_t)rc);
+        rc2 = VSNPRINTF(buf->str + buf->len, (size_t)rc + 1, fmt, args2);
+        if (rc2 < 0)
+            status = errno;
+        else if (rc2 != rc)
+            status = EPROTO;
+    }
+    if (status == 0)
+        buf->len += (size_t)rc;
+    va_end(args2);
+
+    return status;
+#undef VSNPRINTF
+}
+
+tn_status
+tn_strbuf_printf(tn_strbuf * restrict buf, const char * restrict fmt, ...)
+{
+    va_list args;
+    tn_status rc;
+
+    va_start(args, fmt);
+    rc = tn_strbuf_vprintf(buf, fmt, args);
+    va_end(args);
+
+    return rc;
+}
+
+tn_status
+tn_strbuf_vprintf(tn_strbuf * restrict buf, const char * restrict fmt,
+                  va_list args)
+{
+    strfmt_sink sink = {.buf = *buf, .stack = NULL};
+    size_t start = buf->len;
+    tn_status status;
+    va_list args2;
+
+    va_copy(args2, args);
+    status = strfmt_format(&sink, fmt, args);
+    *buf = sink.buf;
+    if (status == ENOTSUP)
+    {
+        buf->len = start;
+        status = strbuf_vprintf_libc(buf, fmt, args2);
+    }
+    else if (status != 0)
+        buf->len = start;
+    va_end(args2);
+
+    return status;
+}
+
+/*
+ * strftime() returns 0 both when the buffer is too small and when
+ * the result is legitimately empty. The format gets a trailing space,
+ * so that the result is never empty, and the buffer is not grown
+ * beyond this many bytes per a format character
+ */
+#define STRFTIME_MAX_EXPANSION 256
+
+/*
+ * The actual implementation of tn_strbuf_strftime(), which is not marked
+ * as strftime-like, so that it can be called by tn_strftime() with a
+ * non-literal format
+ */
+static tn_status
+strbuf_strftime(tn_strbuf * restrict buf, const char * restrict fmt,
+                const struct tm * restrict tm)
+{
+    /* This is necessary to shut up the compiler about non-literal format
+     * string, see e.g https://gcc.gnu.org/bugzilla/show_bug.cgi?id=39438
+     */
+#define STRFTIME                                                        \
+    ((size_t (*)(char *, size_t, const char *, const struct tm *))strftime)
+    size_t fmtlen = strlen(fmt);
+    size_t maxsize;
+    size_t sz = 0;
+    char *spaced;
+
+    if (fmtlen == 0)
+        return 0;
+    if (fmtlen >= SIZE_MAX / STRFTIME_MAX_EXPANSION - 1)
+        return ERANGE;
+    maxsize = STRFTIME_MAX_EXPANSION * (fmtlen + 1);
+
+    spaced = tn_alloc_blob(fmtlen + 2);
+    memcpy(spaced, fmt, fmtlen);
+    spaced[fmtlen] = ' ';
+    spaced[fmtlen + 1] = '\0';
+
+    tn_strbuf_reserve(buf, STRBUF_MIN_CAPACITY);
+    for (;;)
+    {
+        size_t avail = buf->capacity - buf->len + 1;
+
+        sz = STRFTIME(buf->str + buf->len, avail, spaced, tm);
+        if (sz != 0)
+            break;
+        if (avail > maxsize)
+            return ERANGE;
+        tn_strbuf_reserve(buf, 2 * avail);
+    }
+    buf->len += sz - 1;
+    return 0;
+#undef STRFTIME
+}
+
+tn_status
+tn_strbuf_strftime(tn_strbuf * restrict buf, const char * restrict fmt,
+                   const struct tm * restrict tm)
+{
+    return strbuf_strftime(buf, fmt, tm);
+}
+
+tn_string
+tn_strbuf_finish(tn_strbuf *buf)
+{
+    tn_string result = TN_EMPTY_STRING;
+
+    if (buf->len != 0)
+    {
+        buf->str[buf->len] = '\0';
+        result = (tn_string){.str = buf->str, .len = buf->len};
+    }
+    *buf = TN_STRBUF_INIT;
+
+    return result;
+}
+
+#if DO_TESTS
+static void test_strbuf(void)
+{
+    TEST_START;
+    tn_strbuf buf = TN_STRBUF_INIT;
+    tn_string result;
+    struct tm test_tm = {
+        .tm_year = 114,
+        .tm_mon  = 11,
+        .tm_mday  = 22,
+    };
+    unsigned i;
+
+    assert(tn_strbuf_finish(&buf).str == NULL);
+
+    tn_strbuf_addch(&buf, 'a');
+    tn_strbuf_addch(&buf, '\0');
+    tn_strbuf_append(&buf, TN_STRING_LITERAL("bcd"));
+    tn_strbuf_append(&buf, TN_EMPTY_STRING);
+    assert(tn_strbuf_printf(&buf, "%d-%s", 42, "xyz") == 0);
+    assert(tn_strbuf_strftime(&buf, "%Y-%m-%d", &test_tm) == 0);
+    result = tn_strbuf_finish(&buf);
+    assert(tn_strcmp(result, TN_STRING_LITERAL("a\0bcd42-xyz2014-12-22")) == 0);
+    assert(result.str[result.len] == '\0');
+    assert(buf.str == NULL && buf.len == 0);
+
+    for (i = 0; i < 1000; i++)
+        tn_strbuf_addch(&buf, (char)('0' + i % 10));
+    assert(buf.len == 1000 && buf.capacity >= 1000);
+    assert(tn_strbuf_printf(&buf, "%0200d", 0) == 0);
+    result = tn_strbuf_finish(&buf);
+    assert(result.len == 1200);
+    assert(result.str[999] == '9' && result.str[1000] == '0');
+    assert(result.str[1200] == '\0');
+
+    tn_strbuf_reserve(&buf, 100);
+    assert(buf.capacity >= 100);
+    assert(tn_strbuf_finish(&buf).str == NULL);
+}
+#endif
+
 tn_string
 tn_strcats(size_t n, tn_string strs[var_size(n)], tn_string sep)
 {
@@ -248,10 +991,9 @@ tn_strcats(size_t n, tn_string strs[var_size(n)], tn_string sep)
         return strs[0];
     else
     {
+        tn_strbuf buf = TN_STRBUF_INIT;
         size_t i;
         size_t len = strs[0].len;
-        char *buf;
-        char *ptr;
 
         for (i = 1; i < n; i++)
         {
@@ -259,18 +1001,15 @@ tn_strcats(size_t n, tn_string strs[var_size(n)], tn_string sep)
             len += strs[i].len;
         }
 
-        buf = tn_alloc_blob(len + 1);
-        memcpy(buf, strs[0].str, strs[0].len);
-        for (ptr = buf + strs[0].len, i = 1; i < n; i++)
+        tn_strbuf_reserve(&buf, len);
+        tn_strbuf_append(&buf, strs[0]);
+        for (i = 1; i < n; i++)
         {
-            memcpy(ptr, sep.str, sep.len);
-            ptr += sep.len;
-            memcpy(ptr, strs[i].str, strs[i].len);
-            ptr += strs[i].len;
+            tn_strbuf_append(&buf, sep);
+            tn_strbuf_append(&buf, strs[i]);
         }
-        buf[len] = '\0';
 
-        return (tn_string){.str = buf, .len = len};
+        return tn_strbuf_finish(&buf);
     }
 }
 
@@ -370,364 +1109,1964 @@ static void test_strcut(void)
 }
 #endif
 
-tn_string
-tn_strlcprefix(tn_string str1, tn_string str2)
+/*
+ * Byte scanning primitives have several implementations selected
+ * once at startup: SSE2 (always present on amd64), AVX2 if the CPU
+ * supports it, and a portable word-at-a-time one elsewhere.
+ * The plain byte loops are kept as the reference versions and
+ * for the tails shorter than a vector.
+ *
+ * lcsuffix() takes pointers past the ends of the compared strings.
+ * span() measures the longest prefix of bytes which are
+ * members of the set if @a member is true, or non-members otherwise.
+ */
+typedef struct strscan_ops {
+    const char *name;
+    bool (*rchr)(const char *str, size_t len, char ch, size_t *pos);
+    size_t (*lcprefix)(const char *str1, const char *str2, size_t len);
+    size_t (*lcsuffix)(const char *end1, const char *end2, size_t len);
+    size_t (*span)(const tn_charset *set, const char *str, size_t len,
+                   bool member);
+} strscan_ops;
+
+static bool
+strrchr_scalar(const char *str, size_t len, char ch, size_t *pos)
 {
-    size_t minsize = str1.len < str2.len ? str1.len : str2.len;
     size_t i;
 
-    for (i = 0; i < minsize; i++)
+    for (i = len; i > 0; i--)
     {
-        if (str1.str[i] != str2.str[i])
-            break;
+        if (str[i - 1] == ch)
+        {
+            *pos = i - 1;
+            return true;
+        }
     }
-    
-    return (tn_string){.str = (i == 0 ? NULL : str1.str), .len = i};
+    return false;
 }
 
-tn_string
-tn_strlcsuffix(tn_string str1, tn_string str2)
+static size_t
+charset_span_scalar(const tn_charset *set, const char *str, size_t len,
+                    bool member)
 {
-    size_t minsize = str1.len < str2.len ? str1.len : str2.len;
     size_t i;
 
-    for (i = 0; i < minsize; i++)
+    for (i = 0; i < len; i++)
     {
-        if (str1.str[str1.len - i - 1] != str2.str[str2.len - i - 1])
+        if (tn_charset_has(set, str[i]) != member)
             break;
     }
-    
-    return (tn_string){.str = (i == 0 ? NULL : str1.str + str1.len - i),
-                       .len = i};
+    return i;
 }
 
-#if DO_TESTS
-static void test_lc_prefix_suffix(void)
+static size_t
+strlcprefix_scalar(const char *str1, const char *str2, size_t len)
 {
-    TEST_START;
-    tn_string str1 = TN_STRING_LITERAL("abcdef");
-    tn_string str2 = TN_STRING_LITERAL("abcxyz");
-    tn_string str3 = TN_STRING_LITERAL("xyzdef");
-
-    tn_string pfx = TN_STRING_LITERAL("abc");
-    tn_string sfx = TN_STRING_LITERAL("def");
-
-    assert(tn_strcmp(tn_strlcprefix(str1, str2), pfx) == 0);
-    assert(tn_strcmp(tn_strlcsuffix(str1, str3), sfx) == 0);
-
-    assert(tn_strlcprefix(str1, str3).str == NULL);
-    assert(tn_strlcsuffix(str1, str2).str == NULL);
-
-    assert(tn_strcmp(tn_strlcprefix(pfx, str1), pfx) == 0);
-    assert(tn_strcmp(tn_strlcsuffix(str3, sfx), sfx) == 0);
+    size_t i;
 
-    assert(tn_strlcprefix(TN_EMPTY_STRING, str1).str == NULL);
-    assert(tn_strlcprefix(str2, TN_EMPTY_STRING).str == NULL);
-    assert(tn_strlcsuffix(TN_EMPTY_STRING, str1).str == NULL);
-    assert(tn_strlcsuffix(str3, TN_EMPTY_STRING).str == NULL);
+    for (i = 0; i < len; i++)
+    {
+        if (str1[i] != str2[i])
+            break;
+    }
+    return i;
 }
 
-#endif    
-
-bool
-tn_strrchr(tn_string str, char ch, size_t *pos)
+static size_t
+strlcsuffix_scalar(const char *end1, const char *end2, size_t len)
 {
     size_t i;
 
-    for (i = str.len; i > 0; i--)
+    for (i = 0; i < len; i++)
     {
-        if (str.str[i - 1] == ch)
-        {
-            if (pos != NULL)
-                *pos = i - 1;
-            return true;
-        }
+        if (end1[-(ptrdiff_t)i - 1] != end2[-(ptrdiff_t)i - 1])
+            break;
     }
-  
-    return false;
+    return i;
 }
 
-#if DO_TESTS
-static void test_strchr_strrchr(void)
-{
-    TEST_START;
-    tn_string str = TN_STRING_LITERAL("abc\0deffed\0cba");
-    size_t pos = (size_t)-1;
-
-    assert(tn_strchr(str, 'a', NULL));
-    assert(tn_strchr(str, 'd', NULL));
-    assert(tn_strchr(str, '\0', NULL));
-    assert(!tn_strchr(str, 'x', NULL));
-
-    assert(tn_strrchr(str, 'a', NULL));
-    assert(tn_strrchr(str, 'd', NULL));
-    assert(tn_strrchr(str, '\0', NULL));
-    assert(!tn_strrchr(str, 'x', NULL));
+#if !PLATFORM_ARCH_IS_amd64 || DO_TESTS || DO_BENCHMARKS
+#define SWAR_ONES (UINT64_MAX / UINT8_MAX)
+#define SWAR_HAS_ZERO(_w) (((_w) - SWAR_ONES) & ~(_w) & (SWAR_ONES << 7))
 
-    assert(tn_strchr(str, 'a', &pos) && pos == 0);
-    assert(tn_strchr(str, 'd', &pos) && pos == 4);
-    assert(tn_strchr(str, '\0', &pos) && pos == 3);
-    assert(!tn_strchr(str, 'x', &pos) && pos == 3);
+static inline uint64_t
+swar_load(const char *p)
+{
+    uint64_t w;
 
-    assert(tn_strrchr(str, 'a', &pos) && pos == 13);
-    assert(tn_strrchr(str, 'd', &pos) && pos == 9);
-    assert(tn_strrchr(str, '\0', &pos) && pos == 10);
-    assert(!tn_strrchr(str, 'x', &pos) && pos == 10);
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
 
-    assert(!tn_strchr(TN_EMPTY_STRING, '\0', NULL));
-    assert(!tn_strrchr(TN_EMPTY_STRING, '\0', NULL));
+/*
+ * Given a non-zero XOR of two words, counts the equal bytes
+ * at the lower and the higher addresses respectively
+ */
+static inline size_t
+swar_equal_low(uint64_t diff)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (size_t)__builtin_clzll(diff) / 8;
+#else
+    return (size_t)__builtin_ctzll(diff) / 8;
+#endif
 }
+
+static inline size_t
+swar_equal_high(uint64_t diff)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (size_t)__builtin_ctzll(diff) / 8;
+#else
+    return (size_t)__builtin_clzll(diff) / 8;
 #endif
+}
 
-bool
-tn_strstr(tn_string str, tn_string sub, size_t *pos)
+static bool
+strrchr_swar(const char *str, size_t len, char ch, size_t *pos)
 {
-    size_t i;
+    uint64_t pattern = SWAR_ONES * (uint8_t)ch;
+    size_t i = len;
 
-    if (sub.len == 0)
+    while (i >= sizeof(uint64_t))
     {
-        if (pos != NULL)
-            *pos = 0;
-        return true;
+        i -= sizeof(uint64_t);
+        /* The zero-byte test may give false positives above a true
+         * match, so only use it to pick the word to look at */
+        if (SWAR_HAS_ZERO(swar_load(str + i) ^ pattern) != 0)
+            return strrchr_scalar(str + i, sizeof(uint64_t), ch, pos) ?
+                (*pos += i, true) : false;
     }
+    return strrchr_scalar(str, i, ch, pos);
+}
 
-    if (sub.len > str.len)
-        return false;
-    
-    for (i = 0; i < str.len - sub.len + 1; i++)
+static size_t
+strlcprefix_swar(const char *str1, const char *str2, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
     {
-        size_t j;
+        uint64_t diff = swar_load(str1 + i) ^ swar_load(str2 + i);
 
-        for (j = 0; j < sub.len; j++)
-        {
-            if (str.str[i + j] != sub.str[j])
-                break;
-        }
-        if (j == sub.len)
-        {
-            if (pos)
-                *pos = i;
-            return true;
-        }
+        if (diff != 0)
+            return i + swar_equal_low(diff);
     }
-    return false;
+    return i + strlcprefix_scalar(str1 + i, str2 + i, len - i);
 }
 
-#if DO_TESTS
-static void test_strstr(void)
+static size_t
+strlcsuffix_swar(const char *end1, const char *end2, size_t len)
 {
-    TEST_START;
-    tn_string base = TN_STRING_LITERAL("abc\0def\0ghi");
-    size_t pos = (size_t)(-1);
+    size_t i;
 
-    assert(tn_strstr(base, TN_EMPTY_STRING, NULL));
-    assert(tn_strstr(base, TN_STRING_LITERAL("abc"), NULL));
-    assert(tn_strstr(base, TN_STRING_LITERAL("\0ghi"), NULL));
-    assert(!tn_strstr(base, TN_STRING_LITERAL("xyz"), NULL));
-    assert(!tn_strstr(base, TN_STRING_LITERAL("averyveryveryverylongsubstring"), NULL));
-    assert(tn_strstr(TN_EMPTY_STRING, TN_EMPTY_STRING, NULL));
-    assert(!tn_strstr(TN_EMPTY_STRING, TN_STRING_LITERAL("abc"), NULL));
+    for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        size_t back = i + sizeof(uint64_t);
+        uint64_t diff = swar_load(end1 - back) ^ swar_load(end2 - back);
 
-    assert(tn_strstr(base, TN_EMPTY_STRING, &pos) && pos == 0);
-    assert(tn_strstr(base, TN_STRING_LITERAL("abc"), &pos) && pos == 0);
-    assert(tn_strstr(base, TN_STRING_LITERAL("\0ghi"), &pos) && pos == 7);
-    assert(!tn_strstr(base, TN_STRING_LITERAL("xyz"), &pos) && pos == 7);
+        if (diff != 0)
+            return i + swar_equal_high(diff);
+    }
+    return i + strlcsuffix_scalar(end1 - i, end2 - i, len - i);
 }
+
+#undef SWAR_HAS_ZERO
+#undef SWAR_ONES
+
+static const strscan_ops strscan_swar = {
+    "swar", strrchr_swar, strlcprefix_swar, strlcsuffix_swar,
+    charset_span_scalar
+};
 #endif
 
-bool
-tn_strisprefix(tn_string prefix, tn_string str)
+#if PLATFORM_ARCH_IS_amd64
+static bool
+strrchr_sse2(const char *str, size_t len, char ch, size_t *pos)
 {
-    if (prefix.len > str.len)
-        return false;
+    __m128i pattern = _mm_set1_epi8(ch);
+    size_t i = len;
 
-    return memcmp(str.str, prefix.str, prefix.len) == 0;
+    while (i >= sizeof(__m128i))
+    {
+        unsigned mask;
+
+        i -= sizeof(__m128i);
+        mask = (unsigned)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(str + i)),
+                           pattern));
+        if (mask != 0)
+        {
+            *pos = i + 31 - (size_t)__builtin_clz(mask);
+            return true;
+        }
+    }
+    return strrchr_scalar(str, i, ch, pos);
 }
 
-bool
-tn_strissuffix(tn_string suffix, tn_string str)
+static inline unsigned
+sse2_equal_mask(const char *str1, const char *str2)
 {
-    if (suffix.len > str.len)
-        return false;
-
-    return memcmp(str.str + str.len - suffix.len,
-                  suffix.str, suffix.len) == 0;
+    return (unsigned)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)str1),
+                       _mm_loadu_si128((const __m128i *)str2)));
 }
 
-#if DO_TESTS
-static void test_isprefix_issuffix(void)
+static size_t
+strlcprefix_sse2(const char *str1, const char *str2, size_t len)
 {
-    TEST_START;
-    tn_string base = TN_STRING_LITERAL("abc\0def");
+    size_t i;
 
-    assert(tn_strisprefix(TN_STRING_LITERAL("abc\0"), base));
-    assert(tn_strissuffix(TN_STRING_LITERAL("\0def"), base));
-    assert(tn_strisprefix(TN_EMPTY_STRING, base));
-    assert(tn_strissuffix(TN_EMPTY_STRING, base));
-    assert(!tn_strisprefix(TN_STRING_LITERAL("abc\0z"), base));
-    assert(!tn_strissuffix(TN_STRING_LITERAL("z\0def"), base));
+    for (i = 0; i + sizeof(__m128i) <= len; i += sizeof(__m128i))
+    {
+        unsigned mask = sse2_equal_mask(str1 + i, str2 + i);
 
-    assert(!tn_strisprefix(TN_STRING_LITERAL("abc\0defghi"), base));
-    assert(!tn_strissuffix(TN_STRING_LITERAL("abc\0defghi"), base));
+        if (mask != 0xffff)
+            return i + (size_t)__builtin_ctz(~mask);
+    }
+    return i + strlcprefix_scalar(str1 + i, str2 + i, len - i);
 }
-#endif
 
-bool
-tn_strtok(tn_string *src, bool (*predicate)(char c), tn_string *tok)
+static size_t
+strlcsuffix_sse2(const char *end1, const char *end2, size_t len)
 {
     size_t i;
-    size_t start;
 
-    for (i = 0; i < src->len; i++)
+    for (i = 0; i + sizeof(__m128i) <= len; i += sizeof(__m128i))
     {
-        if (!predicate(src->str[i]))
-            break;
-    }
-    if (i == src->len)
-        return false;
+        size_t back = i + sizeof(__m128i);
+        unsigned mask = sse2_equal_mask(end1 - back, end2 - back);
 
-    start = i;
-    for (; i < src->len; i++)
-    {
-        if (predicate(src->str[i]))
-            break;
+        if (mask != 0xffff)
+            return i + (size_t)__builtin_clz((~mask & 0xffff) << 16);
     }
-    if (tok)
-    {
-        tok->str = src->str + start;
-        tok->len = i - start;
-    }
-    src->str += i;
-    src->len -= i;
-
-    return true;
+    return i + strlcsuffix_scalar(end1 - i, end2 - i, len - i);
 }
 
-#if DO_TESTS
-hint_no_side_effects
-static bool test_eq_space(char c)
+static const strscan_ops strscan_sse2 = {
+    "sse2", strrchr_sse2, strlcprefix_sse2, strlcsuffix_sse2,
+    charset_span_scalar
+};
+
+/*
+ * Classifies 16 bytes at once. The high nibble of each byte selects
+ * a bit (the same for bytes below and above 0x80), and the low nibble
+ * selects a row of the set's nibble table, which has this bit set
+ * iff the byte is in the set. The result has a bit set for
+ * each byte that is *not* in the set
+ */
+#if defined(target_isa)
+target_isa("ssse3")
+static inline unsigned
+ssse3_nonmembers(const tn_charset *set, __m128i bytes)
 {
-    return c == ' ';
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                       1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i lo = _mm_and_si128(bytes, nibble);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+    __m128i high = _mm_cmplt_epi8(bytes, _mm_setzero_si128());
+    __m128i row = _mm_or_si128(
+        _mm_andnot_si128(high,
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+                                                          set->nibbles[0]),
+                                          lo)),
+        _mm_and_si128(high,
+                      _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+                                                       set->nibbles[1]),
+                                       lo)));
+    __m128i found = _mm_and_si128(row, _mm_shuffle_epi8(bits, hi));
+
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(found,
+                                                      _mm_setzero_si128()));
 }
 
-static void test_strtok(void)
+target_isa("ssse3")
+static size_t
+charset_span_ssse3(const tn_charset *set, const char *str, size_t len,
+                   bool member)
 {
-    TEST_START;
-    tn_string base = TN_STRING_LITERAL("    abc\t    def ghi    ");
-    tn_string token = TN_EMPTY_STRING;
+    unsigned flip = member ? 0 : 0xffff;
+    size_t i;
 
-    assert(tn_strtok(&base, test_eq_space, &token) &&
-           tn_strcmp(token, TN_STRING_LITERAL("abc\t")) == 0);
-    assert(tn_strtok(&base, test_eq_space, &token) &&
-           tn_strcmp(token, TN_STRING_LITERAL("def")) == 0);
-    assert(tn_strtok(&base, test_eq_space, &token) &&
-           tn_strcmp(token, TN_STRING_LITERAL("ghi")) == 0);
-    assert(!tn_strtok(&base, test_eq_space, &token) &&
-           tn_strcmp(base, TN_STRING_LITERAL("    ")) == 0 &&
-           tn_strcmp(token, TN_STRING_LITERAL("ghi")) == 0);
+    for (i = 0; i + sizeof(__m128i) <= len; i += sizeof(__m128i))
+    {
+        unsigned mask = ssse3_nonmembers(set,
+                                         _mm_loadu_si128((const __m128i *)
+                                                         (str + i))) ^ flip;
+
+        if (mask != 0)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + charset_span_scalar(set, str + i, len - i, member);
 }
+
+static const strscan_ops strscan_ssse3 = {
+    "ssse3", strrchr_sse2, strlcprefix_sse2, strlcsuffix_sse2,
+    charset_span_ssse3
+};
 #endif
 
-tn_string
-tn_strmap(tn_string str, char (*func)(char ch))
+#if defined(target_isa)
+target_isa("avx2")
+static bool
+strrchr_avx2(const char *str, size_t len, char ch, size_t *pos)
 {
-    size_t i;
-    char *buf;
-    
-    if (str.len == 0)
-        return TN_EMPTY_STRING;
+    __m256i pattern = _mm256_set1_epi8(ch);
+    size_t i = len;
 
-    buf = tn_alloc_blob(str.len + 1);
-    for (i = 0; i < str.len; i++)
-        buf[i] = func(str.str[i]);
+    while (i >= sizeof(__m256i))
+    {
+        unsigned mask;
 
-    return (tn_string){.str = buf, .len = str.len};
+        i -= sizeof(__m256i);
+        mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(str + i)),
+                              pattern));
+        if (mask != 0)
+        {
+            *pos = i + 31 - (size_t)__builtin_clz(mask);
+            return true;
+        }
+    }
+    return strrchr_sse2(str, i, ch, pos);
 }
 
-#if DO_TESTS
-hint_no_side_effects
-static char test_cvt(char c)
+target_isa("avx2")
+static inline unsigned
+avx2_equal_mask(const char *str1, const char *str2)
 {
-    return c == ' ' ? '+' : c;
+    return (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)str1),
+                          _mm256_loadu_si256((const __m256i *)str2)));
 }
 
-static void test_strmap(void)
+target_isa("avx2")
+static size_t
+strlcprefix_avx2(const char *str1, const char *str2, size_t len)
 {
-    TEST_START;
-    tn_string base = TN_STRING_LITERAL("abc\0def  ghi ");
+    size_t i;
 
-    assert(tn_strcmp(tn_strmap(base, test_cvt),
-                     TN_STRING_LITERAL("abc\0def++ghi+")) == 0);
-    assert(tn_strmap(TN_EMPTY_STRING, test_cvt).str == NULL);
+    for (i = 0; i + sizeof(__m256i) <= len; i += sizeof(__m256i))
+    {
+        unsigned mask = avx2_equal_mask(str1 + i, str2 + i);
+
+        if (mask != UINT32_MAX)
+            return i + (size_t)__builtin_ctz(~mask);
+    }
+    return i + strlcprefix_sse2(str1 + i, str2 + i, len - i);
 }
-#endif
 
-tn_string
-tn_strfilter(tn_string str, bool (*predicate)(char ch))
+target_isa("avx2")
+static size_t
+strlcsuffix_avx2(const char *end1, const char *end2, size_t len)
 {
-    char *buf;
-    size_t i, j;
-    
-    if (str.len == 0)
-        return TN_EMPTY_STRING;
+    size_t i;
 
-    buf = tn_alloc_blob(str.len + 1);
-    for (i = 0, j = 0; i < str.len; i++)
+    for (i = 0; i + sizeof(__m256i) <= len; i += sizeof(__m256i))
     {
-        if (predicate(str.str[i]))
-            buf[j++] = str.str[i];
-    }
-    buf[j] = '\0';
-    buf = tn_realloc(buf, j + 1);
+        size_t back = i + sizeof(__m256i);
+        unsigned mask = avx2_equal_mask(end1 - back, end2 - back);
 
-    return (tn_string){.str = buf, .len = j};
+        if (mask != UINT32_MAX)
+            return i + (size_t)__builtin_clz(~mask);
+    }
+    return i + strlcsuffix_sse2(end1 - i, end2 - i, len - i);
 }
 
-#if DO_TESTS
-hint_no_side_effects
-static bool test_neq_space(char c)
+/* The same as ssse3_nonmembers(), but for 32 bytes */
+target_isa("avx2")
+static inline unsigned
+avx2_nonmembers(const tn_charset *set, __m256i bytes)
 {
-    return c != ' ';
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(bytes, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+    __m256i low_rows =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)
+                                                    set->nibbles[0]));
+    __m256i high_rows =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)
+                                                    set->nibbles[1]));
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(low_rows, lo),
+                                     _mm256_shuffle_epi8(high_rows, lo),
+                                     bytes);
+    __m256i found = _mm256_and_si256(row, _mm256_shuffle_epi8(bits, hi));
+
+    return (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(found, _mm256_setzero_si256()));
 }
 
-
-static void test_strfilter(void)
+target_isa("avx2")
+static size_t
+charset_span_avx2(const tn_charset *set, const char *str, size_t len,
+                  bool member)
 {
-    TEST_START;
-    tn_string base = TN_STRING_LITERAL("  abc   de\0fg i j k   ");
-
-    assert(tn_strcmp(tn_strfilter(base, test_neq_space),
-                     TN_STRING_LITERAL("abcde\0fgijk")) == 0);
-    assert(tn_strfilter(TN_EMPTY_STRING, test_neq_space).str == NULL);
-}
-#endif
+    unsigned flip = member ? 0 : UINT32_MAX;
+    size_t i;
 
-tn_string
-tn_strrepeat(tn_string str, unsigned n)
-{
-    if (n == 0 || str.len == 0)
-        return TN_EMPTY_STRING;
-    if (n == 1)
-        return str;
-    else
+    for (i = 0; i + sizeof(__m256i) <= len; i += sizeof(__m256i))
     {
-        char *buf = tn_alloc_blob(str.len * n + 1);
-        unsigned i;
+        unsigned mask = avx2_nonmembers(set,
+                                        _mm256_loadu_si256((const __m256i *)
+                                                           (str + i))) ^ flip;
 
-        for (i = 0; i < n; i++)
-            memcpy(buf + str.len * i, str.str, str.len);
-        buf[str.len * n] = '\0';
-
-        return (tn_string){.str = buf, .len = str.len * n};
+        if (mask != 0)
+            return i + (size_t)__builtin_ctz(mask);
     }
+    return i + charset_span_ssse3(set, str + i, len - i, member);
 }
 
-#if DO_TESTS
-static void test_strrepeat(void)
+static const strscan_ops strscan_avx2 = {
+    "avx2", strrchr_avx2, strlcprefix_avx2, strlcsuffix_avx2,
+    charset_span_avx2
+};
+#endif
+
+static const strscan_ops *strscan = &strscan_sse2;
+
+constructor void
+init_strscan(void)
 {
-    tn_string base = TN_STRING_LITERAL("abc\0");
+#if defined(target_isa)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        strscan = &strscan_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        strscan = &strscan_ssse3;
+#endif
+}
+#else
+static const strscan_ops *strscan = &strscan_swar;
+#endif
 
-    assert(tn_strrepeat(base, 0).str == NULL);
+#if DO_TESTS || DO_BENCHMARKS
+static const strscan_ops strscan_scalar = {
+    "scalar", strrchr_scalar, strlcprefix_scalar, strlcsuffix_scalar,
+    charset_span_scalar
+};
+
+static const strscan_ops * const strscan_variants[] = {
+    &strscan_scalar,
+    &strscan_swar,
+#if PLATFORM_ARCH_IS_amd64
+    &strscan_sse2,
+#if defined(target_isa)
+    &strscan_ssse3,
+    &strscan_avx2,
+#endif
+#endif
+};
+
+static bool
+strscan_usable(const strscan_ops *ops)
+{
+#if PLATFORM_ARCH_IS_amd64 && defined(target_isa)
+    if (ops == &strscan_ssse3)
+        return __builtin_cpu_supports("ssse3");
+    if (ops == &strscan_avx2)
+        return __builtin_cpu_supports("avx2");
+#else
+    (void)ops;
+#endif
+    return true;
+}
+#endif
+
+tn_string
+tn_strlcprefix(tn_string str1, tn_string str2)
+{
+    size_t minsize = str1.len < str2.len ? str1.len : str2.len;
+    size_t i = strscan->lcprefix(str1.str, str2.str, minsize);
+
+    return (tn_string){.str = (i == 0 ? NULL : str1.str), .len = i};
+}
+
+tn_string
+tn_strlcsuffix(tn_string str1, tn_string str2)
+{
+    size_t minsize = str1.len < str2.len ? str1.len : str2.len;
+    size_t i;
+
+    if (minsize == 0)
+        return TN_EMPTY_STRING;
+    i = strscan->lcsuffix(str1.str + str1.len, str2.str + str2.len, minsize);
+
+    return (tn_string){.str = (i == 0 ? NULL : str1.str + str1.len - i),
+                       .len = i};
+}
+
+#if DO_TESTS
+static void test_lc_prefix_suffix(void)
+{
+    TEST_START;
+    tn_string str1 = TN_STRING_LITERAL("abcdef");
+    tn_string str2 = TN_STRING_LITERAL("abcxyz");
+    tn_string str3 = TN_STRING_LITERAL("xyzdef");
+
+    tn_string pfx = TN_STRING_LITERAL("abc");
+    tn_string sfx = TN_STRING_LITERAL("def");
+
+    assert(tn_strcmp(tn_strlcprefix(str1, str2), pfx) == 0);
+    assert(tn_strcmp(tn_strlcsuffix(str1, str3), sfx) == 0);
+
+    assert(tn_strlcprefix(str1, str3).str == NULL);
+    assert(tn_strlcsuffix(str1, str2).str == NULL);
+
+    assert(tn_strcmp(tn_strlcprefix(pfx, str1), pfx) == 0);
+    assert(tn_strcmp(tn_strlcsuffix(str3, sfx), sfx) == 0);
+
+    assert(tn_strlcprefix(TN_EMPTY_STRING, str1).str == NULL);
+    assert(tn_strlcprefix(str2, TN_EMPTY_STRING).str == NULL);
+    assert(tn_strlcsuffix(TN_EMPTY_STRING, str1).str == NULL);
+    assert(tn_strlcsuffix(str3, TN_EMPTY_STRING).str == NULL);
+}
+
+#endif    
+
+bool
+tn_strrchr(tn_string str, char ch, size_t *pos)
+{
+    size_t found;
+
+    if (!strscan->rchr(str.str, str.len, ch, &found))
+        return false;
+
+    if (pos != NULL)
+        *pos = found;
+    return true;
+}
+
+#if DO_TESTS
+static void test_strchr_strrchr(void)
+{
+    TEST_START;
+    tn_string str = TN_STRING_LITERAL("abc\0deffed\0cba");
+    size_t pos = (size_t)-1;
+
+    assert(tn_strchr(str, 'a', NULL));
+    assert(tn_strchr(str, 'd', NULL));
+    assert(tn_strchr(str, '\0', NULL));
+    assert(!tn_strchr(str, 'x', NULL));
+
+    assert(tn_strrchr(str, 'a', NULL));
+    assert(tn_strrchr(str, 'd', NULL));
+    assert(tn_strrchr(str, '\0', NULL));
+    assert(!tn_strrchr(str, 'x', NULL));
+
+    assert(tn_strchr(str, 'a', &pos) && pos == 0);
+    assert(tn_strchr(str, 'd', &pos) && pos == 4);
+    assert(tn_strchr(str, '\0', &pos) && pos == 3);
+    assert(!tn_strchr(str, 'x', &pos) && pos == 3);
+
+    assert(tn_strrchr(str, 'a', &pos) && pos == 13);
+    assert(tn_strrchr(str, 'd', &pos) && pos == 9);
+    assert(tn_strrchr(str, '\0', &pos) && pos == 10);
+    assert(!tn_strrchr(str, 'x', &pos) && pos == 10);
+
+    assert(!tn_strchr(TN_EMPTY_STRING, '\0', NULL));
+    assert(!tn_strrchr(TN_EMPTY_STRING, '\0', NULL));
+}
+
+static void test_strscan_engines(void)
+{
+    TEST_START;
+    char buf1[320];
+    char buf2[320];
+    unsigned seed = 54321;
+    unsigned iter;
+
+    for (iter = 0; iter < 4000; iter++)
+    {
+        size_t off1 = (size_t)rand_r(&seed) % 32;
+        size_t off2 = (size_t)rand_r(&seed) % 32;
+        size_t len = (size_t)rand_r(&seed) % (sizeof(buf1) - 32);
+        char ch = "ab\0"[(size_t)rand_r(&seed) % 3];
+        size_t expected_pos = (size_t)(-1);
+        bool expected_found;
+        size_t expected_pfx;
+        size_t expected_sfx;
+        size_t v;
+        size_t i;
+
+        for (i = 0; i < sizeof(buf1); i++)
+            buf1[i] = (char)('a' + rand_r(&seed) % 4);
+        /* Make long common prefixes and suffixes likely */
+        memcpy(buf2 + off2, buf1 + off1, len);
+        if (len > 0 && rand_r(&seed) % 2 == 0)
+            buf2[off2 + (size_t)rand_r(&seed) % len] ^= 1;
+
+        expected_found = strrchr_scalar(buf1 + off1, len, ch, &expected_pos);
+        expected_pfx = strlcprefix_scalar(buf1 + off1, buf2 + off2, len);
+        expected_sfx = strlcsuffix_scalar(buf1 + off1 + len,
+                                          buf2 + off2 + len, len);
+
+        for (v = 0; v < sizeof(strscan_variants) / sizeof(*strscan_variants);
+             v++)
+        {
+            const strscan_ops *ops = strscan_variants[v];
+            size_t pos = (size_t)(-1);
+
+            if (!strscan_usable(ops))
+                continue;
+            assert(ops->rchr(buf1 + off1, len, ch, &pos) == expected_found);
+            assert(!expected_found || pos == expected_pos);
+            assert(ops->lcprefix(buf1 + off1, buf2 + off2, len) ==
+                   expected_pfx);
+            assert(ops->lcsuffix(buf1 + off1 + len, buf2 + off2 + len, len) ==
+                   expected_sfx);
+        }
+    }
+}
+#endif
+
+/*
+ * Substring search is adaptive: needles of up to
+ * STRSTR_SHORT_NEEDLE bytes are located by skipping to candidate
+ * first bytes with memchr(), longer ones use the Two-Way algorithm
+ * (Crochemore & Perrin), which is linear in the worst case and needs
+ * no dynamic memory. Each Two-Way step is preceded by a Horspool
+ * bad-character shift on the last needle byte, so that on typical
+ * inputs most haystack positions are skipped without being compared.
+ */
+#define STRSTR_SHORT_NEEDLE 8
+
+typedef struct strstr_plan {
+    const uint8_t *needle;
+    size_t len;
+    size_t suffix;
+    size_t period;
+    bool periodic;
+    const size_t *shift;
+} strstr_plan;
+
+/*
+ * Computes a maximal suffix of the needle w.r.t. either the direct or
+ * the reversed byte ordering and its period
+ */
+static size_t
+strstr_maximal_suffix(const uint8_t *needle, size_t len, bool reversed,
+                      size_t *period)
+{
+    size_t ms = SIZE_MAX;
+    size_t j = 0;
+    size_t k = 1;
+    size_t p = 1;
+
+    while (j + k < len)
+    {
+        uint8_t a = needle[j + k];
+        uint8_t b = needle[ms + k];
+
+        if (a == b)
+        {
+            if (k != p)
+                k++;
+            else
+            {
+                j += p;
+                k = 1;
+            }
+        }
+        else if ((a < b) != reversed)
+        {
+            j += k;
+            k = 1;
+            p = j - ms;
+        }
+        else
+        {
+            ms = j++;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ms + 1;
+}
+
+static void
+strstr_prepare(strstr_plan *plan, const uint8_t *needle, size_t len,
+               size_t shift[UINT8_MAX + 1])
+{
+    size_t i;
+    size_t period1, period2;
+    size_t suffix1 = strstr_maximal_suffix(needle, len, false, &period1);
+    size_t suffix2 = strstr_maximal_suffix(needle, len, true, &period2);
+
+    plan->needle = needle;
+    plan->len = len;
+    if (suffix1 >= suffix2)
+    {
+        plan->suffix = suffix1;
+        plan->period = period1;
+    }
+    else
+    {
+        plan->suffix = suffix2;
+        plan->period = period2;
+    }
+
+    plan->periodic = plan->period <= len - plan->suffix &&
+        memcmp(needle, needle + plan->period, plan->suffix) == 0;
+    if (!plan->periodic)
+    {
+        plan->period = (plan->suffix > len - plan->suffix ?
+                        plan->suffix : len - plan->suffix) + 1;
+    }
+
+    for (i = 0; i < UINT8_MAX + 1; i++)
+        shift[i] = len;
+    for (i = 0; i < len; i++)
+        shift[needle[i]] = len - i - 1;
+    plan->shift = shift;
+}
+
+/*
+ * If @a reverse is true, the haystack is scanned backwards from its end,
+ * and @a plan must be prepared for the reversed needle. The position
+ * of the match is always counted from the start of the haystack
+ */
+static inline bool
+strstr_twoway(const strstr_plan *plan, const uint8_t *hay, size_t hlen,
+              bool reverse, size_t *pos)
+{
+#define HAY(_i) (reverse ? hay[hlen - 1 - (_i)] : hay[_i])
+    const uint8_t *needle = plan->needle;
+    size_t nlen = plan->len;
+    size_t memory = 0;
+    size_t j = 0;
+
+    while (hlen - j >= nlen)
+    {
+        size_t shift = plan->shift[HAY(j + nlen - 1)];
+        size_t i;
+
+        if (shift > 0)
+        {
+            /* A periodic needle cannot match until after
+             * the mismatching byte
+             */
+            if (memory != 0 && shift < plan->period)
+                shift = nlen - plan->period;
+            memory = 0;
+            j += shift;
+            continue;
+        }
+
+        i = plan->suffix > memory ? plan->suffix : memory;
+        while (i < nlen && needle[i] == HAY(i + j))
+            i++;
+        if (i < nlen)
+        {
+            j += i - plan->suffix + 1;
+            memory = 0;
+            continue;
+        }
+
+        i = plan->suffix;
+        while (i > memory && needle[i - 1] == HAY(i - 1 + j))
+            i--;
+        if (i <= memory)
+        {
+            *pos = reverse ? hlen - j - nlen : j;
+            return true;
+        }
+
+        j += plan->period;
+        if (plan->periodic)
+            memory = nlen - plan->period;
+    }
+    return false;
+#undef HAY
+}
+
+static bool
+strstr_short(const uint8_t *hay, size_t hlen,
+             const uint8_t *needle, size_t nlen, size_t *pos)
+{
+    const uint8_t *start = hay;
+    const uint8_t *last = hay + hlen - nlen;
+
+    while (hay <= last)
+    {
+        hay = memchr(hay, needle[0], (size_t)(last - hay) + 1);
+        if (hay == NULL)
+            return false;
+        if (memcmp(hay + 1, needle + 1, nlen - 1) == 0)
+        {
+            *pos = (size_t)(hay - start);
+            return true;
+        }
+        hay++;
+    }
+    return false;
+}
+
+bool
+tn_strstr(tn_string str, tn_string sub, size_t *pos)
+{
+    const uint8_t *hay = (const uint8_t *)str.str;
+    const uint8_t *needle = (const uint8_t *)sub.str;
+    size_t found = 0;
+    bool result;
+
+    if (sub.len == 0)
+    {
+        if (pos != NULL)
+            *pos = 0;
+        return true;
+    }
+
+    if (sub.len > str.len)
+        return false;
+
+    if (sub.len <= STRSTR_SHORT_NEEDLE)
+        result = strstr_short(hay, str.len, needle, sub.len, &found);
+    else
+    {
+        strstr_plan plan;
+        size_t shift[UINT8_MAX + 1];
+
+        strstr_prepare(&plan, needle, sub.len, shift);
+        result = strstr_twoway(&plan, hay, str.len, false, &found);
+    }
+
+    if (result && pos != NULL)
+        *pos = found;
+    return result;
+}
+
+#if DO_TESTS
+static void test_strstr(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("abc\0def\0ghi");
+    size_t pos = (size_t)(-1);
+
+    assert(tn_strstr(base, TN_EMPTY_STRING, NULL));
+    assert(tn_strstr(base, TN_STRING_LITERAL("abc"), NULL));
+    assert(tn_strstr(base, TN_STRING_LITERAL("\0ghi"), NULL));
+    assert(!tn_strstr(base, TN_STRING_LITERAL("xyz"), NULL));
+    assert(!tn_strstr(base, TN_STRING_LITERAL("averyveryveryverylongsubstring"), NULL));
+    assert(tn_strstr(TN_EMPTY_STRING, TN_EMPTY_STRING, NULL));
+    assert(!tn_strstr(TN_EMPTY_STRING, TN_STRING_LITERAL("abc"), NULL));
+
+    assert(tn_strstr(base, TN_EMPTY_STRING, &pos) && pos == 0);
+    assert(tn_strstr(base, TN_STRING_LITERAL("abc"), &pos) && pos == 0);
+    assert(tn_strstr(base, TN_STRING_LITERAL("\0ghi"), &pos) && pos == 7);
+    assert(!tn_strstr(base, TN_STRING_LITERAL("xyz"), &pos) && pos == 7);
+}
+
+static bool
+test_naive_strstr(tn_string str, tn_string sub, size_t *pos)
+{
+    size_t i;
+
+    for (i = 0; i + sub.len <= str.len; i++)
+    {
+        if (memcmp(str.str + i, sub.str, sub.len) == 0)
+        {
+            *pos = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+test_naive_strrstr(tn_string str, tn_string sub, size_t *pos)
+{
+    size_t i;
+
+    for (i = str.len - sub.len + 1; sub.len <= str.len && i > 0; i--)
+    {
+        if (memcmp(str.str + i - 1, sub.str, sub.len) == 0)
+        {
+            *pos = i - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_strstr_engines(void)
+{
+    TEST_START;
+    tn_string base =
+        TN_STRING_LITERAL("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab\0"
+                          "abababababababababababababababababababababc\0"
+                          "the quick brown fox jumps over the lazy dog");
+    char hay[512];
+    char needle[80];
+    unsigned seed = 12345;
+    unsigned iter;
+    size_t pos = (size_t)(-1);
+
+    assert(tn_strstr(base, TN_STRING_LITERAL("aaaaaaaaaab\0abab"), &pos) &&
+           pos == 31);
+    assert(tn_strstr(base,
+                     TN_STRING_LITERAL("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab"),
+                     &pos) && pos == 8);
+    assert(tn_strstr(base,
+                     TN_STRING_LITERAL("babababababababababababababababababc"),
+                     &pos) && pos == 50);
+    assert(tn_strstr(base, TN_STRING_LITERAL("\0the quick brown fox jumps"),
+                     &pos) && pos == 86);
+    assert(tn_strstr(base, TN_STRING_LITERAL("lazy dog"), &pos) &&
+           pos == base.len - 8);
+    assert(!tn_strstr(base, TN_STRING_LITERAL("lazy dogs"), NULL));
+    assert(!tn_strstr(base,
+                      TN_STRING_LITERAL("abababababababababababababababababd"),
+                      NULL));
+
+    /* Differential check on a small alphabet, so that partial
+     * matches and periodic needles are frequent
+     */
+    for (iter = 0; iter < 2000; iter++)
+    {
+        size_t hlen = (size_t)rand_r(&seed) % sizeof(hay);
+        size_t nlen = (size_t)rand_r(&seed) % sizeof(needle) + 1;
+        size_t i;
+        size_t expected = 0;
+        size_t actual = 0;
+        tn_string hstr = {.str = hay, .len = hlen};
+        tn_string nstr = {.str = needle, .len = nlen};
+        const tn_strsearcher *searcher;
+        bool found;
+
+        for (i = 0; i < hlen; i++)
+            hay[i] = (char)(rand_r(&seed) % 3);
+        if (nlen <= hlen && rand_r(&seed) % 2 == 0)
+            memcpy(needle, hay + (size_t)rand_r(&seed) % (hlen - nlen + 1), nlen);
+        else
+        {
+            for (i = 0; i < nlen; i++)
+                needle[i] = (char)(rand_r(&seed) % 3);
+        }
+
+        found = test_naive_strstr(hstr, nstr, &expected);
+        assert(tn_strstr(hstr, nstr, &actual) == found);
+        assert(!found || actual == expected);
+
+        searcher = tn_strsearcher_create(nstr);
+        assert(tn_strsearcher_find(searcher, hstr, &actual) == found);
+        assert(!found || actual == expected);
+        found = test_naive_strrstr(hstr, nstr, &expected);
+        assert(tn_strsearcher_rfind(searcher, hstr, &actual) == found);
+        assert(!found || actual == expected);
+    }
+}
+#endif
+
+/*
+ * A rough estimate of how common a byte is in typical text
+ * and binary data, the higher the more frequent
+ */
+hint_no_side_effects
+static unsigned
+strsearch_byte_rank(uint8_t c)
+{
+    static const char common_letters[] = "etaoinshrdlucmfwypvbgkjqxz";
+    const char *letter;
+
+    if (c == ' ')
+        return 255;
+    if (c == '\0')
+        return 220;
+    if (c >= 'a' && c <= 'z')
+    {
+        letter = memchr(common_letters, c, sizeof(common_letters) - 1);
+        return 250 - (unsigned)(letter - common_letters);
+    }
+    if (c == '\n' || c == ',' || c == '.' || c == '_' || c == '-' ||
+        c == '/' || c == '"' || c == '(' || c == ')' || c == 0xff)
+        return 200;
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        return 180;
+    if (c >= 0x20 && c < 0x7f)
+        return 120;
+    return 60;
+}
+
+struct tn_strsearcher {
+    tn_string needle;
+    uint8_t rare;
+    size_t rare_offset;
+    strstr_plan forward;
+    strstr_plan backward;
+    size_t forward_shift[UINT8_MAX + 1];
+    size_t backward_shift[UINT8_MAX + 1];
+};
+
+const tn_strsearcher *
+tn_strsearcher_create(tn_string needle)
+{
+    tn_strsearcher *s = TN_NEW(tn_strsearcher);
+    size_t i;
+
+    s->needle = tn_strdupmem(needle.len, (const uint8_t *)needle.str);
+    if (needle.len == 0)
+        return s;
+
+    s->rare = (uint8_t)s->needle.str[0];
+    for (i = 1; i < needle.len; i++)
+    {
+        uint8_t c = (uint8_t)s->needle.str[i];
+
+        if (strsearch_byte_rank(c) < strsearch_byte_rank(s->rare))
+        {
+            s->rare = c;
+            s->rare_offset = i;
+        }
+    }
+
+    if (needle.len > STRSTR_SHORT_NEEDLE)
+    {
+        uint8_t *reversed = tn_alloc_blob(needle.len);
+
+        for (i = 0; i < needle.len; i++)
+            reversed[i] = (uint8_t)s->needle.str[needle.len - i - 1];
+
+        strstr_prepare(&s->forward, (const uint8_t *)s->needle.str,
+                       needle.len, s->forward_shift);
+        strstr_prepare(&s->backward, reversed, needle.len,
+                       s->backward_shift);
+    }
+
+    return s;
+}
+
+tn_string
+tn_strsearcher_needle(const tn_strsearcher *searcher)
+{
+    return searcher->needle;
+}
+
+/*
+ * Short needles are located by skipping to the occurrences
+ * of their rarest byte
+ */
+static bool
+strsearcher_find_short(const tn_strsearcher *s, const uint8_t *hay,
+                       size_t hlen, size_t *pos)
+{
+    const uint8_t *needle = (const uint8_t *)s->needle.str;
+    size_t nlen = s->needle.len;
+    const uint8_t *scan = hay + s->rare_offset;
+    const uint8_t *last = hay + hlen - nlen + s->rare_offset;
+
+    while (scan <= last)
+    {
+        scan = memchr(scan, s->rare, (size_t)(last - scan) + 1);
+        if (scan == NULL)
+            return false;
+        if (memcmp(scan - s->rare_offset, needle, nlen) == 0)
+        {
+            *pos = (size_t)(scan - s->rare_offset - hay);
+            return true;
+        }
+        scan++;
+    }
+    return false;
+}
+
+static bool
+strsearcher_rfind_short(const tn_strsearcher *s, const uint8_t *hay,
+                        size_t hlen, size_t *pos)
+{
+    const uint8_t *needle = (const uint8_t *)s->needle.str;
+    size_t nlen = s->needle.len;
+    size_t i;
+
+    for (i = hlen - nlen + 1; i > 0; i--)
+    {
+        if (hay[i - 1 + s->rare_offset] == s->rare &&
+            memcmp(hay + i - 1, needle, nlen) == 0)
+        {
+            *pos = i - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Finds the first match at or after @a from */
+static bool
+strsearcher_find_from(const tn_strsearcher *s, tn_string str, size_t from,
+                      size_t *pos)
+{
+    const uint8_t *hay = (const uint8_t *)str.str + from;
+    size_t hlen = str.len - from;
+    size_t found = 0;
+    bool result;
+
+    if (s->needle.len == 0)
+    {
+        *pos = from;
+        return true;
+    }
+    if (s->needle.len > hlen)
+        return false;
+
+    if (s->needle.len <= STRSTR_SHORT_NEEDLE)
+        result = strsearcher_find_short(s, hay, hlen, &found);
+    else
+        result = strstr_twoway(&s->forward, hay, hlen, false, &found);
+
+    if (result)
+        *pos = from + found;
+    return result;
+}
+
+bool
+tn_strsearcher_find(const tn_strsearcher *searcher, tn_string str,
+                    size_t *pos)
+{
+    size_t found = 0;
+
+    if (!strsearcher_find_from(searcher, str, 0, &found))
+        return false;
+    if (pos != NULL)
+        *pos = found;
+    return true;
+}
+
+bool
+tn_strsearcher_rfind(const tn_strsearcher *searcher, tn_string str,
+                     size_t *pos)
+{
+    const uint8_t *hay = (const uint8_t *)str.str;
+    size_t found = 0;
+    bool result;
+
+    if (searcher->needle.len > str.len)
+        return false;
+
+    if (searcher->needle.len == 0)
+    {
+        found = str.len;
+        result = true;
+    }
+    else if (searcher->needle.len <= STRSTR_SHORT_NEEDLE)
+        result = strsearcher_rfind_short(searcher, hay, str.len, &found);
+    else
+    {
+        result = strstr_twoway(&searcher->backward, hay, str.len, true,
+                               &found);
+    }
+
+    if (result && pos != NULL)
+        *pos = found;
+    return result;
+}
+
+size_t
+tn_strsearcher_findall(const tn_strsearcher *searcher, tn_string str,
+                       size_t max, size_t positions[var_size(max)])
+{
+    size_t step = searcher->needle.len == 0 ? 1 : searcher->needle.len;
+    size_t from = 0;
+    size_t n;
+
+    for (n = 0; n < max && from <= str.len; n++)
+    {
+        if (!strsearcher_find_from(searcher, str, from, &positions[n]))
+            break;
+        from = positions[n] + step;
+    }
+    return n;
+}
+
+size_t
+tn_strsearcher_count(const tn_strsearcher *searcher, tn_string str)
+{
+    size_t step = searcher->needle.len == 0 ? 1 : searcher->needle.len;
+    size_t from = 0;
+    size_t pos;
+    size_t n;
+
+    for (n = 0; from <= str.len; n++)
+    {
+        if (!strsearcher_find_from(searcher, str, from, &pos))
+            break;
+        from = pos + step;
+    }
+    return n;
+}
+
+#if DO_TESTS
+static void test_strsearcher(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("abc\0abcabc\0abc-xyzzy-abcabcabc\0");
+    tn_string longbase =
+        TN_STRING_LITERAL("ababababababababababab\0"
+                          "ababababababababababab\0"
+                          "abababababababababababab");
+    const tn_strsearcher *abc = tn_strsearcher_create(TN_STRING_LITERAL("abc"));
+    const tn_strsearcher *zero = tn_strsearcher_create(TN_STRING_LITERAL("\0a"));
+    const tn_strsearcher *empty = tn_strsearcher_create(TN_EMPTY_STRING);
+    const tn_strsearcher *longer =
+        tn_strsearcher_create(TN_STRING_LITERAL("abababababababababab\0"));
+    size_t positions[8];
+    size_t pos = (size_t)-1;
+
+    assert(tn_strcmp(tn_strsearcher_needle(abc),
+                     TN_STRING_LITERAL("abc")) == 0);
+
+    assert(tn_strsearcher_find(abc, base, &pos) && pos == 0);
+    assert(tn_strsearcher_rfind(abc, base, &pos) && pos == 27);
+    assert(tn_strsearcher_find(zero, base, &pos) && pos == 3);
+    assert(tn_strsearcher_rfind(zero, base, &pos) && pos == 10);
+    assert(!tn_strsearcher_find(zero, TN_STRING_LITERAL("\0"), NULL));
+    assert(!tn_strsearcher_rfind(abc, TN_EMPTY_STRING, NULL));
+
+    assert(tn_strsearcher_count(abc, base) == 7);
+    assert(tn_strsearcher_findall(abc, base, 8, positions) == 7);
+    assert(positions[0] == 0 && positions[1] == 4 && positions[2] == 7 &&
+           positions[3] == 11 && positions[4] == 21 && positions[5] == 24 &&
+           positions[6] == 27);
+    assert(tn_strsearcher_findall(abc, base, 2, positions) == 2);
+    assert(positions[1] == 4);
+
+    assert(tn_strsearcher_find(empty, base, &pos) && pos == 0);
+    assert(tn_strsearcher_rfind(empty, base, &pos) && pos == base.len);
+    assert(tn_strsearcher_count(empty, TN_STRING_LITERAL("ab")) == 3);
+
+    assert(tn_strsearcher_find(longer, longbase, &pos) && pos == 2);
+    assert(tn_strsearcher_rfind(longer, longbase, &pos) && pos == 25);
+    assert(tn_strsearcher_count(longer, longbase) == 2);
+    assert(!tn_strsearcher_find(longer, tn_substr(longbase, 0, 22), NULL));
+}
+#endif
+
+/*
+ * Keyword sets are compiled into an Aho-Corasick automaton with a
+ * complete transition table. To keep the table compact, the input
+ * alphabet is reduced to the bytes that actually occur in keywords,
+ * all other bytes sharing a single class
+ */
+struct tn_strkeywords {
+    size_t nclasses;
+    uint16_t classes[UINT8_MAX + 1];
+    const uint32_t *delta;
+    /* Keyword index + 1 of the longest keyword that ends in a state */
+    const uint32_t *match;
+    const size_t *lengths;
+};
+
+const tn_strkeywords *
+tn_strkeywords_create(size_t n, const tn_string keywords[var_size(n)])
+{
+    tn_strkeywords *kw = TN_NEW(tn_strkeywords);
+    size_t *lengths = tn_alloc_blob(n * sizeof(*lengths) + 1);
+    size_t maxstates = 1;
+    size_t nstates = 1;
+    uint32_t *delta;
+    uint32_t *match;
+    uint32_t *fail;
+    uint32_t *queue;
+    size_t head, tail;
+    size_t i, j;
+
+    assert(n < UINT32_MAX);
+    kw->nclasses = 1;
+    for (i = 0; i < n; i++)
+    {
+        lengths[i] = keywords[i].len;
+        maxstates += keywords[i].len;
+        for (j = 0; j < keywords[i].len; j++)
+        {
+            uint8_t c = (uint8_t)keywords[i].str[j];
+
+            if (kw->classes[c] == 0)
+                kw->classes[c] = (uint16_t)kw->nclasses++;
+        }
+    }
+    assert(maxstates < UINT32_MAX);
+
+    delta = tn_alloc_blob(maxstates * kw->nclasses * sizeof(*delta));
+    memset(delta, 0, maxstates * kw->nclasses * sizeof(*delta));
+    match = tn_alloc_blob(maxstates * sizeof(*match));
+    memset(match, 0, maxstates * sizeof(*match));
+
+    /* Build the trie; state 0 is the root, so a zero transition
+     * from a non-root state means there is no edge yet
+     */
+    for (i = 0; i < n; i++)
+    {
+        uint32_t state = 0;
+
+        for (j = 0; j < keywords[i].len; j++)
+        {
+            uint32_t *next = &delta[state * kw->nclasses +
+                                    kw->classes[(uint8_t)keywords[i].str[j]]];
+            if (*next == 0)
+                *next = (uint32_t)nstates++;
+            state = *next;
+        }
+        if (match[state] == 0)
+            match[state] = (uint32_t)i + 1;
+    }
+
+    /* Turn the trie into a complete automaton in breadth-first order */
+    fail = tn_alloc_blob(nstates * sizeof(*fail));
+    queue = tn_alloc_blob(nstates * sizeof(*queue));
+    head = tail = 0;
+    for (j = 0; j < kw->nclasses; j++)
+    {
+        uint32_t next = delta[j];
+
+        if (next != 0)
+        {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail)
+    {
+        uint32_t state = queue[head++];
+
+        if (match[state] == 0)
+            match[state] = match[fail[state]];
+
+        for (j = 0; j < kw->nclasses; j++)
+        {
+            uint32_t *next = &delta[state * kw->nclasses + j];
+            uint32_t fallback = delta[fail[state] * kw->nclasses + j];
+
+            if (*next == 0)
+                *next = fallback;
+            else
+            {
+                fail[*next] = fallback;
+                queue[tail++] = *next;
+            }
+        }
+    }
+
+    kw->delta = delta;
+    kw->match = match;
+    kw->lengths = lengths;
+    return kw;
+}
+
+bool
+tn_strkeywords_find(const tn_strkeywords *keywords, tn_string str,
+                    size_t *pos, size_t *which)
+{
+    uint32_t state = 0;
+    uint32_t found = keywords->match[0];
+    size_t i;
+
+    for (i = 0; found == 0 && i < str.len; i++)
+    {
+        state = keywords->delta[state * keywords->nclasses +
+                                keywords->classes[(uint8_t)str.str[i]]];
+        found = keywords->match[state];
+    }
+    if (found == 0)
+        return false;
+
+    if (pos != NULL)
+        *pos = i - keywords->lengths[found - 1];
+    if (which != NULL)
+        *which = found - 1;
+    return true;
+}
+
+#if DO_TESTS
+static void test_strkeywords(void)
+{
+    TEST_START;
+    tn_string words[] = {
+        TN_STRING_LITERAL("he"),
+        TN_STRING_LITERAL("she"),
+        TN_STRING_LITERAL("his"),
+        TN_STRING_LITERAL("hers"),
+        TN_STRING_LITERAL("\0x"),
+        TN_STRING_LITERAL("he"),
+    };
+    const tn_strkeywords *kw = tn_strkeywords_create(6, words);
+    const tn_strkeywords *none = tn_strkeywords_create(0, words);
+    tn_string empty_word[] = {TN_EMPTY_STRING};
+    size_t pos = (size_t)-1;
+    size_t which = (size_t)-1;
+
+    assert(tn_strkeywords_find(kw, TN_STRING_LITERAL("ushers"),
+                               &pos, &which));
+    assert(pos == 1 && which == 1);
+    assert(tn_strkeywords_find(kw, TN_STRING_LITERAL("ahhis"),
+                               &pos, &which));
+    assert(pos == 2 && which == 2);
+    assert(tn_strkeywords_find(kw, TN_STRING_LITERAL("hhe"), &pos, &which));
+    assert(pos == 1 && which == 0);
+    assert(tn_strkeywords_find(kw, TN_STRING_LITERAL("a\0\0xz"),
+                               &pos, &which));
+    assert(pos == 2 && which == 4);
+    assert(!tn_strkeywords_find(kw, TN_STRING_LITERAL("shx\0"), NULL, NULL));
+    assert(!tn_strkeywords_find(kw, TN_EMPTY_STRING, NULL, NULL));
+    assert(!tn_strkeywords_find(none, TN_STRING_LITERAL("he"), NULL, NULL));
+
+    assert(tn_strkeywords_find(tn_strkeywords_create(1, empty_word),
+                               TN_STRING_LITERAL("abc"), &pos, &which));
+    assert(pos == 0 && which == 0);
+}
+#endif
+
+bool
+tn_strisprefix(tn_string prefix, tn_string str)
+{
+    if (prefix.len > str.len)
+        return false;
+
+    return memcmp(str.str, prefix.str, prefix.len) == 0;
+}
+
+bool
+tn_strissuffix(tn_string suffix, tn_string str)
+{
+    if (suffix.len > str.len)
+        return false;
+
+    return memcmp(str.str + str.len - suffix.len,
+                  suffix.str, suffix.len) == 0;
+}
+
+#if DO_TESTS
+static void test_isprefix_issuffix(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("abc\0def");
+
+    assert(tn_strisprefix(TN_STRING_LITERAL("abc\0"), base));
+    assert(tn_strissuffix(TN_STRING_LITERAL("\0def"), base));
+    assert(tn_strisprefix(TN_EMPTY_STRING, base));
+    assert(tn_strissuffix(TN_EMPTY_STRING, base));
+    assert(!tn_strisprefix(TN_STRING_LITERAL("abc\0z"), base));
+    assert(!tn_strissuffix(TN_STRING_LITERAL("z\0def"), base));
+
+    assert(!tn_strisprefix(TN_STRING_LITERAL("abc\0defghi"), base));
+    assert(!tn_strissuffix(TN_STRING_LITERAL("abc\0defghi"), base));
+}
+#endif
+
+bool
+tn_strtok(tn_string *src, bool (*predicate)(char c), tn_string *tok)
+{
+    size_t i;
+    size_t start;
+
+    for (i = 0; i < src->len; i++)
+    {
+        if (!predicate(src->str[i]))
+            break;
+    }
+    if (i == src->len)
+        return false;
+
+    start = i;
+    for (; i < src->len; i++)
+    {
+        if (predicate(src->str[i]))
+            break;
+    }
+    if (tok)
+    {
+        tok->str = src->str + start;
+        tok->len = i - start;
+    }
+    src->str += i;
+    src->len -= i;
+
+    return true;
+}
+
+#if DO_TESTS
+hint_no_side_effects
+static bool test_eq_space(char c)
+{
+    return c == ' ';
+}
+
+static void test_strtok(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("    abc\t    def ghi    ");
+    tn_string token = TN_EMPTY_STRING;
+
+    assert(tn_strtok(&base, test_eq_space, &token) &&
+           tn_strcmp(token, TN_STRING_LITERAL("abc\t")) == 0);
+    assert(tn_strtok(&base, test_eq_space, &token) &&
+           tn_strcmp(token, TN_STRING_LITERAL("def")) == 0);
+    assert(tn_strtok(&base, test_eq_space, &token) &&
+           tn_strcmp(token, TN_STRING_LITERAL("ghi")) == 0);
+    assert(!tn_strtok(&base, test_eq_space, &token) &&
+           tn_strcmp(base, TN_STRING_LITERAL("    ")) == 0 &&
+           tn_strcmp(token, TN_STRING_LITERAL("ghi")) == 0);
+}
+#endif
+
+tn_string
+tn_strmap(tn_string str, char (*func)(char ch))
+{
+    size_t i;
+    char *buf;
+    
+    if (str.len == 0)
+        return TN_EMPTY_STRING;
+
+    buf = tn_alloc_blob(str.len + 1);
+    for (i = 0; i < str.len; i++)
+        buf[i] = func(str.str[i]);
+
+    return (tn_string){.str = buf, .len = str.len};
+}
+
+#if DO_TESTS
+hint_no_side_effects
+static char test_cvt(char c)
+{
+    return c == ' ' ? '+' : c;
+}
+
+static void test_strmap(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("abc\0def  ghi ");
+
+    assert(tn_strcmp(tn_strmap(base, test_cvt),
+                     TN_STRING_LITERAL("abc\0def++ghi+")) == 0);
+    assert(tn_strmap(TN_EMPTY_STRING, test_cvt).str == NULL);
+}
+#endif
+
+tn_string
+tn_strfilter(tn_string str, bool (*predicate)(char ch))
+{
+    char *buf;
+    size_t i, j;
+    
+    if (str.len == 0)
+        return TN_EMPTY_STRING;
+
+    buf = tn_alloc_blob(str.len + 1);
+    for (i = 0, j = 0; i < str.len; i++)
+    {
+        if (predicate(str.str[i]))
+            buf[j++] = str.str[i];
+    }
+    buf[j] = '\0';
+    buf = tn_realloc(buf, j + 1);
+
+    return (tn_string){.str = buf, .len = j};
+}
+
+#if DO_TESTS
+hint_no_side_effects
+static bool test_neq_space(char c)
+{
+    return c != ' ';
+}
+
+
+static void test_strfilter(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("  abc   de\0fg i j k   ");
+
+    assert(tn_strcmp(tn_strfilter(base, test_neq_space),
+                     TN_STRING_LITERAL("abcde\0fgijk")) == 0);
+    assert(tn_strfilter(TN_EMPTY_STRING, test_neq_space).str == NULL);
+}
+#endif
+
+/*
+ * Runs between delimiters are usually short, so the first few bytes
+ * are checked inline before going to the vectorized code
+ */
+#define CHARSET_INLINE_SPAN 16
+
+static inline size_t
+charset_span(const tn_charset *set, const char *str, size_t len, bool member)
+{
+    size_t head = len < CHARSET_INLINE_SPAN ? len : CHARSET_INLINE_SPAN;
+    size_t i;
+
+    for (i = 0; i < head; i++)
+    {
+        if (tn_charset_has(set, str[i]) != member)
+            return i;
+    }
+    if (i == len)
+        return i;
+    return i + strscan->span(set, str + i, len - i, member);
+}
+
+static void
+charset_add(tn_charset *set, uint8_t c)
+{
+    set->bits[c / 32] |= 1u << (c % 32);
+    set->nibbles[c >> 7][c & 0x0f] |= (uint8_t)(1u << ((c >> 4) & 7));
+}
+
+void
+tn_charset_init(tn_charset *set, tn_string chars)
+{
+    size_t i;
+
+    memset(set, 0, sizeof(*set));
+    for (i = 0; i < chars.len; i++)
+        charset_add(set, (uint8_t)chars.str[i]);
+}
+
+void
+tn_charset_init_predicate(tn_charset *set, bool (*predicate)(char ch))
+{
+    unsigned c;
+
+    memset(set, 0, sizeof(*set));
+    for (c = 0; c <= UINT8_MAX; c++)
+    {
+        if (predicate((char)c))
+            charset_add(set, (uint8_t)c);
+    }
+}
+
+size_t
+tn_strspan(tn_string str, const tn_charset *set)
+{
+    return charset_span(set, str.str, str.len, true);
+}
+
+size_t
+tn_strcspan(tn_string str, const tn_charset *set)
+{
+    return charset_span(set, str.str, str.len, false);
+}
+
+bool
+tn_strtok_set(tn_string *src, const tn_charset *delims, tn_string *tok)
+{
+    size_t start = charset_span(delims, src->str, src->len, true);
+    size_t end;
+
+    if (start == src->len)
+        return false;
+
+    end = start + charset_span(delims, src->str + start, src->len - start,
+                               false);
+    if (tok)
+    {
+        tok->str = src->str + start;
+        tok->len = end - start;
+    }
+    src->str += end;
+    src->len -= end;
+
+    return true;
+}
+
+tn_string
+tn_strfilter_set(tn_string str, const tn_charset *set)
+{
+    char *buf;
+    size_t i, j;
+
+    if (str.len == 0)
+        return TN_EMPTY_STRING;
+
+    buf = tn_alloc_blob(str.len + 1);
+    for (i = 0, j = 0; i < str.len;)
+    {
+        size_t run = charset_span(set, str.str + i, str.len - i, true);
+
+        memcpy(buf + j, str.str + i, run);
+        j += run;
+        i += run;
+        i += charset_span(set, str.str + i, str.len - i, false);
+    }
+    buf[j] = '\0';
+    buf = tn_realloc(buf, j + 1);
+
+    return (tn_string){.str = buf, .len = j};
+}
+
+tn_string
+tn_strtranslate(tn_string str, const char table[UINT8_MAX + 1])
+{
+    size_t i;
+    char *buf;
+
+    if (str.len == 0)
+        return TN_EMPTY_STRING;
+
+    buf = tn_alloc_blob(str.len + 1);
+    for (i = 0; i < str.len; i++)
+        buf[i] = table[(uint8_t)str.str[i]];
+    buf[str.len] = '\0';
+
+    return (tn_string){.str = buf, .len = str.len};
+}
+
+#if DO_TESTS
+hint_no_side_effects
+static bool test_is_delim(char c)
+{
+    return c == ' ' || c == '\t' || c == ',' || (uint8_t)c >= 0xf0;
+}
+
+static void test_charset(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("  abc\t,de\0f \xf1 g\xe0h ,");
+    tn_string token = TN_EMPTY_STRING;
+    tn_charset delims;
+    tn_charset from_predicate;
+    char table[UINT8_MAX + 1];
+    char buf[300];
+    unsigned seed = 777;
+    unsigned iter;
+    unsigned c;
+
+    tn_charset_init(&delims, TN_STRING_LITERAL(" \t,"
+                                               "\xf0\xf1\xf2\xf3\xf4\xf5\xf6\xf7"
+                                               "\xf8\xf9\xfa\xfb\xfc\xfd\xfe\xff"));
+    tn_charset_init_predicate(&from_predicate, test_is_delim);
+    assert(memcmp(&delims, &from_predicate, sizeof(delims)) == 0);
+    assert(tn_charset_has(&delims, ','));
+    assert(tn_charset_has(&delims, '\xff'));
+    assert(!tn_charset_has(&delims, '\0'));
+    assert(!tn_charset_has(&delims, '\xe0'));
+
+    assert(tn_strspan(base, &delims) == 2);
+    assert(tn_strcspan(base, &delims) == 0);
+    assert(tn_strcspan(tn_substr(base, 2, base.len), &delims) == 3);
+    assert(tn_strspan(TN_EMPTY_STRING, &delims) == 0);
+
+    assert(tn_strtok_set(&base, &delims, &token) &&
+           tn_strcmp(token, TN_STRING_LITERAL("abc")) == 0);
+    assert(tn_strtok_set(&base, &delims, &token) &&
+           tn_strcmp(token, TN_STRING_LITERAL("de\0f")) == 0);
+    assert(tn_strtok_set(&base, &delims, &token) &&
+           tn_strcmp(token, TN_STRING_LITERAL("g\xe0h")) == 0);
+    assert(!tn_strtok_set(&base, &delims, &token) &&
+           tn_strcmp(base, TN_STRING_LITERAL(" ,")) == 0 &&
+           tn_strcmp(token, TN_STRING_LITERAL("g\xe0h")) == 0);
+
+    assert(tn_strcmp(tn_strfilter_set(TN_STRING_LITERAL("a, b,\xf3,c"),
+                                      &delims),
+                     TN_STRING_LITERAL(", ,\xf3,")) == 0);
+    assert(tn_strfilter_set(TN_EMPTY_STRING, &delims).str == NULL);
+
+    for (c = 0; c <= UINT8_MAX; c++)
+        table[c] = tn_charset_has(&delims, (char)c) ? '_' : (char)c;
+    assert(tn_strcmp(tn_strtranslate(TN_STRING_LITERAL("a, b\xfe\0"), table),
+                     TN_STRING_LITERAL("a__b_\0")) == 0);
+    assert(tn_strtranslate(TN_EMPTY_STRING, table).str == NULL);
+
+    /* Differential check of vectorized classification
+     * on random sets */
+    for (iter = 0; iter < 500; iter++)
+    {
+        tn_charset set;
+        size_t off = (size_t)rand_r(&seed) % 32;
+        size_t len = (size_t)rand_r(&seed) % (sizeof(buf) - 32);
+        size_t i;
+        size_t v;
+
+        memset(&set, 0, sizeof(set));
+        for (c = 0; c <= UINT8_MAX; c++)
+        {
+            if (rand_r(&seed) % 16 == 0)
+                charset_add(&set, (uint8_t)c);
+        }
+        for (i = 0; i < sizeof(buf); i++)
+        {
+            /* Long runs of members and non-members */
+            buf[i] = (char)(rand_r(&seed) % 8 == 0 ? rand_r(&seed) :
+                            i > 0 ? buf[i - 1] : 0);
+        }
+
+        for (v = 0; v < sizeof(strscan_variants) / sizeof(*strscan_variants);
+             v++)
+        {
+            const strscan_ops *ops = strscan_variants[v];
+
+            if (!strscan_usable(ops))
+                continue;
+            for (i = 0; i < len; i += 1 + (size_t)rand_r(&seed) % 16)
+            {
+                assert(ops->span(&set, buf + off + i, len - i, true) ==
+                       charset_span_scalar(&set, buf + off + i, len - i,
+                                           true));
+                assert(ops->span(&set, buf + off + i, len - i, false) ==
+                       charset_span_scalar(&set, buf + off + i, len - i,
+                                           false));
+            }
+        }
+    }
+}
+#endif
+
+size_t
+tn_strsplitn(tn_string str, char sep, size_t max,
+             tn_string fields[var_size(max)])
+{
+    size_t n = 0;
+    size_t start = 0;
+    size_t i = 0;
+
+    if (max == 0)
+        return 0;
+
+#if PLATFORM_ARCH_IS_amd64
+    /* Separators are found 32 at a time, which is much cheaper than
+     * a memchr() call per field when fields are short */
+    {
+        __m128i pattern = _mm_set1_epi8(sep);
+
+        for (; n + 1 < max && i + 2 * sizeof(__m128i) <= str.len;
+             i += 2 * sizeof(__m128i))
+        {
+            const __m128i *block = (const __m128i *)(str.str + i);
+            unsigned mask = (unsigned)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128(block), pattern)) |
+                (unsigned)_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128(block + 1), pattern)) << 16;
+
+            for (; mask != 0 && n + 1 < max; mask &= mask - 1)
+            {
+                size_t pos = i + (size_t)__builtin_ctz(mask);
+
+                fields[n++] = tn_substr(str, start, pos - start);
+                start = pos + 1;
+            }
+        }
+        if (i < start)
+            i = start;
+    }
+#endif
+
+    while (n + 1 < max && i < str.len)
+    {
+        const char *found = memchr(str.str + i, sep, str.len - i);
+        size_t pos;
+
+        if (found == NULL)
+            break;
+        pos = (size_t)(found - str.str);
+        fields[n++] = tn_substr(str, start, pos - start);
+        start = i = pos + 1;
+    }
+    fields[n++] = tn_substr(str, start, str.len - start);
+
+    return n;
+}
+
+#if DO_TESTS
+static void test_strsplit(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("ab,,c\0d,");
+    tn_strsplitter iter = TN_STRSPLITTER_INIT(base, ',');
+    tn_string field = TN_EMPTY_STRING;
+    tn_string fields[40];
+    char buf[200];
+    unsigned seed = 4242;
+    unsigned iter_no;
+
+    assert(tn_strsplit_next(&iter, &field) &&
+           tn_strcmp(field, TN_STRING_LITERAL("ab")) == 0);
+    assert(tn_strsplit_next(&iter, &field) && field.str == NULL);
+    assert(tn_strsplit_next(&iter, &field) &&
+           tn_strcmp(field, TN_STRING_LITERAL("c\0d")) == 0);
+    assert(tn_strsplit_next(&iter, &field) && field.str == NULL);
+    assert(!tn_strsplit_next(&iter, &field));
+
+    iter = TN_STRSPLITTER_INIT(TN_EMPTY_STRING, ',');
+    assert(tn_strsplit_next(&iter, &field) && field.len == 0);
+    assert(!tn_strsplit_next(&iter, &field));
+
+    assert(tn_strsplitn(base, ',', 10, fields) == 4);
+    assert(tn_strcmp(fields[2], TN_STRING_LITERAL("c\0d")) == 0);
+    assert(fields[3].str == NULL);
+    assert(tn_strsplitn(base, ',', 2, fields) == 2);
+    assert(tn_strcmp(fields[1], TN_STRING_LITERAL(",c\0d,")) == 0);
+    assert(tn_strsplitn(base, ',', 0, fields) == 0);
+    assert(tn_strsplitn(base, ';', 10, fields) == 1 &&
+           tn_strcmp(fields[0], base) == 0);
+    assert(tn_strsplitn(TN_EMPTY_STRING, ',', 10, fields) == 1 &&
+           fields[0].str == NULL);
+
+    /* Differential check against the iterator */
+    for (iter_no = 0; iter_no < 2000; iter_no++)
+    {
+        tn_string str = {.str = buf,
+                         .len = (size_t)rand_r(&seed) % sizeof(buf)};
+        size_t max = (size_t)rand_r(&seed) % (sizeof(fields) /
+                                               sizeof(*fields));
+        size_t n;
+        size_t i;
+
+        for (i = 0; i < str.len; i++)
+            buf[i] = rand_r(&seed) % 6 == 0 ? ',' : 'x';
+        n = tn_strsplitn(str, ',', max, fields);
+        iter = TN_STRSPLITTER_INIT(str, ',');
+        for (i = 0; i + 1 < n; i++)
+        {
+            assert(tn_strsplit_next(&iter, &field));
+            assert(field.str == fields[i].str && field.len == fields[i].len);
+        }
+        if (n > 0)
+        {
+            assert(!iter.done);
+            assert(fields[n - 1].len == iter.rest.len &&
+                   (iter.rest.len == 0 ||
+                    fields[n - 1].str == iter.rest.str));
+        }
+        else
+            assert(max == 0);
+        if (n < max)
+        {
+            assert(tn_strsplit_next(&iter, &field));
+            assert(!tn_strsplit_next(&iter, &field));
+        }
+    }
+}
+#endif
+
+tn_string
+tn_strrepeat(tn_string str, unsigned n)
+{
+    if (n == 0 || str.len == 0)
+        return TN_EMPTY_STRING;
+    if (n == 1)
+        return str;
+    else
+    {
+        tn_strbuf buf = TN_STRBUF_INIT;
+        unsigned i;
+
+        tn_strbuf_reserve(&buf, str.len * n);
+        for (i = 0; i < n; i++)
+            tn_strbuf_append(&buf, str);
+
+        return tn_strbuf_finish(&buf);
+    }
+}
+
+#if DO_TESTS
+static void test_strrepeat(void)
+{
+    TEST_START;
+    tn_string base = TN_STRING_LITERAL("abc\0");
+
+    assert(tn_strrepeat(base, 0).str == NULL);
     assert(tn_strrepeat(base, 1).str == base.str);
     assert(tn_strcmp(tn_strrepeat(base, 2),
                      TN_STRING_LITERAL("abc\0abc\0")) == 0);
@@ -735,70 +3074,690 @@ static void test_strrepeat(void)
 }
 #endif
 
-static size_t
-min_size3(size_t s1, size_t s2, size_t s3)
+static size_t
+min_size3(size_t s1, size_t s2, size_t s3)
+{
+    size_t min12 = s1 < s2 ? s1 : s2;
+
+    return min12 < s3 ? min12 : s3;
+}
+
+/*
+ * Edit distances are computed with the bit-vector algorithm by Myers
+ * in the formulation by Hyyrö, which processes a column of the
+ * dynamic programming matrix per a machine word operation.
+ * The shorter string is the "pattern" that is packed into words,
+ * and the longer one is the "text".
+ *
+ * The bounded versions give up as soon as the distance is certain to
+ * exceed @a max, i.e. when the score of the current column minus
+ * the number of remaining text characters is still greater than
+ * @a max; in that case @a max + 1 is returned.
+ */
+#define STRDISTANCE_WORD_BITS 64
+#define STRDISTANCE_STACK_BLOCKS 4
+
+static size_t
+strdistance_myers(const uint8_t *p, size_t m, const uint8_t *t, size_t n,
+                  size_t max)
+{
+    uint64_t peq[UINT8_MAX + 1];
+    uint64_t pv = UINT64_MAX;
+    uint64_t mv = 0;
+    uint64_t high = (uint64_t)1 << (m - 1);
+    size_t score = m;
+    size_t j;
+
+    memset(peq, 0, sizeof(peq));
+    for (j = 0; j < m; j++)
+        peq[p[j]] |= (uint64_t)1 << j;
+
+    for (j = 0; j < n; j++)
+    {
+        uint64_t eq = peq[t[j]];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & high)
+            score++;
+        else if (mh & high)
+            score--;
+
+        if (score > max && score - max > n - j - 1)
+            return max + 1;
+
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score;
+}
+
+static size_t
+strdistance_blocked(const uint8_t *p, size_t m, const uint8_t *t, size_t n,
+                    size_t max)
+{
+    size_t nblocks = (m + STRDISTANCE_WORD_BITS - 1) / STRDISTANCE_WORD_BITS;
+    uint64_t stack_space[(UINT8_MAX + 3) * STRDISTANCE_STACK_BLOCKS];
+    uint64_t *peq = stack_space;
+    uint64_t *pv;
+    uint64_t *mv;
+    uint64_t last_high = (uint64_t)1 << ((m - 1) % STRDISTANCE_WORD_BITS);
+    size_t score = m;
+    size_t i, j;
+
+    if (nblocks > STRDISTANCE_STACK_BLOCKS)
+        peq = tn_alloc_blob((UINT8_MAX + 3) * nblocks * sizeof(*peq));
+    pv = peq + (UINT8_MAX + 1) * nblocks;
+    mv = pv + nblocks;
+
+    memset(peq, 0, (UINT8_MAX + 1) * nblocks * sizeof(*peq));
+    for (i = 0; i < m; i++)
+    {
+        peq[p[i] * nblocks + i / STRDISTANCE_WORD_BITS] |=
+            (uint64_t)1 << (i % STRDISTANCE_WORD_BITS);
+    }
+    for (i = 0; i < nblocks; i++)
+    {
+        pv[i] = UINT64_MAX;
+        mv[i] = 0;
+    }
+
+    for (j = 0; j < n; j++)
+    {
+        const uint64_t *eqs = &peq[t[j] * nblocks];
+        /* The horizontal delta entering the block from above;
+         * the top row of the matrix always increases by one
+         */
+        int hin = 1;
+
+        for (i = 0; i < nblocks; i++)
+        {
+            uint64_t high = i == nblocks - 1 ? last_high :
+                (uint64_t)1 << (STRDISTANCE_WORD_BITS - 1);
+            uint64_t eq = eqs[i];
+            uint64_t xv = eq | mv[i];
+            uint64_t xh;
+            uint64_t ph;
+            uint64_t mh;
+            int hout = 0;
+
+            if (hin < 0)
+                eq |= 1;
+            xh = (((eq & pv[i]) + pv[i]) ^ pv[i]) | eq;
+            ph = mv[i] | ~(xh | pv[i]);
+            mh = pv[i] & xh;
+
+            if (ph & high)
+                hout = 1;
+            else if (mh & high)
+                hout = -1;
+
+            ph <<= 1;
+            mh <<= 1;
+            if (hin < 0)
+                mh |= 1;
+            else if (hin > 0)
+                ph |= 1;
+            pv[i] = mh | ~(xv | ph);
+            mv[i] = ph & xv;
+            hin = hout;
+        }
+
+        if (hin > 0)
+            score++;
+        else if (hin < 0)
+            score--;
+
+        if (score > max && score - max > n - j - 1)
+            return max + 1;
+    }
+    return score;
+}
+
+/*
+ * The diagonal band version of the classic dynamic programming algorithm
+ * (Ukkonen). Only cells within @a max of the main diagonal are computed,
+ * so it beats the blocked bit-vector algorithm when @a max is small
+ * compared to the string lengths. The strings must not differ in length
+ * by more than @a max
+ */
+static size_t
+strdistance_banded(const uint8_t *s1, size_t n1, const uint8_t *s2, size_t n2,
+                   size_t max)
+{
+    size_t width = 2 * max + 1;
+    size_t stack_rows[2 * (UINT8_MAX + 1)];
+    size_t *prev = stack_rows;
+    size_t *cur;
+    size_t *swap;
+    size_t i, d;
+
+    if (width > UINT8_MAX + 1)
+        prev = tn_alloc_blob(2 * width * sizeof(*prev));
+    cur = prev + width;
+
+    /* Cell (i, j) is stored at index d = j - i + max */
+    for (d = 0; d < width; d++)
+        prev[d] = d < max ? max + 1 : d - max;
+
+    for (i = 1; i <= n1; i++)
+    {
+        size_t rowmin = max + 1;
+
+        for (d = 0; d < width; d++)
+        {
+            size_t j = i + d;
+            size_t value;
+
+            if (j < max || j - max > n2)
+            {
+                cur[d] = max + 1;
+                continue;
+            }
+            j -= max;
+            if (j == 0)
+                value = i;
+            else
+            {
+                value = min_size3(prev[d] + (s1[i - 1] != s2[j - 1]),
+                                  d + 1 < width ? prev[d + 1] + 1 : max + 1,
+                                  d > 0 ? cur[d - 1] + 1 : max + 1);
+            }
+            cur[d] = value > max ? max + 1 : value;
+            if (cur[d] < rowmin)
+                rowmin = cur[d];
+        }
+        if (rowmin > max)
+            return max + 1;
+
+        swap = prev;
+        prev = cur;
+        cur = swap;
+    }
+    return prev[n2 + max - n1];
+}
+
+static size_t
+strdistance(tn_string str1, tn_string str2, size_t max)
+{
+    const uint8_t *p;
+    const uint8_t *t;
+    size_t m, n;
+
+    if (str1.len > str2.len)
+    {
+        tn_string swap = str1;
+
+        str1 = str2;
+        str2 = swap;
+    }
+    p = (const uint8_t *)str1.str;
+    m = str1.len;
+    t = (const uint8_t *)str2.str;
+    n = str2.len;
+
+    if (n - m > max)
+        return max + 1;
+    if (m == 0)
+        return n;
+    if (m <= STRDISTANCE_WORD_BITS)
+        return strdistance_myers(p, m, t, n, max);
+    if (max < n && 2 * max + 1 < 4 * (m / STRDISTANCE_WORD_BITS + 1))
+        return strdistance_banded(p, m, t, n, max);
+    return strdistance_blocked(p, m, t, n, max);
+}
+
+size_t
+tn_strdistance(tn_string str1, tn_string str2)
+{
+    return strdistance(str1, str2, SIZE_MAX - 1);
+}
+
+size_t
+tn_strdistance_max(tn_string str1, tn_string str2, size_t max)
+{
+    if (max >= SIZE_MAX - 1)
+        max = SIZE_MAX - 1;
+    return strdistance(str1, str2, max);
+}
+
+#if DO_TESTS || DO_BENCHMARKS
+/* The plain Wagner-Fischer algorithm */
+static size_t
+reference_strdistance(tn_string str1, tn_string str2)
+{
+    size_t *prev_row;
+    size_t *cur_row;
+    size_t *swap;
+    size_t i, j;
+
+    prev_row = tn_alloc_blob(sizeof(*prev_row) * (str2.len + 1));
+    cur_row  = tn_alloc_blob(sizeof(*cur_row) * (str2.len + 1));
+
+    for (i = 0; i <= str2.len; i++)
+        prev_row[i] = i;
+
+    for (i = 1; i <= str1.len; i++)
+    {
+        cur_row[0] = i;
+        for (j = 1; j <= str2.len; j++)
+        {
+            cur_row[j] = min_size3(cur_row[j - 1] + 1,
+                                   prev_row[j] + 1,
+                                   prev_row[j - 1] +
+                                   (str2.str[j - 1] != str1.str[i - 1]));
+        }
+        swap = prev_row;
+        prev_row = cur_row;
+        cur_row = swap;
+    }
+    return prev_row[str2.len];
+}
+#endif
+
+#if DO_TESTS
+
+static void test_distance(void)
+{
+    TEST_START;
+    tn_string str1 = TN_STRING_LITERAL("abc");
+    tn_string str2 = TN_STRING_LITERAL("adbecf");
+
+    assert(tn_strdistance(str1, str1) == 0);
+    assert(tn_strdistance(TN_EMPTY_STRING, TN_EMPTY_STRING) == 0);
+    assert(tn_strdistance(str1, TN_EMPTY_STRING) == str1.len);
+    assert(tn_strdistance(TN_EMPTY_STRING, str2) == str2.len);
+
+    assert(tn_strdistance(str1, tn_substr(str1, 0, 2)) == 1);
+    assert(tn_strdistance(str1, str2) == 3);
+    assert(tn_strdistance(str2, str1) == 3);
+}
+
+static void test_distance_max(void)
+{
+    TEST_START;
+    tn_string str1 = TN_STRING_LITERAL("abc");
+    tn_string str2 = TN_STRING_LITERAL("adbecf");
+
+    assert(tn_strdistance_max(str1, str1, 0) == 0);
+    assert(tn_strdistance_max(str1, str2, 3) == 3);
+    assert(tn_strdistance_max(str1, str2, 2) == 3);
+    assert(tn_strdistance_max(str1, str2, 0) == 1);
+    assert(tn_strdistance_max(str1, str2, SIZE_MAX) == 3);
+    assert(tn_strdistance_max(TN_EMPTY_STRING, str2, 1) == 2);
+    assert(tn_strdistance_max(TN_STRING_LITERAL("kitten"),
+                              TN_STRING_LITERAL("sitting"), 3) == 3);
+    assert(tn_strdistance_max(TN_STRING_LITERAL("kitten"),
+                              TN_STRING_LITERAL("sitting"), 2) == 3);
+}
+
+/*
+ * Compare all the algorithms against the reference implementation
+ * on strings of various lengths over a small alphabet
+ */
+static void test_distance_engines(void)
+{
+    TEST_START;
+    static const size_t lengths[] = {1, 2, 31, 63, 64, 65, 127, 128, 129,
+                                     300};
+    static char buf1[400];
+    static char buf2[400];
+    unsigned seed = 54321;
+    unsigned iter;
+
+    for (iter = 0; iter < 400; iter++)
+    {
+        size_t len1 = lengths[(size_t)rand_r(&seed) %
+                              (sizeof(lengths) / sizeof(*lengths))];
+        size_t len2 = len1;
+        size_t edits = (size_t)rand_r(&seed) % 12;
+        size_t i;
+        tn_string str1;
+        tn_string str2;
+        size_t expected;
+        size_t max;
+
+        for (i = 0; i < len1; i++)
+            buf1[i] = (char)('a' + rand_r(&seed) % 4);
+        memcpy(buf2, buf1, len1);
+        for (i = 0; i < edits && len2 > 0 && len2 < sizeof(buf2); i++)
+        {
+            size_t at = (size_t)rand_r(&seed) % len2;
+
+            switch (rand_r(&seed) % 3)
+            {
+                case 0:
+                    buf2[at] = (char)('a' + rand_r(&seed) % 4);
+                    break;
+                case 1:
+                    memmove(buf2 + at + 1, buf2 + at, len2 - at);
+                    buf2[at] = (char)('a' + rand_r(&seed) % 4);
+                    len2++;
+                    break;
+                default:
+                    memmove(buf2 + at, buf2 + at + 1, len2 - at - 1);
+                    len2--;
+                    break;
+            }
+        }
+
+        str1 = (tn_string){.str = buf1, .len = len1};
+        str2 = (tn_string){.str = buf2, .len = len2};
+        expected = reference_strdistance(str1, str2);
+
+        assert(tn_strdistance(str1, str2) == expected);
+        assert(tn_strdistance(str2, str1) == expected);
+        for (max = 0; max <= expected + 1; max++)
+        {
+            size_t bounded = tn_strdistance_max(str1, str2, max);
+
+            assert(max >= expected ? bounded == expected : bounded == max + 1);
+        }
+    }
+}
+
+#endif
+
+/*
+ * SipHash-1-3 keyed with a per-process random key, so that
+ * hash values cannot be predicted from outside to cause collisions
+ */
+static uint64_t strhash_key[2] = {
+    UINT64_C(0x736f6d6570736575), UINT64_C(0x646f72616e646f6d)
+};
+
+constructor void
+init_strhash_key(void)
+{
+    uint64_t key[2];
+
+    if (getentropy(key, sizeof(key)) == 0)
+        memcpy(strhash_key, key, sizeof(key));
+}
+
+#define SIPHASH_ROTL(_x, _b) (((_x) << (_b)) | ((_x) >> (64 - (_b))))
+
+#define SIPHASH_ROUND(_v0, _v1, _v2, _v3)                               \
+    do {                                                                \
+        _v0 += _v1; _v1 = SIPHASH_ROTL(_v1, 13); _v1 ^= _v0;            \
+        _v0 = SIPHASH_ROTL(_v0, 32);                                    \
+        _v2 += _v3; _v3 = SIPHASH_ROTL(_v3, 16); _v3 ^= _v2;            \
+        _v0 += _v3; _v3 = SIPHASH_ROTL(_v3, 21); _v3 ^= _v0;            \
+        _v2 += _v1; _v1 = SIPHASH_ROTL(_v1, 17); _v1 ^= _v2;            \
+        _v2 = SIPHASH_ROTL(_v2, 32);                                    \
+    } while (0)
+
+uint64_t
+tn_strhash(tn_string str)
+{
+    const uint8_t *data = (const uint8_t *)str.str;
+    uint64_t v0 = strhash_key[0] ^ UINT64_C(0x736f6d6570736575);
+    uint64_t v1 = strhash_key[1] ^ UINT64_C(0x646f72616e646f6d);
+    uint64_t v2 = strhash_key[0] ^ UINT64_C(0x6c7967656e657261);
+    uint64_t v3 = strhash_key[1] ^ UINT64_C(0x7465646279746573);
+    uint64_t last = (uint64_t)str.len << 56;
+    size_t tail = str.len % sizeof(uint64_t);
+    size_t i;
+
+    for (i = 0; i + sizeof(uint64_t) <= str.len; i += sizeof(uint64_t))
+    {
+        uint64_t m;
+
+        memcpy(&m, data + i, sizeof(m));
+        v3 ^= m;
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    for (; tail > 0; tail--)
+        last |= (uint64_t)data[i + tail - 1] << (8 * (tail - 1));
+
+    v3 ^= last;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPHASH_ROUND
+#undef SIPHASH_ROTL
+
+#if DO_TESTS
+static void test_strhash(void)
+{
+    TEST_START;
+    tn_string str = TN_STRING_LITERAL("abcdefgh\0ijklmnopq");
+    char copy[sizeof("abcdefgh\0ijklmnopq")];
+
+    memcpy(copy, str.str, sizeof(copy));
+    assert(tn_strhash(str) ==
+           tn_strhash((tn_string){.str = copy, .len = str.len}));
+    assert(tn_strhash(str) != tn_strhash(tn_substr(str, 0, str.len - 1)));
+    assert(tn_strhash(TN_STRING_LITERAL("\0")) !=
+           tn_strhash(TN_STRING_LITERAL("\0\0")));
+    assert(tn_strhash(TN_EMPTY_STRING) == tn_strhash(tn_substr(str, 0, 0)));
+}
+#endif
+
+/*
+ * The interning table uses open addressing with linear probing.
+ * Lookups take no locks: slots are only ever filled, never cleared,
+ * and a grown table is published atomically while the old one stays
+ * valid for any concurrent readers (until the garbage collector
+ * notices nobody uses it anymore). Insertions are serialized by a mutex.
+ */
+typedef struct intern_entry {
+    uint64_t hash;
+    tn_string str;
+} intern_entry;
+
+typedef struct intern_table {
+    size_t mask;
+    size_t count;
+    intern_entry * _Atomic slots[];
+} intern_table;
+
+#define INTERN_INITIAL_SIZE 256
+
+static intern_table * _Atomic intern_current;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const intern_entry *
+intern_lookup(const intern_table *table, tn_string str, uint64_t hash)
 {
-    size_t min12 = s1 < s2 ? s1 : s2;
+    size_t i;
 
-    return min12 < s3 ? min12 : s3;
+    if (table == NULL)
+        return NULL;
+
+    for (i = (size_t)hash & table->mask;; i = (i + 1) & table->mask)
+    {
+        const intern_entry *entry =
+            atomic_load_explicit(&table->slots[i], memory_order_acquire);
+
+        if (entry == NULL)
+            return NULL;
+        if (entry->hash == hash && entry->str.len == str.len &&
+            memcmp(entry->str.str, str.str, str.len) == 0)
+            return entry;
+    }
 }
 
-size_t
-tn_strdistance(tn_string str1, tn_string str2)
+static void
+intern_insert(intern_table *table, intern_entry *entry)
 {
-    size_t *prev_row;
-    size_t *cur_row;
-    size_t *swap;
-    size_t i, j;
-    
-    if (tn_strcmp(str1, str2) == 0)
-        return 0;
-    if (str1.len == 0)
-        return str2.len;
-    if (str2.len == 0)
-        return str1.len;
+    size_t i = (size_t)entry->hash & table->mask;
 
-    prev_row = tn_alloc_blob(sizeof(*prev_row) * (str2.len + 1));
-    cur_row  = tn_alloc_blob(sizeof(*cur_row) * (str2.len + 1));
+    while (atomic_load_explicit(&table->slots[i], memory_order_relaxed) != NULL)
+        i = (i + 1) & table->mask;
 
-    for (i = 0; i <= str2.len; i++)
-        prev_row[i] = i;
+    atomic_store_explicit(&table->slots[i], entry, memory_order_release);
+    table->count++;
+}
 
-    for (i = 1; i <= str1.len; i++)
+warn_unused_result
+static intern_table *
+intern_grow(intern_table *table)
+{
+    size_t size = table == NULL ? INTERN_INITIAL_SIZE : 2 * (table->mask + 1);
+    intern_table *grown = tn_alloc(sizeof(*grown) +
+                                   size * sizeof(*grown->slots));
+    size_t i;
+
+    grown->mask = size - 1;
+    grown->count = 0;
+    for (i = 0; i < size; i++)
+        atomic_init(&grown->slots[i], NULL);
+
+    if (table != NULL)
     {
-        cur_row[0] = i;
-        for (j = 1; j <= str2.len; j++)
+        for (i = 0; i <= table->mask; i++)
         {
-            cur_row[j] = min_size3(cur_row[j - 1] + 1,
-                                   prev_row[j] + 1,
-                                   prev_row[j - 1] +
-                                   (str2.str[j - 1] != str1.str[i - 1]));
+            intern_entry *entry =
+                atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+
+            if (entry != NULL)
+                intern_insert(grown, entry);
         }
-        swap = prev_row;
-        prev_row = cur_row;
-        cur_row = swap;
     }
-    return prev_row[str2.len];
+
+    atomic_store_explicit(&intern_current, grown, memory_order_release);
+    return grown;
+}
+
+bool
+tn_strinterned(tn_string str, tn_string *interned)
+{
+    const intern_entry *entry;
+
+    if (str.len == 0)
+    {
+        if (interned != NULL)
+            *interned = TN_EMPTY_STRING;
+        return true;
+    }
+
+    entry = intern_lookup(atomic_load_explicit(&intern_current,
+                                               memory_order_acquire),
+                          str, tn_strhash(str));
+    if (entry == NULL)
+        return false;
+
+    if (interned != NULL)
+        *interned = entry->str;
+    return true;
+}
+
+tn_string
+tn_strintern(tn_string str)
+{
+    uint64_t hash;
+    intern_table *table;
+    const intern_entry *found;
+    intern_entry *entry;
+
+    if (str.len == 0)
+        return TN_EMPTY_STRING;
+
+    hash = tn_strhash(str);
+    found = intern_lookup(atomic_load_explicit(&intern_current,
+                                               memory_order_acquire),
+                          str, hash);
+    if (found != NULL)
+        return found->str;
+
+    pthread_mutex_lock(&intern_lock);
+
+    /* Someone might have interned the string in the meantime */
+    table = atomic_load_explicit(&intern_current, memory_order_relaxed);
+    found = intern_lookup(table, str, hash);
+    if (found != NULL)
+    {
+        pthread_mutex_unlock(&intern_lock);
+        return found->str;
+    }
+
+    /* Keep the load factor below 3/4 */
+    if (table == NULL || (table->count + 1) * 4 > (table->mask + 1) * 3)
+        table = intern_grow(table);
+
+    entry = TN_NEW(intern_entry);
+    entry->hash = hash;
+    entry->str = tn_strdupmem(str.len, (const uint8_t *)str.str);
+    intern_insert(table, entry);
+
+    pthread_mutex_unlock(&intern_lock);
+
+    return entry->str;
 }
 
 #if DO_TESTS
+#define TEST_INTERN_COUNT 10000
 
-static void test_distance(void)
+static tn_string test_interned[TEST_INTERN_COUNT];
+
+static void *
+test_intern_reader(unused void *arg)
 {
-    TEST_START;
-    tn_string str1 = TN_STRING_LITERAL("abc");
-    tn_string str2 = TN_STRING_LITERAL("adbecf");
+    unsigned i;
 
-    assert(tn_strdistance(str1, str1) == 0);
-    assert(tn_strdistance(TN_EMPTY_STRING, TN_EMPTY_STRING) == 0);
-    assert(tn_strdistance(str1, TN_EMPTY_STRING) == str1.len);
-    assert(tn_strdistance(TN_EMPTY_STRING, str2) == str2.len);
+    for (i = 0; i < TEST_INTERN_COUNT; i++)
+    {
+        char buf[32];
+        tn_string found = TN_EMPTY_STRING;
+        int len = snprintf(buf, sizeof(buf), "name%u", i);
 
-    assert(tn_strdistance(str1, tn_substr(str1, 0, 2)) == 1);
-    assert(tn_strdistance(str1, str2) == 3);
-    assert(tn_strdistance(str2, str1) == 3);
+        assert(tn_strinterned((tn_string){.str = buf, .len = (size_t)len},
+                              &found));
+        assert(tn_strinterned_eq(found, test_interned[i]));
+    }
+    return NULL;
 }
 
+static void test_strintern(void)
+{
+    TEST_START;
+    char copy[] = "abc\0def";
+    tn_string str = TN_STRING_LITERAL("abc\0def");
+    tn_string interned = tn_strintern(str);
+    pthread_t readers[4];
+    unsigned i;
+
+    assert(interned.str != str.str);
+    assert(tn_strcmp(interned, str) == 0);
+    assert(interned.str[interned.len] == '\0');
+    assert(tn_strinterned_eq(interned,
+                             tn_strintern((tn_string){.str = copy,
+                                                      .len = str.len})));
+    assert(!tn_strinterned_eq(interned,
+                              tn_strintern(tn_substr(str, 0, 3))));
+    assert(tn_strintern(TN_EMPTY_STRING).str == NULL);
+    assert(!tn_strinterned(TN_STRING_LITERAL("not interned"), NULL));
+
+    for (i = 0; i < TEST_INTERN_COUNT; i++)
+    {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "name%u", i);
+
+        test_interned[i] = tn_strintern((tn_string){.str = buf,
+                                                    .len = (size_t)len});
+    }
+    for (i = 0; i < sizeof(readers) / sizeof(*readers); i++)
+        assert(pthread_create(&readers[i], NULL, test_intern_reader, NULL) == 0);
+    for (i = 0; i < sizeof(readers) / sizeof(*readers); i++)
+        assert(pthread_join(readers[i], NULL) == 0);
+
+    assert(tn_strinterned(str, &interned) &&
+           interned.str == tn_strintern(str).str);
+}
 #endif
 
 tn_status
@@ -818,152 +3777,637 @@ tn_status
 tn_strvprintf(tn_string * restrict dest, const char * restrict fmt,
               va_list args)
 {
-    char buf[64];
-    tn_status status = 0;
-    char *result = buf;
-    int rc;
+    char stack[128];
+    strfmt_sink sink = {.buf = {.str = stack, .len = 0,
+                                .capacity = sizeof(stack) - 1},
+                        .stack = stack};
+    tn_status status;
     va_list args2;
 
     va_copy(args2, args);
-    rc = vsnprintf(buf, sizeof(buf), fmt, args);
-    if (rc < 0)
-        status = errno;
-    else if ((size_t)rc >= sizeof(buf))
+    status = strfmt_format(&sink, fmt, args);
+    if (status == ENOTSUP)
     {
-        int rc2;
+        sink.buf = TN_STRBUF_INIT;
+        status = strbuf_vprintf_libc(&sink.buf, fmt, args2);
+    }
+    va_end(args2);
+    if (status != 0)
+        return status;
+
+    /* The result is allocated to its exact size */
+    if (sink.buf.len == 0)
+        *dest = TN_EMPTY_STRING;
+    else if (sink.buf.str == stack)
+        *dest = tn_strdupmem(sink.buf.len, (const uint8_t *)stack);
+    else
+    {
+        sink.buf.str[sink.buf.len] = '\0';
+        *dest = (tn_string){.str = tn_realloc(sink.buf.str, sink.buf.len + 1),
+                            .len = sink.buf.len};
+    }
 
-        result = tn_alloc_blob((size_t)rc + 1);
-        
-        rc2 = vsnprintf(result, (size_t)rc + 1, fmt, args2);
-        if (rc2 < 0)
-            status = errno;
-        else if (rc2 != rc)
-            status = EPROTO;
-        else
+    return 0;
+}
+
+#if DO_TESTS
+static void test_sprintf(void)
+{
+    TEST_START;
+    tn_string buffer1 = TN_EMPTY_STRING;
+    tn_string buffer2 = TN_EMPTY_STRING;
+    tn_string longresult =
+        TN_STRING_LITERAL("01234567890123456789012345678901234567890123456789"
+                          "01234567890123456789012345678901234567890123456789");
+
+    assert(tn_strprintf(&buffer1, "%d", 123) == 0);
+    assert(tn_strcmp(buffer1, TN_STRING_LITERAL("123")) == 0);
+
+    assert(tn_strprintf(&buffer2, "%s", longresult.str) == 0);
+    assert(tn_strcmp(buffer2, longresult) == 0);
+    assert(buffer1.str != buffer2.str);
+    
+}
+
+#define TEST_FORMAT(_fmt, ...)                                          \
+    do {                                                                \
+        char expected[512];                                             \
+        tn_string result = TN_EMPTY_STRING;                             \
+        int len = snprintf(expected, sizeof(expected), _fmt, __VA_ARGS__); \
+                                                                        \
+        assert(len >= 0 && (size_t)len < sizeof(expected));             \
+        assert(tn_strprintf(&result, _fmt, __VA_ARGS__) == 0);          \
+        assert(result.len == (size_t)len);                              \
+        assert(len == 0 || (memcmp(result.str, expected, result.len) == 0 && \
+                            result.str[result.len] == '\0'));           \
+    } while (0)
+
+static void test_sprintf_conversions(void)
+{
+    TEST_START;
+    static const char longstr[] =
+        "0123456789012345678901234567890123456789012345678901234567890123"
+        "4567890123456789012345678901234567890123456789012345678901234567";
+    tn_string name = TN_STRING_LITERAL("name=value");
+    tn_strbuf buf = TN_STRBUF_INIT;
+    unsigned char uc = 200;
+    short sh = -1234;
+    void *ptr = &uc;
+
+    TEST_FORMAT("%d|%i|%d|%d", 0, -1, INT_MAX, INT_MIN);
+    TEST_FORMAT("%u|%x|%X|%o", 0u, 0xdeadbeefu, 0xdeadbeefu, 0777u);
+    TEST_FORMAT("%ld|%lu|%lld|%llu", LONG_MIN, ULONG_MAX, LLONG_MIN,
+                ULLONG_MAX);
+    TEST_FORMAT("%zu|%zd|%jd|%ju|%td", (size_t)SIZE_MAX, (ssize_t)-5,
+                INTMAX_MIN, UINTMAX_MAX, (ptrdiff_t)-77);
+    TEST_FORMAT("%hhu|%hhd|%hd|%hu", uc, (signed char)-3, sh,
+                (unsigned short)65535);
+    TEST_FORMAT("[%5d][%-5d][%05d][%+d][% d][%+05d][%-+5d]",
+                42, 42, -42, 42, 42, 42, -42);
+    TEST_FORMAT("[%.0d][%.0u][%.3d][%8.3d][%-8.3x]",
+                0, 0u, 7, -7, 0xau);
+    TEST_FORMAT("[%#x][%#X][%#o][%#o][%#.3o][%#x][%#08x][%#.0o]",
+                255u, 255u, 8u, 0u, 8u, 0u, 255u, 0u);
+    TEST_FORMAT("[%*d][%-*d][%*d][%.*d][%.*d]", 6, 1, 6, 2, -6, 3, 4, 5,
+                -1, 6);
+    TEST_FORMAT("[%c][%3c][%-3c][%%]", 'x', 'y', 'z');
+    TEST_FORMAT("[%s][%10s][%-10s][%.3s][%*.*s][%.0s]", "abc", "abc", "abc",
+                "abcdef", 8, 2, "abcdef", "abc");
+    TEST_FORMAT("[" TN_STRING_FMT "][" TN_STRING_FMT "]",
+                TN_STRING_ARGS(name), TN_STRING_ARGS(tn_substr(name, 0, 4)));
+    TEST_FORMAT("%s%s%s", longstr, longstr, longstr);
+    TEST_FORMAT("%200d|%-200u|", 1, 2u);
+    TEST_FORMAT("[%f][%.2f][%10.3e][%-10g][%+G][%a][%Lf]", 3.14159, 2.5,
+                12345.678, 0.0001, 1e100, 1.0, (long double)1.5);
+    TEST_FORMAT("[%p][%d]", ptr, 7);
+    TEST_FORMAT("%s", "");
+
+    assert(tn_strbuf_printf(&buf, "%s=", "key") == 0);
+    assert(tn_strbuf_printf(&buf, "%d,%p", 10, ptr) == 0);
+    assert(tn_strbuf_printf(&buf, "%.1f", 0.25) == 0);
+    {
+        char expected[64];
+
+        snprintf(expected, sizeof(expected), "key=10,%p0.2", ptr);
+        assert(tn_strcmp(tn_strbuf_finish(&buf), tn_strdup(expected)) == 0);
+    }
+}
+#undef TEST_FORMAT
+#endif
+
+tn_status
+tn_strscanf(tn_string src, unsigned *count, const char * restrict fmt, ...)
+{
+    va_list args;
+    tn_status rc;
+    
+    va_start(args, fmt);
+    rc = tn_strvscanf(src, count, fmt, args);
+    va_end(args);
+
+    return rc;
+}
+
+tn_status
+tn_strvscanf(tn_string src, unsigned *count, const char * restrict fmt,
+             va_list args)
+{
+    int rc;
+
+    errno = 0;
+    rc = vsscanf(tn_str2cstr(src), fmt, args);
+    if (rc == EOF)
+    {
+        if (errno == 0)
+            *count = 0;
+        return errno;
+    }
+
+    *count = (unsigned)rc;
+
+    return 0;
+}
+
+#if DO_TESTS
+static void test_sscanf(void)
+{
+    TEST_START;
+    tn_string buffer = TN_STRING_LITERAL("123 134");
+    int v1 = 0, v2 = 0;
+    unsigned count = 0;
+
+    assert(tn_strscanf(buffer, &count, "%d %d", &v1, &v2) == 0);
+    assert(count == 2);
+    assert(v1 == 123 && v2 == 134);
+
+    v1 = v2 = 0;
+    assert(tn_strscanf(tn_substr(buffer, 0, 4), &count, "%d %d", &v1, &v2) == 0);
+    assert(count == 1);
+    assert(v1 == 123);
+    assert(v2 == 0);
+
+    assert(tn_strscanf(TN_EMPTY_STRING, &count, "%d %d", &v1, &v2) == 0);
+    assert(count == 0);
+}
+#endif
+
+/*
+ * Numeric parsing works directly on string views. Decimal digits are
+ * consumed eight at a time where possible, by checking and converting
+ * a whole 64-bit word (little-endian targets only)
+ */
+static const uint8_t strto_digit_values[UINT8_MAX + 1] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['g'] = 17, ['h'] = 18, ['i'] = 19, ['j'] = 20, ['k'] = 21, ['l'] = 22,
+    ['m'] = 23, ['n'] = 24, ['o'] = 25, ['p'] = 26, ['q'] = 27, ['r'] = 28,
+    ['s'] = 29, ['t'] = 30, ['u'] = 31, ['v'] = 32, ['w'] = 33, ['x'] = 34,
+    ['y'] = 35, ['z'] = 36,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['G'] = 17, ['H'] = 18, ['I'] = 19, ['J'] = 20, ['K'] = 21, ['L'] = 22,
+    ['M'] = 23, ['N'] = 24, ['O'] = 25, ['P'] = 26, ['Q'] = 27, ['R'] = 28,
+    ['S'] = 29, ['T'] = 30, ['U'] = 31, ['V'] = 32, ['W'] = 33, ['X'] = 34,
+    ['Y'] = 35, ['Z'] = 36,
+};
+
+/* Returns the digit value plus one, or 0 for non-digits */
+static inline unsigned
+strto_digit(char ch, unsigned base)
+{
+    unsigned value = strto_digit_values[(uint8_t)ch];
+
+    return value <= base ? value : 0;
+}
+
+#define SWAR_DIGITS 8
+
+static inline bool
+swar_all_digits(uint64_t word)
+{
+    return ((word & UINT64_C(0xf0f0f0f0f0f0f0f0)) |
+            (((word + UINT64_C(0x0606060606060606)) &
+              UINT64_C(0xf0f0f0f0f0f0f0f0)) >> 4)) ==
+        UINT64_C(0x3333333333333333);
+}
+
+/* Converts eight ASCII digits, the first one in the lowest byte */
+static inline uint32_t
+swar_parse_digits(uint64_t word)
+{
+    word -= UINT64_C(0x3030303030303030);
+    word = word * 10 + (word >> 8);
+    return (uint32_t)
+        (((word & UINT64_C(0x000000ff000000ff)) *
+          (100 + (UINT64_C(1000000) << 32)) +
+          ((word >> 16) & UINT64_C(0x000000ff000000ff)) *
+          (1 + (UINT64_C(10000) << 32))) >> 32);
+}
+
+/*
+ * Accumulates decimal digits starting at @a *pos into @a *value.
+ * Returns false on overflow, in which case the remaining
+ * digits are still skipped
+ */
+static bool
+strto_decimal(tn_string str, size_t *pos, uint64_t *value)
+{
+    size_t i = *pos;
+    uint64_t acc = *value;
+    bool ok = true;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (i + SWAR_DIGITS <= str.len)
+    {
+        uint64_t word;
+
+        memcpy(&word, str.str + i, sizeof(word));
+        if (!swar_all_digits(word))
+            break;
+        if (__builtin_mul_overflow(acc, UINT64_C(100000000), &acc) ||
+            __builtin_add_overflow(acc, swar_parse_digits(word), &acc))
+            ok = false;
+        i += SWAR_DIGITS;
+    }
+#endif
+    for (; i < str.len; i++)
+    {
+        unsigned digit = strto_digit(str.str[i], 10);
+
+        if (digit == 0)
+            break;
+        if (__builtin_mul_overflow(acc, 10, &acc) ||
+            __builtin_add_overflow(acc, digit - 1, &acc))
+            ok = false;
+    }
+    *pos = i;
+    *value = acc;
+    return ok;
+}
+
+/*
+ * Parses an optionally signed number, returning its magnitude.
+ * Base prefixes are recognized if @a base is 0 or matches them
+ */
+static tn_status
+strto_magnitude(tn_string str, unsigned base, bool *negative,
+                uint64_t *value, size_t *used)
+{
+    size_t i = 0;
+    size_t start;
+    bool ok = true;
+
+    *negative = false;
+    *value = 0;
+    if (base == 1 || base > 36)
+        return EINVAL;
+
+    if (i < str.len && (str.str[i] == '-' || str.str[i] == '+'))
+        *negative = str.str[i++] == '-';
+
+    if (i + 1 < str.len && str.str[i] == '0')
+    {
+        unsigned prefix_base = 0;
+
+        switch (str.str[i + 1])
+        {
+            case 'x':
+            case 'X':
+                prefix_base = 16;
+                break;
+            case 'o':
+            case 'O':
+                prefix_base = 8;
+                break;
+            case 'b':
+            case 'B':
+                prefix_base = 2;
+                break;
+            default:
+                break;
+        }
+        /* A prefix not followed by a digit is just a zero */
+        if (prefix_base != 0 && (base == 0 || base == prefix_base) &&
+            i + 2 < str.len && strto_digit(str.str[i + 2], prefix_base) != 0)
         {
-            dest->str = result;
-            dest->len = (size_t)rc;
+            base = prefix_base;
+            i += 2;
         }
     }
+    if (base == 0)
+        base = 10;
+
+    start = i;
+    if (base == 10)
+        ok = strto_decimal(str, &i, value);
     else
     {
-        *dest = tn_strdup(buf);
+        for (; i < str.len; i++)
+        {
+            unsigned digit = strto_digit(str.str[i], base);
+
+            if (digit == 0)
+                break;
+            if (__builtin_mul_overflow(*value, base, value) ||
+                __builtin_add_overflow(*value, digit - 1, value))
+                ok = false;
+        }
     }
-    va_end(args2);
 
-    return status;
+    if (i == start || (used == NULL && i != str.len))
+        return EINVAL;
+    if (used != NULL)
+        *used = i;
+    return ok ? 0 : ERANGE;
 }
 
-#if DO_TESTS
-static void test_sprintf(void)
+tn_status
+tn_strtou64(tn_string str, unsigned base, uint64_t *result, size_t *used)
 {
-    TEST_START;
-    tn_string buffer1 = TN_EMPTY_STRING;
-    tn_string buffer2 = TN_EMPTY_STRING;
-    tn_string longresult =
-        TN_STRING_LITERAL("01234567890123456789012345678901234567890123456789"
-                          "01234567890123456789012345678901234567890123456789");
-
-    assert(tn_strprintf(&buffer1, "%d", 123) == 0);
-    assert(tn_strcmp(buffer1, TN_STRING_LITERAL("123")) == 0);
-
-    assert(tn_strprintf(&buffer2, "%s", longresult.str) == 0);
-    assert(tn_strcmp(buffer2, longresult) == 0);
-    assert(buffer1.str != buffer2.str);
-    
+    bool negative;
+    uint64_t value;
+    tn_status status = strto_magnitude(str, base, &negative, &value, used);
+
+    if (status == 0 && negative && value != 0)
+        status = ERANGE;
+    if (status == ERANGE)
+        value = negative ? 0 : UINT64_MAX;
+    if (status == 0 || status == ERANGE)
+        *result = value;
+    return status;
 }
-#endif
 
 tn_status
-tn_strscanf(tn_string src, unsigned *count, const char * restrict fmt, ...)
+tn_strtoi64(tn_string str, unsigned base, int64_t *result, size_t *used)
 {
-    va_list args;
-    tn_status rc;
-    
-    va_start(args, fmt);
-    rc = tn_strvscanf(src, count, fmt, args);
-    va_end(args);
-
-    return rc;
+    bool negative;
+    uint64_t value;
+    tn_status status = strto_magnitude(str, base, &negative, &value, used);
+
+    if (status == 0 &&
+        value > (negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX))
+        status = ERANGE;
+
+    if (status == ERANGE)
+        *result = negative ? INT64_MIN : INT64_MAX;
+    else if (status == 0)
+        *result = negative ? (int64_t)(0 - value) : (int64_t)value;
+    return status;
 }
 
-tn_status
-tn_strvscanf(tn_string src, unsigned *count, const char * restrict fmt,
-             va_list args)
+/*
+ * Floating-point numbers use Clinger's fast path: if the decimal
+ * significand fits into 53 bits and the power of ten is
+ * exactly representable too, a single IEEE multiplication or division
+ * is correctly rounded. Other inputs (about 1% of typical data,
+ * but e.g. all long fractions) are passed to strtod()
+ */
+#define STRTOD_MAX_EXACT_POW10 22
+
+static const double strtod_pow10[STRTOD_MAX_EXACT_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool
+strtod_fast(tn_string str, double *result, size_t *used)
 {
-    int rc;
+    size_t i = 0;
+    size_t int_digits;
+    size_t frac_digits = 0;
+    uint64_t significand = 0;
+    int64_t exponent = 0;
+    bool negative = false;
+    double value;
+
+    if (i < str.len && (str.str[i] == '-' || str.str[i] == '+'))
+        negative = str.str[i++] == '-';
+
+    /* Hexadecimal floats would otherwise be parsed as a zero prefix */
+    if (i + 1 < str.len && str.str[i] == '0' &&
+        (str.str[i + 1] == 'x' || str.str[i + 1] == 'X'))
+        return false;
 
-    errno = 0;
-    rc = vsscanf(tn_str2cstr(src), fmt, args);
-    if (rc == EOF)
+    int_digits = i;
+    if (!strto_decimal(str, &i, &significand))
+        return false;
+    int_digits = i - int_digits;
+    if (i < str.len && str.str[i] == '.')
     {
-        if (errno == 0)
-            *count = 0;
-        return errno;
+        frac_digits = ++i;
+        if (!strto_decimal(str, &i, &significand))
+            return false;
+        frac_digits = i - frac_digits;
     }
+    /* No digits at all, or maybe something like "inf" or "nan" */
+    if (int_digits + frac_digits == 0)
+        return false;
 
-    *count = (unsigned)rc;
-
-    return 0;
-}
-
-#if DO_TESTS
-static void test_sscanf(void)
-{
-    TEST_START;
-    tn_string buffer = TN_STRING_LITERAL("123 134");
-    int v1 = 0, v2 = 0;
-    unsigned count = 0;
+    if (i < str.len && (str.str[i] == 'e' || str.str[i] == 'E'))
+    {
+        size_t exp_start = i + 1;
+        bool exp_negative = false;
+        uint64_t exp_value = 0;
+
+        if (exp_start < str.len &&
+            (str.str[exp_start] == '-' || str.str[exp_start] == '+'))
+            exp_negative = str.str[exp_start++] == '-';
+        i = exp_start;
+        if (!strto_decimal(str, &i, &exp_value) ||
+            exp_value > STRTOD_MAX_EXACT_POW10 + SWAR_DIGITS * 4)
+            return false;
+        if (i == exp_start)
+            return false;
+        exponent = exp_negative ? -(int64_t)exp_value : (int64_t)exp_value;
+    }
+    if (used == NULL && i != str.len)
+        return false;
 
-    assert(tn_strscanf(buffer, &count, "%d %d", &v1, &v2) == 0);
-    assert(count == 2);
-    assert(v1 == 123 && v2 == 134);
+    exponent -= (int64_t)frac_digits;
+    if (significand > (UINT64_C(1) << 53) ||
+        exponent < -STRTOD_MAX_EXACT_POW10 ||
+        exponent > STRTOD_MAX_EXACT_POW10)
+        return false;
 
-    v1 = v2 = 0;
-    assert(tn_strscanf(tn_substr(buffer, 0, 4), &count, "%d %d", &v1, &v2) == 0);
-    assert(count == 1);
-    assert(v1 == 123);
-    assert(v2 == 0);
+    value = (double)significand;
+    if (exponent < 0)
+        value /= strtod_pow10[-exponent];
+    else
+        value *= strtod_pow10[exponent];
 
-    assert(tn_strscanf(TN_EMPTY_STRING, &count, "%d %d", &v1, &v2) == 0);
-    assert(count == 0);
+    *result = negative ? -value : value;
+    if (used != NULL)
+        *used = i;
+    return true;
 }
-#endif
 
 tn_status
-tn_strftime(tn_string * restrict dest, const char * restrict fmt,
-            const struct tm * restrict tm)
+tn_strtod(tn_string str, double *result, size_t *used)
 {
     char buf[64];
-    /* This is necessary to shut up the compiler about non-literal format
-     * string, see e.g https://gcc.gnu.org/bugzilla/show_bug.cgi?id=39438
-     */
-#define STRFTIME                                                        \
-    ((size_t (*)(char *, size_t, const char *, const struct tm *))strftime)
-    size_t sz = STRFTIME(buf, sizeof(buf), fmt, tm);
+    const char *cstr;
+    char *end;
+    double value;
+
+    if (strtod_fast(str, result, used))
+        return 0;
 
-    if (sz != 0)
+    /* Unlike strtod(), leading whitespace is not allowed */
+    if (str.len == 0 || isspace((unsigned char)*str.str))
+        return EINVAL;
+
+    if (str.len < sizeof(buf))
     {
-        *dest = tn_strdup(buf);
+        memcpy(buf, str.str, str.len);
+        buf[str.len] = '\0';
+        cstr = buf;
     }
     else
-    {
-        char *dynbuf = NULL;
-        size_t maxsize = 2 * sizeof(buf);
+        cstr = tn_str2cstr(str);
 
-        while (sz == 0)
+    errno = 0;
+    value = strtod(cstr, &end);
+    if (end == cstr || (used == NULL && (size_t)(end - cstr) != str.len))
+        return EINVAL;
+    if (used != NULL)
+        *used = (size_t)(end - cstr);
+    *result = value;
+    return errno == ERANGE ? ERANGE : 0;
+}
+
+#if DO_TESTS
+static void test_strtonum(void)
+{
+    TEST_START;
+    int64_t ival = 0;
+    uint64_t uval = 0;
+    double dval = 0;
+    size_t used = 0;
+    unsigned seed = 2023;
+    unsigned iter;
+
+    assert(tn_strtoi64(TN_STRING_LITERAL("12345"), 10, &ival, NULL) == 0 &&
+           ival == 12345);
+    assert(tn_strtoi64(TN_STRING_LITERAL("-9223372036854775808"), 0,
+                       &ival, NULL) == 0 && ival == INT64_MIN);
+    assert(tn_strtoi64(TN_STRING_LITERAL("9223372036854775808"), 0,
+                       &ival, NULL) == ERANGE && ival == INT64_MAX);
+    assert(tn_strtoi64(TN_STRING_LITERAL("-99999999999999999999999"), 0,
+                       &ival, NULL) == ERANGE && ival == INT64_MIN);
+    assert(tn_strtoi64(TN_STRING_LITERAL("+0x7fffFFFF"), 0, &ival, NULL) == 0 &&
+           ival == INT32_MAX);
+    assert(tn_strtoi64(TN_STRING_LITERAL("-0b101"), 0, &ival, NULL) == 0 &&
+           ival == -5);
+    assert(tn_strtoi64(TN_STRING_LITERAL("0o17"), 0, &ival, NULL) == 0 &&
+           ival == 15);
+    assert(tn_strtoi64(TN_STRING_LITERAL("017"), 0, &ival, NULL) == 0 &&
+           ival == 17);
+    assert(tn_strtoi64(TN_STRING_LITERAL("0b101"), 2, &ival, NULL) == 0 &&
+           ival == 5);
+    assert(tn_strtoi64(TN_STRING_LITERAL("zz"), 36, &ival, NULL) == 0 &&
+           ival == 36 * 36 - 1);
+    assert(tn_strtoi64(TN_STRING_LITERAL("0x"), 0, &ival, &used) == 0 &&
+           ival == 0 && used == 1);
+    assert(tn_strtoi64(TN_STRING_LITERAL("0x1g"), 16, &ival, &used) == 0 &&
+           ival == 1 && used == 3);
+    assert(tn_strtoi64(TN_STRING_LITERAL("0x1g"), 16, &ival, NULL) == EINVAL);
+    assert(tn_strtoi64(TN_STRING_LITERAL("0b2"), 2, &ival, NULL) == EINVAL);
+    assert(tn_strtoi64(TN_STRING_LITERAL(" 1"), 10, &ival, NULL) == EINVAL);
+    assert(tn_strtoi64(TN_STRING_LITERAL("-"), 10, &ival, NULL) == EINVAL);
+    assert(tn_strtoi64(TN_EMPTY_STRING, 10, &ival, NULL) == EINVAL);
+    assert(tn_strtoi64(TN_STRING_LITERAL("1"), 37, &ival, NULL) == EINVAL);
+
+    assert(tn_strtou64(TN_STRING_LITERAL("18446744073709551615"), 10,
+                       &uval, NULL) == 0 && uval == UINT64_MAX);
+    assert(tn_strtou64(TN_STRING_LITERAL("18446744073709551616"), 10,
+                       &uval, NULL) == ERANGE && uval == UINT64_MAX);
+    assert(tn_strtou64(TN_STRING_LITERAL("0xffffffffffffffff"), 0,
+                       &uval, NULL) == 0 && uval == UINT64_MAX);
+    assert(tn_strtou64(TN_STRING_LITERAL("-1"), 10, &uval, NULL) == ERANGE &&
+           uval == 0);
+    assert(tn_strtou64(TN_STRING_LITERAL("-0"), 10, &uval, NULL) == 0 &&
+           uval == 0);
+    /* Views need not be NUL-terminated */
+    assert(tn_strtou64(tn_substr(TN_STRING_LITERAL("1234567890123"), 2, 9),
+                       10, &uval, NULL) == 0 && uval == 345678901);
+
+    assert(tn_strtod(TN_STRING_LITERAL("1.5"), &dval, NULL) == 0 &&
+           dval == 1.5);
+    assert(tn_strtod(TN_STRING_LITERAL("-0.0"), &dval, NULL) == 0 &&
+           dval == 0 && signbit(dval));
+    assert(tn_strtod(TN_STRING_LITERAL("1e22"), &dval, NULL) == 0 &&
+           dval == 1e22);
+    assert(tn_strtod(TN_STRING_LITERAL("12.5e-3x"), &dval, &used) == 0 &&
+           dval == 12.5e-3 && used == 7);
+    assert(tn_strtod(TN_STRING_LITERAL("5."), &dval, NULL) == 0 && dval == 5);
+    assert(tn_strtod(TN_STRING_LITERAL(".25"), &dval, NULL) == 0 &&
+           dval == 0.25);
+    assert(tn_strtod(TN_STRING_LITERAL("1e400"), &dval, NULL) == ERANGE &&
+           isinf(dval));
+    assert(tn_strtod(TN_STRING_LITERAL("inf"), &dval, NULL) == 0 &&
+           isinf(dval));
+    assert(tn_strtod(TN_STRING_LITERAL("."), &dval, NULL) == EINVAL);
+    assert(tn_strtod(TN_STRING_LITERAL("1e"), &dval, NULL) == EINVAL);
+    assert(tn_strtod(TN_STRING_LITERAL("1e"), &dval, &used) == 0 &&
+           dval == 1 && used == 1);
+    assert(tn_strtod(TN_STRING_LITERAL("0x10"), &dval, &used) == 0 &&
+           dval == 16 && used == 4);
+    assert(tn_strtod(TN_STRING_LITERAL("-0X1p4"), &dval, NULL) == 0 &&
+           dval == -16);
+    assert(tn_strtod(TN_STRING_LITERAL("nan,"), &dval, &used) == 0 &&
+           isnan(dval) && used == 3);
+    assert(tn_strtod(TN_STRING_LITERAL(" 1"), &dval, NULL) == EINVAL);
+    assert(tn_strtod(TN_EMPTY_STRING, &dval, NULL) == EINVAL);
+
+    /* Differential check against the C library */
+    for (iter = 0; iter < 20000; iter++)
+    {
+        char buf[64];
+        int len;
+        uint64_t bits = ((uint64_t)rand_r(&seed) << 33) ^
+            ((uint64_t)rand_r(&seed) << 11) ^ (uint64_t)rand_r(&seed);
+        int64_t signed_bits = (int64_t)(bits >> (rand_r(&seed) % 64));
+
+        len = snprintf(buf, sizeof(buf), "%" PRId64, signed_bits);
+        assert(tn_strtoi64((tn_string){.str = buf, .len = (size_t)len}, 10,
+                           &ival, NULL) == 0 && ival == signed_bits);
+        len = snprintf(buf, sizeof(buf), "%#" PRIx64, bits);
+        assert(tn_strtou64((tn_string){.str = buf, .len = (size_t)len}, 0,
+                           &uval, NULL) == 0 && uval == bits);
+
+        switch (iter % 3)
         {
-            dynbuf = tn_realloc(dynbuf, maxsize);
-            sz = STRFTIME(dynbuf, maxsize, fmt, tm);
-            maxsize *= 2;
+            case 0:
+                len = snprintf(buf, sizeof(buf), "%.*g",
+                               1 + rand_r(&seed) % 17,
+                               (double)signed_bits / (double)(1 + bits % 10000));
+                break;
+            case 1:
+                len = snprintf(buf, sizeof(buf), "%.*f", rand_r(&seed) % 8,
+                               (double)(signed_bits % 100000000) / 1000.0);
+                break;
+            default:
+                len = snprintf(buf, sizeof(buf), "%.17g",
+                               (double)bits * 1e-300 * (iter % 7));
+                break;
         }
-
-        dynbuf = tn_realloc(dynbuf, sz + 1);
-        dest->str = dynbuf;
-        dest->len = sz;
+        assert(tn_strtod((tn_string){.str = buf, .len = (size_t)len},
+                         &dval, NULL) == 0);
+        assert(dval == strtod(buf, NULL));
     }
-#undef STRFTIME
+}
+#endif
+
+tn_status
+tn_strftime(tn_string * restrict dest, const char * restrict fmt,
+            const struct tm * restrict tm)
+{
+    tn_strbuf buf = TN_STRBUF_INIT;
+    tn_status rc = strbuf_strftime(&buf, fmt, tm);
 
+    if (rc != 0)
+        return rc;
+    *dest = tn_strbuf_finish(&buf);
     return 0;
 }
 
@@ -1000,6 +4444,508 @@ static void test_strftime(void)
 }
 #endif
 
+#if DO_BENCHMARKS
+/* The original quadratic search, kept as a reference point */
+static bool
+bench_naive_strstr(tn_string str, tn_string sub, size_t *pos)
+{
+    size_t i, j;
+
+    for (i = 0; i + sub.len <= str.len; i++)
+    {
+        for (j = 0; j < sub.len; j++)
+        {
+            if (str.str[i + j] != sub.str[j])
+                break;
+        }
+        if (j == sub.len)
+        {
+            *pos = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+bench_strstr_variant(const char *variant,
+                     bool (*search)(tn_string, tn_string, size_t *),
+                     tn_string hay, tn_string needle)
+{
+    char params[64];
+    unsigned long iters;
+    double elapsed;
+    size_t pos = 0;
+
+    TN_BENCH_RUN(iters, elapsed,
+                 if (search(hay, needle, &pos))
+                     tn_bench_sink = pos);
+    snprintf(params, sizeof(params), "needle=%zu;haystack=%zu",
+             needle.len, hay.len);
+    tn_bench_report("strstr", variant, params, hay.len, iters, elapsed);
+}
+
+/*
+ * The haystack is random lowercase text with the needle
+ * planted at its very end, so every search scans the whole haystack
+ */
+static void
+bench_strstr(void)
+{
+    static const size_t needle_sizes[] = {1, 2, 4, 8, 16, 32, 64, 256, 1024};
+    static const size_t hay_sizes[] = {64, 4096, 262144, 4194304};
+    unsigned seed = 1;
+    size_t i, j, k;
+
+    for (i = 0; i < sizeof(hay_sizes) / sizeof(*hay_sizes); i++)
+    {
+        char *hay = tn_alloc_blob(hay_sizes[i]);
+
+        for (k = 0; k < hay_sizes[i]; k++)
+            hay[k] = (char)('a' + rand_r(&seed) % 26);
+
+        for (j = 0; j < sizeof(needle_sizes) / sizeof(*needle_sizes); j++)
+        {
+            tn_string htext = {.str = hay, .len = hay_sizes[i]};
+            tn_string needle;
+
+            if (needle_sizes[j] > hay_sizes[i])
+                continue;
+            needle = tn_substr(htext, hay_sizes[i] - needle_sizes[j],
+                               needle_sizes[j]);
+
+            bench_strstr_variant("tn_strstr", tn_strstr, htext, needle);
+            if (hay_sizes[i] <= 262144)
+            {
+                bench_strstr_variant("naive", bench_naive_strstr,
+                                     htext, needle);
+            }
+        }
+    }
+}
+
+static bool
+bench_strsearcher_find(tn_string hay, tn_string needle, size_t *pos)
+{
+    static const tn_strsearcher *searcher;
+
+    if (searcher == NULL)
+        searcher = tn_strsearcher_create(needle);
+    return tn_strsearcher_find(searcher, hay, pos);
+}
+
+/* Searching for the same needle in many short strings */
+static void
+bench_strsearcher(void)
+{
+    static const size_t hay_size = 256;
+    tn_string needle = TN_STRING_LITERAL("quick brown fox");
+    char *hay = tn_alloc_blob(hay_size);
+    unsigned seed = 1;
+    size_t k;
+
+    for (k = 0; k < hay_size; k++)
+        hay[k] = (char)('a' + rand_r(&seed) % 26);
+    memcpy(hay + hay_size - needle.len, needle.str, needle.len);
+
+    bench_strstr_variant("tn_strstr", tn_strstr,
+                         (tn_string){.str = hay, .len = hay_size}, needle);
+    bench_strstr_variant("tn_strsearcher", bench_strsearcher_find,
+                         (tn_string){.str = hay, .len = hay_size}, needle);
+}
+
+/* Vectorized byte scans against the reference loops */
+static void
+bench_strscan(void)
+{
+    static const size_t sizes[] = {16, 256, 4096, 65536};
+    size_t i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        char *str1 = malloc(sizes[i]);
+        char *str2 = malloc(sizes[i]);
+        char params[32];
+        size_t v;
+
+        memset(str1, 'a', sizes[i]);
+        memset(str2, 'a', sizes[i]);
+        snprintf(params, sizeof(params), "length=%zu", sizes[i]);
+
+        for (v = 0; v < sizeof(strscan_variants) / sizeof(*strscan_variants);
+             v++)
+        {
+            const strscan_ops *ops = strscan_variants[v];
+            unsigned long iters;
+            double elapsed;
+            size_t pos;
+
+            if (!strscan_usable(ops))
+                continue;
+            TN_BENCH_RUN(iters, elapsed,
+                         tn_bench_sink = ops->rchr(str1, sizes[i], 'x', &pos));
+            tn_bench_report("strrchr", ops->name, params, sizes[i],
+                            iters, elapsed);
+            TN_BENCH_RUN(iters, elapsed,
+                         tn_bench_sink = ops->lcprefix(str1, str2, sizes[i]));
+            tn_bench_report("strlcprefix", ops->name, params, sizes[i],
+                            iters, elapsed);
+            TN_BENCH_RUN(iters, elapsed,
+                         tn_bench_sink = ops->lcsuffix(str1 + sizes[i],
+                                                       str2 + sizes[i],
+                                                       sizes[i]));
+            tn_bench_report("strlcsuffix", ops->name, params, sizes[i],
+                            iters, elapsed);
+        }
+        free(str1);
+        free(str2);
+    }
+}
+
+/* Whitespace tokenization with a callback and with a byte set */
+static bool
+bench_is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static size_t
+bench_count_tokens(tn_string src)
+{
+    size_t n = 0;
+
+    while (tn_strtok(&src, bench_is_space, NULL))
+        n++;
+    return n;
+}
+
+static size_t
+bench_count_tokens_set(tn_string src, const tn_charset *spaces)
+{
+    size_t n = 0;
+
+    while (tn_strtok_set(&src, spaces, NULL))
+        n++;
+    return n;
+}
+
+static bool
+bench_is_comma(char c)
+{
+    return c == ',';
+}
+
+static void
+bench_strtok(void)
+{
+    static const size_t words[] = {4, 16, 64};
+    static const size_t size = 1024 * 1024;
+    char *text = malloc(size);
+    tn_string str = {.str = text, .len = size};
+    tn_charset spaces;
+    size_t i;
+
+    tn_charset_init(&spaces, TN_STRING_LITERAL(" \t\n"));
+    for (i = 0; i < sizeof(words) / sizeof(*words); i++)
+    {
+        char params[32];
+        unsigned long iters;
+        double elapsed;
+        size_t k;
+
+        for (k = 0; k < size; k++)
+            text[k] = (k + 1) % (words[i] + 1) == 0 ? " \t\n"[k % 3] :
+                (char)('a' + k % 26);
+        snprintf(params, sizeof(params), "size=%zu;word=%zu", size, words[i]);
+
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = bench_count_tokens(str));
+        tn_bench_report("strtok", "tn_strtok", params, size, iters, elapsed);
+
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = bench_count_tokens_set(str, &spaces));
+        tn_bench_report("strtok", "tn_strtok_set", params, size,
+                        iters, elapsed);
+    }
+    free(text);
+}
+
+/* Splitting CSV-like records into fields */
+static size_t
+bench_split_tokens(tn_string line)
+{
+    tn_string field;
+    size_t n = 0;
+
+    while (tn_strtok(&line, bench_is_comma, &field))
+        n += field.len;
+    return n;
+}
+
+hint_no_side_effects
+static size_t
+bench_split_iterator(tn_string line)
+{
+    tn_strsplitter iter = TN_STRSPLITTER_INIT(line, ',');
+    tn_string field;
+    size_t n = 0;
+
+    while (tn_strsplit_next(&iter, &field))
+        n += field.len;
+    return n;
+}
+
+static size_t
+bench_split_fields(tn_string line)
+{
+    tn_string fields[16];
+    size_t count = tn_strsplitn(line, ',', sizeof(fields) / sizeof(*fields),
+                                fields);
+    size_t n = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        n += fields[i].len;
+    return n;
+}
+
+static void
+bench_strsplit(void)
+{
+    static const size_t widths[] = {2, 8, 32};
+    char line[16 * 33];
+    size_t i;
+
+    for (i = 0; i < sizeof(widths) / sizeof(*widths); i++)
+    {
+        tn_string str = {.str = line, .len = 16 * (widths[i] + 1) - 1};
+        char params[32];
+        unsigned long iters;
+        double elapsed;
+        size_t k;
+
+        for (k = 0; k < str.len; k++)
+            line[k] = (k + 1) % (widths[i] + 1) == 0 ? ',' :
+                (char)('0' + k % 10);
+        snprintf(params, sizeof(params), "fields=16;width=%zu", widths[i]);
+
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = bench_split_tokens(str));
+        tn_bench_report("strsplit", "tn_strtok", params, str.len,
+                        iters, elapsed);
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = bench_split_iterator(str));
+        tn_bench_report("strsplit", "tn_strsplit_next", params, str.len,
+                        iters, elapsed);
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = bench_split_fields(str));
+        tn_bench_report("strsplit", "tn_strsplitn", params, str.len,
+                        iters, elapsed);
+    }
+}
+
+/* Building a string character by character */
+static void
+bench_strbuf(void)
+{
+    static const size_t sizes[] = {16, 256, 4096};
+    size_t i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        char params[32];
+        unsigned long iters;
+        double elapsed;
+        size_t k;
+
+        snprintf(params, sizeof(params), "length=%zu", sizes[i]);
+
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_string str = TN_EMPTY_STRING;
+                     for (k = 0; k < sizes[i]; k++)
+                         str = tn_straddch(str, 'x');
+                     tn_bench_sink = str.len);
+        tn_bench_report("addch", "tn_straddch", params, sizes[i],
+                        iters, elapsed);
+
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_strbuf buf = TN_STRBUF_INIT;
+                     for (k = 0; k < sizes[i]; k++)
+                         tn_strbuf_addch(&buf, 'x');
+                     tn_bench_sink = tn_strbuf_finish(&buf).len);
+        tn_bench_report("addch", "tn_strbuf", params, sizes[i],
+                        iters, elapsed);
+    }
+}
+
+/* Pairs of random strings differing by a few edits */
+static void
+bench_strdistance(void)
+{
+    static const size_t sizes[] = {8, 32, 64, 200, 1000};
+    unsigned seed = 1;
+    size_t i, k;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        char *buf1 = tn_alloc_blob(sizes[i]);
+        char *buf2 = tn_alloc_blob(sizes[i]);
+        tn_string str1 = {.str = buf1, .len = sizes[i]};
+        tn_string str2 = {.str = buf2, .len = sizes[i]};
+        char params[32];
+        unsigned long iters;
+        double elapsed;
+
+        for (k = 0; k < sizes[i]; k++)
+            buf1[k] = (char)('a' + rand_r(&seed) % 26);
+        memcpy(buf2, buf1, sizes[i]);
+        for (k = 0; k < 3; k++)
+            buf2[(size_t)rand_r(&seed) % sizes[i]] = '_';
+
+        snprintf(params, sizeof(params), "length=%zu", sizes[i]);
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = reference_strdistance(str1, str2));
+        tn_bench_report("strdistance", "wagner-fischer", params,
+                        sizes[i], iters, elapsed);
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = tn_strdistance(str1, str2));
+        tn_bench_report("strdistance", "tn_strdistance", params,
+                        sizes[i], iters, elapsed);
+        TN_BENCH_RUN(iters, elapsed,
+                     tn_bench_sink = tn_strdistance_max(str1, str2, 2));
+        tn_bench_report("strdistance", "tn_strdistance_max(2)", params,
+                        sizes[i], iters, elapsed);
+    }
+}
+
+/* Formatting with the native formatter and with vsnprintf() */
+hint_printf_like(1, 2)
+static tn_string
+bench_libc_printf(const char *fmt, ...)
+{
+    tn_strbuf buf = TN_STRBUF_INIT;
+    va_list args;
+
+    va_start(args, fmt);
+    if (strbuf_vprintf_libc(&buf, fmt, args) != 0)
+        abort();
+    va_end(args);
+
+    return tn_strbuf_finish(&buf);
+}
+
+static void
+bench_strprintf(void)
+{
+    static const char longstr[] =
+        "0123456789012345678901234567890123456789012345678901234567890123"
+        "4567890123456789012345678901234567890123456789012345678901234567";
+    unsigned long iters;
+    double elapsed;
+    tn_string result = TN_EMPTY_STRING;
+
+    TN_BENCH_RUN(iters, elapsed,
+                 (void)!tn_strprintf(&result, "%d", (int)iters);
+                 tn_bench_sink = result.len);
+    tn_bench_report("strprintf", "native", "fmt=%d", 0, iters, elapsed);
+    TN_BENCH_RUN(iters, elapsed,
+                 tn_bench_sink = bench_libc_printf("%d", (int)iters).len);
+    tn_bench_report("strprintf", "vsnprintf", "fmt=%d", 0, iters, elapsed);
+
+    TN_BENCH_RUN(iters, elapsed,
+                 (void)!tn_strprintf(&result, "%s:%lu:%08x", "key",
+                                     iters, (unsigned)iters);
+                 tn_bench_sink = result.len);
+    tn_bench_report("strprintf", "native", "fmt=%s:%lu:%08x", 0,
+                    iters, elapsed);
+    TN_BENCH_RUN(iters, elapsed,
+                 tn_bench_sink = bench_libc_printf("%s:%lu:%08x", "key", iters,
+                                                   (unsigned)iters).len);
+    tn_bench_report("strprintf", "vsnprintf", "fmt=%s:%lu:%08x", 0,
+                    iters, elapsed);
+
+    TN_BENCH_RUN(iters, elapsed,
+                 (void)!tn_strprintf(&result, "%s/%s", longstr, longstr);
+                 tn_bench_sink = result.len);
+    tn_bench_report("strprintf", "native", "fmt=%s/%s;len=257",
+                    2 * sizeof(longstr) - 1, iters, elapsed);
+    TN_BENCH_RUN(iters, elapsed,
+                 tn_bench_sink = bench_libc_printf("%s/%s", longstr,
+                                                   longstr).len);
+    tn_bench_report("strprintf", "vsnprintf", "fmt=%s/%s;len=257",
+                    2 * sizeof(longstr) - 1, iters, elapsed);
+}
+
+/* Numeric parsing from string views and with the C library */
+static void
+bench_strtonum(void)
+{
+    static const char *const inputs[] = {
+        "42", "1234567890123456", "-9223372036854775807",
+        "3.25", "-1234.5678e-3", "0.30000000000000004"
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(*inputs); i++)
+    {
+        tn_string str = tn_strdup(inputs[i]);
+        bool is_float = strpbrk(inputs[i], ".e") != NULL;
+        char params[48];
+        unsigned long iters;
+        double elapsed;
+
+        snprintf(params, sizeof(params), "input=%s", inputs[i]);
+        if (is_float)
+        {
+            double dval = 0;
+
+            TN_BENCH_RUN(iters, elapsed,
+                         (void)!tn_strtod(str, &dval, NULL);
+                         tn_bench_sink = (size_t)dval);
+            tn_bench_report("strtonum", "tn_strtod", params, str.len,
+                            iters, elapsed);
+            TN_BENCH_RUN(iters, elapsed,
+                         tn_bench_sink = (size_t)strtod(tn_str2cstr(str),
+                                                        NULL));
+            tn_bench_report("strtonum", "strtod", params, str.len,
+                            iters, elapsed);
+        }
+        else
+        {
+            int64_t ival = 0;
+
+            TN_BENCH_RUN(iters, elapsed,
+                         (void)!tn_strtoi64(str, 10, &ival, NULL);
+                         tn_bench_sink = (size_t)ival);
+            tn_bench_report("strtonum", "tn_strtoi64", params, str.len,
+                            iters, elapsed);
+            TN_BENCH_RUN(iters, elapsed,
+                         tn_bench_sink = (size_t)strtoll(tn_str2cstr(str),
+                                                         NULL, 10));
+            tn_bench_report("strtonum", "strtoll", params, str.len,
+                            iters, elapsed);
+        }
+    }
+}
+
+int main()
+{
+    GC_INIT();
+    puts(TN_BENCH_CSV_HEADER);
+    bench_strstr();
+    bench_strsearcher();
+    bench_strscan();
+    bench_strtok();
+    bench_strsplit();
+    bench_strbuf();
+    bench_strdistance();
+    bench_strprintf();
+    bench_strtonum();
+
+    return 0;
+}
+#endif
+
 #if DO_TESTS
 int main()
 {
@@ -1010,20 +4956,33 @@ int main()
     test_str2cstr();
     test_strcat();
     test_straddch();
+    test_strbuf();
     test_strcats();
     test_substr();
     test_strcut();
     test_lc_prefix_suffix();
     test_strchr_strrchr();
+    test_strscan_engines();
     test_isprefix_issuffix();
     test_strstr();
+    test_strstr_engines();
+    test_strsearcher();
+    test_strkeywords();
     test_strtok();
     test_strmap();
     test_strfilter();
+    test_charset();
+    test_strsplit();
     test_strrepeat();
     test_distance();
+    test_distance_max();
+    test_distance_engines();
+    test_strhash();
+    test_strintern();
     test_sprintf();
+    test_sprintf_conversions();
     test_sscanf();
+    test_strtonum();
     test_strftime();
     
     puts("OK");
@@ -101,6 +101,70 @@ extern tn_string tn_strcat(tn_string str1, tn_string str2);
 warn_unused_result
 extern tn_string tn_straddch(tn_string str, char ch);
 
+/**
+ * Growable string builder with amortized constant-time appends.
+ * A builder must be initialized with TN_STRBUF_INIT, and
+ * tn_strbuf_finish() hands over its contents as a tn_string
+ * without copying
+ */
+typedef struct tn_strbuf {
+    char *str;
+    size_t len;
+    size_t capacity;
+} tn_strbuf;
+
+#define TN_STRBUF_INIT ((tn_strbuf){.str = NULL, .len = 0, .capacity = 0})
+
+/**
+ * Ensures there is space for at least @a extra more bytes in @a buf
+ */
+warn_null_args(1)
+extern void tn_strbuf_reserve(tn_strbuf *buf, size_t extra);
+
+warn_null_args(1)
+static inline void
+tn_strbuf_addch(tn_strbuf *buf, char ch)
+{
+    if (buf->len == buf->capacity)
+        tn_strbuf_reserve(buf, 1);
+    buf->str[buf->len++] = ch;
+}
+
+warn_null_args(1)
+extern void tn_strbuf_append(tn_strbuf *buf, tn_string str);
+
+warn_unused_result
+warn_null_args(1, 2)
+hint_printf_like(2, 3)
+extern tn_status tn_strbuf_printf(tn_strbuf * restrict buf,
+                                  const char * restrict fmt, ...);
+
+warn_unused_result
+warn_null_args(1, 2)
+hint_printf_like(2, 0)
+extern tn_status tn_strbuf_vprintf(tn_strbuf * restrict buf,
+                                   const char * restrict fmt, va_list args);
+
+/**
+ * Appends the result of strftime()
+ *
+ * @return 0 or ERANGE if the result is unreasonably long
+ * for the format, in which case nothing is appended
+ */
+warn_unused_result
+warn_any_null_arg
+hint_strftime_like(2)
+extern tn_status tn_strbuf_strftime(tn_strbuf * restrict buf,
+                                    const char * restrict fmt,
+                                    const struct tm * restrict tm);
+
+/**
+ * Returns the built string and resets @a buf to the empty state
+ */
+warn_unused_result
+warn_null_args(1)
+extern tn_string tn_strbuf_finish(tn_strbuf *buf);
+
 warn_unused_result
 extern tn_string tn_strcats(size_t n, tn_string strs[var_size(n)], tn_string sep);
 
@@ -137,9 +201,145 @@ extern bool tn_strrchr(tn_string str, char ch, size_t *pos);
 warn_unused_result
 extern bool tn_strstr(tn_string str, tn_string sub, size_t *pos);
 
+/**
+ * A needle compiled for repeated searches by tn_strsearcher_create().
+ * Searchers are immutable once created, so a single searcher
+ * may be shared between threads
+ */
+typedef struct tn_strsearcher tn_strsearcher;
+
+warn_unused_result
+hint_returns_not_null
+extern const tn_strsearcher *tn_strsearcher_create(tn_string needle);
+
+/**
+ * Returns a private copy of the needle of @a searcher
+ */
+warn_unused_result
+warn_null_args(1)
+hint_no_side_effects
+extern tn_string tn_strsearcher_needle(const tn_strsearcher *searcher);
+
+/**
+ * Finds the first occurrence of the needle in @a str,
+ * like tn_strstr()
+ */
+warn_unused_result
+warn_null_args(1)
+extern bool tn_strsearcher_find(const tn_strsearcher *searcher,
+                                tn_string str, size_t *pos);
+
+/**
+ * Finds the last occurrence of the needle in @a str
+ */
+warn_unused_result
+warn_null_args(1)
+extern bool tn_strsearcher_rfind(const tn_strsearcher *searcher,
+                                 tn_string str, size_t *pos);
+
+/**
+ * Stores the positions of at most @a max non-overlapping
+ * occurrences of the needle in @a str into @a positions
+ *
+ * @return the number of positions stored
+ */
+warn_unused_result
+warn_null_args(1)
+extern size_t tn_strsearcher_findall(const tn_strsearcher *searcher,
+                                     tn_string str, size_t max,
+                                     size_t positions[var_size(max)]);
+
+/**
+ * Counts non-overlapping occurrences of the needle in @a str
+ */
+warn_unused_result
+warn_null_args(1)
+hint_no_side_effects
+extern size_t tn_strsearcher_count(const tn_strsearcher *searcher,
+                                   tn_string str);
+
+/**
+ * A set of keywords compiled by tn_strkeywords_create() to be
+ * searched for simultaneously. Like tn_strsearcher, it is immutable
+ */
+typedef struct tn_strkeywords tn_strkeywords;
+
+warn_unused_result
+hint_returns_not_null
+extern const tn_strkeywords *tn_strkeywords_create(
+        size_t n, const tn_string keywords[var_size(n)]);
+
+/**
+ * Finds the occurrence of any keyword that ends first in @a str.
+ * If several keywords end at the same position, the longest one
+ * is reported; if there are duplicate keywords, the first one is.
+ *
+ * @param pos    The start of the occurrence (may be NULL)
+ * @param which  The index of the keyword found (may be NULL)
+ */
+warn_unused_result
+warn_null_args(1)
+extern bool tn_strkeywords_find(const tn_strkeywords *keywords,
+                                tn_string str, size_t *pos, size_t *which);
+
+/**
+ * Computes the Levenshtein distance between @a str1 and @a str2.
+ * If at least one string is no longer than 64 bytes, no memory
+ * is allocated
+ */
 warn_unused_result
 extern size_t tn_strdistance(tn_string str1, tn_string str2);
 
+/**
+ * Like tn_strdistance(), but gives up as soon as the distance is known
+ * to exceed @a max
+ *
+ * @return The distance, if it is not greater than @a max,
+ *         otherwise @a max + 1
+ */
+warn_unused_result
+extern size_t tn_strdistance_max(tn_string str1, tn_string str2, size_t max);
+
+/**
+ * Computes a strong 64-bit hash of @a str. The hash function is keyed
+ * with a random per-process key, so hash values must never be
+ * stored outside of the process
+ */
+warn_unused_result
+hint_no_side_effects
+extern uint64_t tn_strhash(tn_string str);
+
+/**
+ * Returns the canonical copy of @a str from the global interning
+ * table, adding it to the table if necessary. All interned strings with
+ * the same content share the same storage, so they may be compared with
+ * tn_strinterned_eq(). Interned strings are NUL-terminated and
+ * are never freed, so they are also valid flat CORDs.
+ * It is safe to call from several threads at once.
+ */
+warn_unused_result
+extern tn_string tn_strintern(tn_string str);
+
+/**
+ * Looks up @a str in the interning table without adding it.
+ * Lookups never take any locks
+ *
+ * @param interned The canonical copy of @a str if found (may be NULL)
+ */
+warn_unused_result
+extern bool tn_strinterned(tn_string str, tn_string *interned);
+
+/**
+ * Compares two interned strings
+ */
+warn_unused_result
+hint_no_shared_state
+static inline bool
+tn_strinterned_eq(tn_string str1, tn_string str2)
+{
+    return str1.str == str2.str;
+}
+
 warn_unused_result
 warn_null_args(1, 2)
 extern bool tn_strtok(tn_string * restrict src, bool (*predicate)(char c),
@@ -153,9 +353,171 @@ warn_unused_result
 warn_null_args(2)
 extern tn_string tn_strfilter(tn_string str, bool (*predicate)(char ch));
 
+/**
+ * A set of bytes for classifying strings in bulk.
+ * Besides a plain bitmap, it keeps nibble tables which allow to
+ * classify 16 or 32 bytes at once with byte shuffles.
+ * Sets are filled by tn_charset_init() or tn_charset_init_predicate()
+ * and are read-only afterwards, so they may be shared between threads
+ */
+typedef struct tn_charset {
+    /**
+     * Rows are indexed by the low nibble of a byte; the bit number
+     * `high nibble % 8` is set if the byte is a member. The first
+     * table is for bytes below 0x80, the second for the rest
+     */
+    uint8_t nibbles[2][16];
+    uint32_t bits[(UINT8_MAX + 1) / 32];
+} tn_charset;
+
+/**
+ * Initializes @a set to contain exactly the bytes of @a chars
+ */
+warn_null_args(1)
+extern void tn_charset_init(tn_charset *set, tn_string chars);
+
+/**
+ * Initializes @a set to contain the bytes for which
+ * @a predicate is true. Useful to turn a predicate callback
+ * into a set once and then scan many strings with it
+ */
+warn_null_args(1, 2)
+extern void tn_charset_init_predicate(tn_charset *set,
+                                      bool (*predicate)(char ch));
+
+warn_unused_result
+warn_null_args(1)
+static inline bool
+tn_charset_has(const tn_charset *set, char ch)
+{
+    uint8_t c = (uint8_t)ch;
+
+    return (set->bits[c / 32] >> (c % 32)) & 1u;
+}
+
+/**
+ * Returns the length of the longest prefix of @a str
+ * consisting only of the members of @a set
+ */
+warn_unused_result
+warn_null_args(2)
+hint_no_side_effects
+extern size_t tn_strspan(tn_string str, const tn_charset *set);
+
+/**
+ * Returns the length of the longest prefix of @a str
+ * containing no members of @a set
+ */
+warn_unused_result
+warn_null_args(2)
+hint_no_side_effects
+extern size_t tn_strcspan(tn_string str, const tn_charset *set);
+
+/**
+ * The same as tn_strtok(), but tokens are delimited by any bytes
+ * from @a delims
+ */
+warn_unused_result
+warn_null_args(1, 2)
+extern bool tn_strtok_set(tn_string * restrict src,
+                          const tn_charset *delims,
+                          tn_string * restrict tok);
+
+/**
+ * The same as tn_strfilter(), but keeps the bytes which are
+ * members of @a set
+ */
+warn_unused_result
+warn_null_args(2)
+extern tn_string tn_strfilter_set(tn_string str, const tn_charset *set);
+
+/**
+ * The same as tn_strmap(), but each byte is replaced by
+ * the corresponding entry of @a table
+ */
+warn_unused_result
+warn_null_args(2)
+extern tn_string tn_strtranslate(tn_string str,
+                                 const char table[at_least(UINT8_MAX + 1)]);
+
+/**
+ * An iterator over the fields of a string separated by a single byte.
+ * Fields are views into the original string, so nothing is allocated.
+ * Unlike tn_strtok(), empty fields are kept: "a,,b" has three fields,
+ * and an empty string has one empty field
+ */
+typedef struct tn_strsplitter {
+    tn_string rest;
+    char sep;
+    bool done;
+} tn_strsplitter;
+
+#define TN_STRSPLITTER_INIT(_str, _sep)                             \
+    ((tn_strsplitter){.rest = (_str), .sep = (_sep), .done = false})
+
+/**
+ * Stores the next field of @a iter into @a field
+ *
+ * @return false if there are no more fields
+ */
+warn_unused_result
+warn_null_args(1, 2)
+static inline bool
+tn_strsplit_next(tn_strsplitter * restrict iter, tn_string * restrict field)
+{
+    const char *found;
+
+    if (iter->done)
+        return false;
+
+    found = iter->rest.len == 0 ? NULL :
+        memchr(iter->rest.str, iter->sep, iter->rest.len);
+    if (found == NULL)
+    {
+        *field = iter->rest;
+        iter->rest = TN_EMPTY_STRING;
+        iter->done = true;
+        return true;
+    }
+
+    field->len = (size_t)(found - iter->rest.str);
+    field->str = field->len == 0 ? NULL : iter->rest.str;
+    iter->rest.str = found + 1;
+    iter->rest.len -= field->len + 1;
+    if (iter->rest.len == 0)
+        iter->rest.str = NULL;
+    return true;
+}
+
+/**
+ * Splits @a str into at most @a max fields separated by @a sep.
+ * If there are more, the last field holds the unsplit rest
+ * of the string. The fields are the same as produced by
+ * tn_strsplit_next() and are views into @a str
+ *
+ * @return The number of fields stored
+ */
+warn_unused_result
+extern size_t tn_strsplitn(tn_string str, char sep, size_t max,
+                           tn_string fields[var_size(max)]);
+
 warn_unused_result
 extern tn_string tn_strrepeat(tn_string str, unsigned n);
 
+/**
+ * Formats a tn_string with printf-like functions, e.g.
+ * `tn_strprintf(&dest, "name=" TN_STRING_FMT, TN_STRING_ARGS(name))`.
+ * Note that as with any `%.*s`, the output stops at an embedded NUL
+ */
+#define TN_STRING_FMT "%.*s"
+#define TN_STRING_ARGS(_str) (int)(_str).len, (_str).str
+
+/**
+ * Formats a string. The common conversions (integers, characters and
+ * strings) are done natively in a single pass, floating-point ones are
+ * delegated to snprintf(), and anything else makes the whole format
+ * go through vsnprintf(). The result is allocated to its exact size
+ */
 warn_unused_result
 warn_null_args(1, 2)
 hint_printf_like(2, 3)
@@ -178,6 +540,41 @@ hint_scanf_like(3, 0)
 extern tn_status tn_strvscanf(tn_string src, unsigned *count, const char * restrict fmt,
                               va_list args);
 
+/**
+ * Parses a signed 64-bit integer from @a str. An optional sign
+ * may be followed by a `0x`, `0o` or `0b` prefix, which is recognized
+ * if @a base is 0 or the corresponding base. With @a base 0 numbers
+ * without a prefix are decimal (a leading zero does not mean octal).
+ * Leading whitespace is not skipped.
+ *
+ * @param used If NULL, the whole of @a str must be a number; otherwise
+ *             the longest valid prefix is parsed and its length stored
+ * @return 0, EINVAL if there is no number, or ERANGE if it does not fit,
+ *         in which case @a result is saturated
+ */
+warn_unused_result
+warn_null_args(3)
+extern tn_status tn_strtoi64(tn_string str, unsigned base, int64_t *result,
+                             size_t *used);
+
+/**
+ * The same as tn_strtoi64() for unsigned numbers. Negative numbers
+ * other than zero are out of range
+ */
+warn_unused_result
+warn_null_args(3)
+extern tn_status tn_strtou64(tn_string str, unsigned base, uint64_t *result,
+                             size_t *used);
+
+/**
+ * Parses a floating-point number from @a str. The conventions are
+ * the same as for tn_strtoi64(); ERANGE is returned when strtod()
+ * would report it
+ */
+warn_unused_result
+warn_null_args(2)
+extern tn_status tn_strtod(tn_string str, double *result, size_t *used);
+
 warn_unused_result
 warn_any_null_arg
 hint_strftime_like(2)
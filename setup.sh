@@ -48,6 +48,7 @@ BUILDDIR="build/${PLATFORM_PLATFORM}"
 
 mkdir -p "$BUILDDIR" || exit 1
 mkdir -p "$BUILDDIR/tests" || exit 1
+mkdir -p "$BUILDDIR/bench" || exit 1
 
 if ! ${CC} -Wall -W -Werror -o "$BUILDDIR/testrun" setup/testrun.c || \
         ! test -x "$BUILDDIR/testrun"; then
@@ -26,14 +26,35 @@
  */
 
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <pthread.h>
+#if PLATFORM_ARCH_IS_amd64
+#include <immintrin.h>
+#endif
 #if DO_TESTS
 #include <stdio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <rpc/xdr.h>
 #include <math.h>
 #endif
+#if DO_BENCHMARKS
+#include <stdio.h>
+#include <rpc/xdr.h>
+#include "bench.h"
+#endif
 #include "utils.h"
 #include "xdr.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 #if DO_TESTS
 #define TEST_START ((void)(fprintf(stderr, "%s():\n", __FUNCTION__)))
 
@@ -168,19 +189,13 @@ DEFINE_OVERFLOW_TEST(bool, ovrmax, bool, 2);
 #endif
 
 tn_status
-tn_xdr_read_from_stream(tn_xdr_stream * restrict stream,
-                        void * restrict dest, size_t sz)
+tn_xdr_read_from_backend(tn_xdr_stream * restrict stream,
+                         void * restrict dest, size_t sz)
 {
-    tn_status status;
-
-    if (stream->limit - stream->pos < sz)
+    if (tn_xdr_stream_left(stream) < sz)
         return ENOMSG;
 
-    status = stream->reader(stream, dest, sz);
-    if (status == 0)
-        stream->pos += sz;
-
-    return status;
+    return stream->reader(stream, dest, sz);
 }
 
 #if DO_TESTS
@@ -211,19 +226,13 @@ static void test_read_not_enough_data(void)
 #endif
 
 tn_status
-tn_xdr_write_to_stream(tn_xdr_stream * restrict stream,
-                       const void * restrict dest, size_t sz)
+tn_xdr_write_to_backend(tn_xdr_stream * restrict stream,
+                        const void * restrict dest, size_t sz)
 {
-    tn_status status;
-
-    if (stream->limit - stream->pos < sz)
+    if (tn_xdr_stream_left(stream) < sz)
         return ENOSPC;
 
-    status = stream->writer(stream, dest, sz);
-    if (status == 0)
-        stream->pos += sz;
-
-    return status;
+    return stream->writer(stream, dest, sz);
 }
 
 #if DO_TESTS
@@ -245,6 +254,85 @@ static void test_write_not_enough_space(void)
 #endif
 
 
+tn_status
+tn_xdr_encode_varint(tn_xdr_stream * restrict stream, uint64_t value)
+{
+    uint8_t buf[TN_XDR_VARINT_MAX];
+    uint8_t *dest = buf;
+    size_t n = 0;
+
+    if (tn_xdr_write_room(stream) >= TN_XDR_VARINT_MAX)
+        dest = stream->cur;
+
+    while (value >= 0x80)
+    {
+        dest[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    dest[n++] = (uint8_t)value;
+
+    if (dest == buf)
+        return tn_xdr_write_to_stream(stream, buf, n);
+    stream->cur += n;
+    return 0;
+}
+
+/* Parses a varint from @a avail bytes, returning ENOMSG if it is
+ * incomplete */
+warn_unused_result
+static tn_status
+xdr_get_varint(const uint8_t *src, size_t avail, uint64_t *value,
+               size_t *used)
+{
+    uint64_t result = 0;
+    size_t i;
+
+    for (i = 0; i < avail; i++)
+    {
+        uint8_t byte = src[i];
+
+        if (i == TN_XDR_VARINT_MAX - 1 && byte > 1)
+            return EPROTO;
+        result |= (uint64_t)(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            *used = i + 1;
+            return 0;
+        }
+    }
+    return avail >= TN_XDR_VARINT_MAX ? EPROTO : ENOMSG;
+}
+
+tn_status
+tn_xdr_decode_varint(tn_xdr_stream * restrict stream,
+                     uint64_t * restrict value)
+{
+    uint8_t buf[TN_XDR_VARINT_MAX];
+    size_t used;
+    size_t n;
+    tn_status rc = xdr_get_varint(stream->cur,
+                                  (size_t)(stream->end - stream->cur),
+                                  value, &used);
+
+    if (rc == 0)
+        stream->cur += used;
+    if (rc != ENOMSG)
+        return rc;
+
+    /* The varint crosses the window end, so it is read
+     * byte by byte through the backend */
+    for (n = 0; n < TN_XDR_VARINT_MAX; n++)
+    {
+        rc = tn_xdr_read_from_stream(stream, &buf[n], 1);
+        if (rc != 0)
+            return rc;
+        if ((buf[n] & 0x80) == 0)
+            return xdr_get_varint(buf, n + 1, value, &used);
+    }
+    return EPROTO;
+}
+
 tn_status
 tn_xdr_encode_int64(tn_xdr_stream * restrict stream,
                     const int64_t * restrict data)
@@ -253,6 +341,9 @@ tn_xdr_encode_int64(tn_xdr_stream * restrict stream,
     int32_t high = (int32_t)(*data >> 32);
     uint32_t low = (uint32_t)(*data & 0xffffffffu);
 
+    if (stream->compact)
+        return tn_xdr_encode_varint(stream, tn_xdr_zigzag(*data));
+
     rc = tn_xdr_encode_int32(stream, &high);
     if (rc == 0)
         rc = tn_xdr_encode_uint32(stream, &low);
@@ -267,6 +358,16 @@ tn_xdr_decode_int64(tn_xdr_stream * restrict stream, int64_t * restrict data)
     int32_t high;
     uint32_t low;
 
+    if (stream->compact)
+    {
+        uint64_t var;
+
+        rc = tn_xdr_decode_varint(stream, &var);
+        if (rc == 0)
+            *data = tn_xdr_unzigzag(var);
+        return rc;
+    }
+
     rc = tn_xdr_decode_int32(stream, &high);
     if (rc == 0)
         rc = tn_xdr_decode_uint32(stream, &low);
@@ -284,6 +385,9 @@ tn_xdr_encode_uint64(tn_xdr_stream * restrict stream,
     uint32_t high = (uint32_t)(*data >> 32);
     uint32_t low = (uint32_t)(*data & 0xffffffffu);
 
+    if (stream->compact)
+        return tn_xdr_encode_varint(stream, *data);
+
     rc = tn_xdr_encode_uint32(stream, &high);
     if (rc == 0)
         rc = tn_xdr_encode_uint32(stream, &low);
@@ -298,6 +402,9 @@ tn_xdr_decode_uint64(tn_xdr_stream * restrict stream, uint64_t * restrict data)
     uint32_t high;
     uint32_t low;
 
+    if (stream->compact)
+        return tn_xdr_decode_varint(stream, data);
+
     rc = tn_xdr_decode_uint32(stream, &high);
     if (rc == 0)
         rc = tn_xdr_decode_uint32(stream, &low);
@@ -318,7 +425,8 @@ tn_xdr_encode_length(tn_xdr_stream * restrict stream, size_t length)
 #endif
 
     /* This only checks against the minimum possible space requirement */
-    if (stream->limit - stream->pos < length + sizeof(uint32_t))
+    if (tn_xdr_stream_left(stream) <
+        length + (stream->compact ? 1 : sizeof(uint32_t)))
         return ENOSPC;
 
     len32 = (uint32_t)length;
@@ -335,7 +443,7 @@ tn_xdr_decode_length(tn_xdr_stream * restrict stream,
     if (rc != 0)
         return rc;
 
-    if (stream->limit - stream->pos < len32)
+    if (tn_xdr_stream_left(stream) < len32)
         return EPROTO;
 
     *length = (size_t)len32;
@@ -352,10 +460,10 @@ xdr_add_padding(tn_xdr_stream * stream, size_t len)
 {
     uint32_t zero = 0;
 
-    if (len % 4 == 0)
+    if (len % 4 == 0 || stream->compact)
         return 0;
 
-    return tn_xdr_write_to_stream(stream, &zero, len % 4);
+    return tn_xdr_write_to_stream(stream, &zero, 4 - len % 4);
 }
 
 
@@ -366,10 +474,10 @@ xdr_skip_padding(tn_xdr_stream * stream, size_t len)
     tn_status rc;
     uint32_t scratch = 0;
 
-    if (len % 4 == 0)
+    if (len % 4 == 0 || stream->compact)
         return 0;
 
-    rc = tn_xdr_read_from_stream(stream, &scratch, len % 4);
+    rc = tn_xdr_read_from_stream(stream, &scratch, 4 - len % 4);
     if (rc != 0)
         return rc;
 
@@ -382,8 +490,14 @@ tn_xdr_encode_bytes(tn_xdr_stream * restrict stream,
                     size_t len,
                     const uint8_t data[restrict var_size(len)])
 {
-    tn_status rc =
-        tn_xdr_write_to_stream(stream, data, len);
+    tn_status rc;
+
+    if (stream->referrer == NULL)
+        rc = tn_xdr_write_to_stream(stream, data, len);
+    else if (tn_xdr_stream_left(stream) < len)
+        rc = ENOSPC;
+    else
+        rc = stream->referrer(stream, data, len);
 
     if (rc == 0)
         rc = xdr_add_padding(stream, len);
@@ -418,6 +532,68 @@ tn_xdr_encode_var_bytes(tn_xdr_stream * restrict stream,
     return tn_xdr_encode_bytes(stream, len, data);
 }
 
+/*
+ * Var arrays and opaque data larger than that which are not yet
+ * in the window start with room for what the window holds, but
+ * at least that much, and grow as more data arrive. So the memory
+ * taken by a hostile length is bounded by the data actually received,
+ * even when decoding is retried, as resumable decoding does
+ */
+#define XDR_DECODE_CHUNK_SIZE (4 * 1024)
+
+/*
+ * Reads @a len bytes of opaque data with their padding into
+ * a new blob, which has @a extra more bytes at the end.
+ * Streams of unknown length may announce any length, so large
+ * blobs grow as their data actually arrive
+ */
+warn_unused_result
+static tn_status
+xdr_decode_blob(tn_xdr_stream * restrict stream, size_t len, size_t extra,
+                uint8_t ** restrict data)
+{
+    size_t avail = (size_t)(stream->end - stream->cur);
+    size_t total;
+    size_t capacity;
+    size_t done = 0;
+    uint8_t *buf;
+    tn_status rc;
+
+    if (len > SIZE_MAX - extra)
+        return EMSGSIZE;
+    rc = tn_xdr_charge_alloc(stream, len + extra, 1, &total);
+    if (rc != 0)
+        return rc;
+
+    capacity = total;
+    if (total > XDR_DECODE_CHUNK_SIZE && len > avail)
+    {
+        capacity = avail + extra > XDR_DECODE_CHUNK_SIZE ?
+            avail + extra : XDR_DECODE_CHUNK_SIZE;
+    }
+    buf = tn_alloc_blob(capacity);
+
+    while (done < len)
+    {
+        size_t n;
+
+        if (done == capacity)
+        {
+            capacity = capacity > total - capacity ? total : 2 * capacity;
+            buf = tn_realloc(buf, capacity);
+        }
+        n = (capacity < len ? capacity : len) - done;
+        rc = tn_xdr_read_from_stream(stream, buf + done, n);
+        if (rc != 0)
+            return rc;
+        done += n;
+    }
+
+    rc = xdr_skip_padding(stream, len);
+    if (rc == 0)
+        *data = buf;
+    return rc;
+}
 
 tn_status
 tn_xdr_decode_var_bytes(tn_xdr_stream * restrict stream,
@@ -435,8 +611,7 @@ tn_xdr_decode_var_bytes(tn_xdr_stream * restrict stream,
         *data = NULL;
     else
     {
-        buf = tn_alloc_blob(len0);
-        rc = tn_xdr_decode_bytes(stream, len0, buf);
+        rc = xdr_decode_blob(stream, len0, 0, &buf);
         if (rc != 0)
             return rc;
         *data = buf;
@@ -450,22 +625,519 @@ tn_xdr_decode_cstring(tn_xdr_stream * restrict stream, char ** restrict str)
 {
     tn_status rc;
     size_t len;
-    char *buf;
+    uint8_t *buf;
 
     rc = tn_xdr_decode_length(stream, &len);
     if (rc != 0)
         return rc;
-
-    buf = tn_alloc_blob(len + 1);
-    rc = tn_xdr_decode_bytes(stream, len, (uint8_t *)buf);
+    rc = xdr_decode_blob(stream, len, 1, &buf);
     if (rc != 0)
         return rc;
 
     buf[len] = '\0';
-    *str = buf;
+    *str = (char *)buf;
+    return 0;
+}
+
+tn_status
+tn_xdr_decode_bytes_view(tn_xdr_stream * restrict stream,
+                         size_t len,
+                         tn_xdr_view * restrict view)
+{
+    tn_status rc;
+
+    if (stream->viewer == NULL)
+    {
+        uint8_t *buf;
+
+        rc = xdr_decode_blob(stream, len, 0, &buf);
+        if (rc != 0)
+            return rc;
+        *view = (tn_xdr_view){.data = buf, .len = len, .owner = buf};
+        return 0;
+    }
+
+    if (tn_xdr_stream_left(stream) < len)
+        return ENOMSG;
+    rc = stream->viewer(stream, len, view);
+    if (rc != 0)
+        return rc;
+
+    return xdr_skip_padding(stream, len);
+}
+
+tn_status
+tn_xdr_decode_var_bytes_view(tn_xdr_stream * restrict stream,
+                             tn_xdr_view * restrict view)
+{
+    size_t len;
+    tn_status rc = tn_xdr_decode_length(stream, &len);
+
+    if (rc != 0)
+        return rc;
+
+    return tn_xdr_decode_bytes_view(stream, len, view);
+}
+
+
+#define DEFINE_XDR_BUILTIN_DESCR(_type, _ctype)                     \
+    static tn_status                                                \
+    xdr_encode_##_type##_elt(tn_xdr_stream * restrict stream,       \
+                             const void * restrict data)            \
+    {                                                               \
+        return tn_xdr_encode_##_type(stream, (const _ctype *)data); \
+    }                                                               \
+                                                                    \
+    static tn_status                                                \
+    xdr_decode_##_type##_elt(tn_xdr_stream * restrict stream,       \
+                             void * restrict data)                  \
+    {                                                               \
+        return tn_xdr_decode_##_type(stream, (_ctype *)data);       \
+    }                                                               \
+                                                                    \
+    static tn_status                                                \
+    xdr_measure_##_type##_elt(unused const void * restrict data,    \
+                              size_t * restrict size)               \
+    {                                                               \
+        *size += TN_XDR_SIZE_##_type;                               \
+        return 0;                                                   \
+    }                                                               \
+                                                                    \
+    const tn_xdr_element_descr tn_xdr_##_type##_descr = {           \
+        .elsize = sizeof(_ctype),                                   \
+        .encode = xdr_encode_##_type##_elt,                         \
+        .decode = xdr_decode_##_type##_elt,                         \
+        .measure = xdr_measure_##_type##_elt,                       \
+        .fixed_size = TN_XDR_SIZE_##_type                           \
+    }
+
+DEFINE_XDR_BUILTIN_DESCR(int32, int32_t);
+DEFINE_XDR_BUILTIN_DESCR(uint32, uint32_t);
+DEFINE_XDR_BUILTIN_DESCR(int64, int64_t);
+DEFINE_XDR_BUILTIN_DESCR(uint64, uint64_t);
+DEFINE_XDR_BUILTIN_DESCR(float, float);
+DEFINE_XDR_BUILTIN_DESCR(double, double);
+
+/*
+ * Arrays of built-in 4- and 8-byte numbers are converted
+ * between host and XDR order in bulk, straight from or into
+ * the stream window. On big-endian hosts that is just copying
+ */
+typedef void (*xdr_bswap_func)(uint8_t * restrict dest,
+                               const uint8_t * restrict src,
+                               size_t n, size_t width);
+
+static void
+xdr_bswap_scalar(uint8_t * restrict dest, const uint8_t * restrict src,
+                 size_t n, size_t width)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dest, src, n * width);
+#else
+    size_t i;
+
+    if (width == sizeof(uint32_t))
+    {
+        for (i = 0; i < n; i++)
+        {
+            uint32_t val;
+
+            memcpy(&val, src + i * sizeof(val), sizeof(val));
+            val = __builtin_bswap32(val);
+            memcpy(dest + i * sizeof(val), &val, sizeof(val));
+        }
+    }
+    else
+    {
+        for (i = 0; i < n; i++)
+        {
+            uint64_t val;
+
+            memcpy(&val, src + i * sizeof(val), sizeof(val));
+            val = __builtin_bswap64(val);
+            memcpy(dest + i * sizeof(val), &val, sizeof(val));
+        }
+    }
+#endif
+}
+
+#if PLATFORM_ARCH_IS_amd64 && defined(target_isa)
+target_isa("ssse3")
+static inline __m128i
+xdr_bswap_order(size_t width)
+{
+    return width == sizeof(uint32_t) ?
+        _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12) :
+        _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+}
+
+target_isa("ssse3")
+static void
+xdr_bswap_ssse3(uint8_t * restrict dest, const uint8_t * restrict src,
+                size_t n, size_t width)
+{
+    const __m128i order = xdr_bswap_order(width);
+    size_t nbytes = n * width;
+    size_t i;
+
+    for (i = 0; i + sizeof(__m128i) <= nbytes; i += sizeof(__m128i))
+    {
+        _mm_storeu_si128((__m128i *)(dest + i),
+                         _mm_shuffle_epi8(
+                             _mm_loadu_si128((const __m128i *)(src + i)),
+                             order));
+    }
+    xdr_bswap_scalar(dest + i, src + i, (nbytes - i) / width, width);
+}
+
+target_isa("avx2")
+static void
+xdr_bswap_avx2(uint8_t * restrict dest, const uint8_t * restrict src,
+               size_t n, size_t width)
+{
+    const __m256i order = _mm256_broadcastsi128_si256(xdr_bswap_order(width));
+    size_t nbytes = n * width;
+    size_t i;
+
+    for (i = 0; i + sizeof(__m256i) <= nbytes; i += sizeof(__m256i))
+    {
+        _mm256_storeu_si256((__m256i *)(dest + i),
+                            _mm256_shuffle_epi8(
+                                _mm256_loadu_si256((const __m256i *)
+                                                   (src + i)),
+                                order));
+    }
+    xdr_bswap_scalar(dest + i, src + i, (nbytes - i) / width, width);
+}
+
+static xdr_bswap_func xdr_bswap = xdr_bswap_scalar;
+
+constructor void
+init_xdr_bswap(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        xdr_bswap = xdr_bswap_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        xdr_bswap = xdr_bswap_ssse3;
+}
+#else
+static const xdr_bswap_func xdr_bswap = xdr_bswap_scalar;
+#endif
+
+warn_unused_result
+static size_t
+xdr_bulk_width(const tn_xdr_element_descr *elt)
+{
+    if (elt == &tn_xdr_int32_descr || elt == &tn_xdr_uint32_descr ||
+        elt == &tn_xdr_float_descr)
+        return sizeof(uint32_t);
+    if (elt == &tn_xdr_int64_descr || elt == &tn_xdr_uint64_descr ||
+        elt == &tn_xdr_double_descr)
+        return sizeof(uint64_t);
+    return 0;
+}
+
+warn_unused_result
+static tn_status
+xdr_encode_bulk(tn_xdr_stream * restrict stream, size_t width,
+                size_t len, const uint8_t * restrict data)
+{
+    while (len > 0)
+    {
+        size_t room = tn_xdr_write_room(stream) / width;
+
+        /* Elements which cross the window end go through
+         * the backend one at a time */
+        if (room == 0)
+        {
+            uint8_t tmp[sizeof(uint64_t)];
+            tn_status rc;
+
+            xdr_bswap_scalar(tmp, data, 1, width);
+            rc = tn_xdr_write_to_stream(stream, tmp, width);
+            if (rc != 0)
+                return rc;
+            room = 1;
+        }
+        else
+        {
+            if (room > len)
+                room = len;
+            xdr_bswap(stream->cur, data, room, width);
+            stream->cur += room * width;
+        }
+        data += room * width;
+        len -= room;
+    }
+    return 0;
+}
+
+warn_unused_result
+static tn_status
+xdr_decode_bulk(tn_xdr_stream * restrict stream, size_t width,
+                size_t len, uint8_t * restrict data)
+{
+    while (len > 0)
+    {
+        size_t room = (size_t)(stream->end - stream->cur) / width;
+
+        if (room == 0)
+        {
+            uint8_t tmp[sizeof(uint64_t)];
+            tn_status rc = tn_xdr_read_from_stream(stream, tmp, width);
+
+            if (rc != 0)
+                return rc;
+            xdr_bswap_scalar(data, tmp, 1, width);
+            room = 1;
+        }
+        else
+        {
+            if (room > len)
+                room = len;
+            xdr_bswap(data, stream->cur, room, width);
+            stream->cur += room * width;
+        }
+        data += room * width;
+        len -= room;
+    }
     return 0;
 }
 
+/*
+ * Decoders of structs, unions and arrays of non-builtin elements
+ * take a level of the depth budget while they run
+ */
+warn_unused_result
+static inline tn_status
+xdr_enter(tn_xdr_stream *stream)
+{
+    if (stream->depth_left == 0)
+        return ELOOP;
+    stream->depth_left--;
+    return 0;
+}
+
+warn_unused_result
+static inline tn_status
+xdr_leave(tn_xdr_stream *stream, tn_status rc)
+{
+    stream->depth_left++;
+    return rc;
+}
+
+/*
+ * Arrays of fixed-size elements whose encoding takes at least
+ * XDR_PARALLEL_MIN_SIZE bytes and fits into the stream window
+ * are cut into slices, which a pool of threads encode straight
+ * into their final places in the window. The calling thread
+ * takes slices as well, and waits for the rest to finish
+ */
+#define XDR_PARALLEL_MIN_SIZE (1024 * 1024)
+#define XDR_PARALLEL_SLICE_SIZE (256 * 1024)
+#define XDR_POOL_MAX_THREADS 64
+
+typedef struct xdr_parallel_job {
+    const tn_xdr_element_descr *elt;
+    size_t width;
+    const uint8_t *data;
+    uint8_t *out;
+    size_t len;
+    size_t slice_len;
+    size_t nslices;
+    size_t next_slice;
+    tn_status rc;
+} xdr_parallel_job;
+
+static struct {
+    /** Serializes parallel jobs */
+    pthread_mutex_t busy;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    unsigned nthreads;
+    unsigned nworkers;
+    /** Workers with lower indices take part in the current job */
+    unsigned job_workers;
+    unsigned active;
+    unsigned long generation;
+    xdr_parallel_job *job;
+} xdr_pool = {
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+    .nthreads = 1,
+    .nworkers = 0,
+    .job_workers = 0,
+    .active = 0,
+    .generation = 0,
+    .job = NULL
+};
+
+void
+tn_xdr_set_encode_threads(unsigned nthreads)
+{
+    __atomic_store_n(&xdr_pool.nthreads, nthreads, __ATOMIC_RELAXED);
+}
+
+warn_unused_result
+static unsigned
+xdr_encode_threads(void)
+{
+    unsigned nthreads = __atomic_load_n(&xdr_pool.nthreads,
+                                        __ATOMIC_RELAXED);
+
+    if (nthreads == 0)
+    {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        nthreads = ncpus > 0 ? (unsigned)ncpus : 1;
+    }
+    return nthreads < XDR_POOL_MAX_THREADS ? nthreads : XDR_POOL_MAX_THREADS;
+}
+
+static void
+xdr_parallel_run(xdr_parallel_job *job)
+{
+    size_t fixed_size = job->elt->fixed_size;
+    size_t elsize = job->elt->elsize;
+    size_t slice;
+
+    while ((slice = __atomic_fetch_add(&job->next_slice, 1,
+                                       __ATOMIC_RELAXED)) < job->nslices)
+    {
+        size_t first = slice * job->slice_len;
+        size_t n = job->len - first < job->slice_len ?
+            job->len - first : job->slice_len;
+        tn_xdr_stream sub = tn_xdr_mem_stream(job->out + first * fixed_size,
+                                              n * fixed_size);
+        const uint8_t *data = job->data + first * elsize;
+        tn_status rc = 0;
+        tn_status expected = 0;
+        size_t i;
+
+        if (job->width != 0)
+            rc = xdr_encode_bulk(&sub, job->width, n, data);
+        else
+        {
+            for (i = 0; i < n && rc == 0; i++, data += elsize)
+                rc = job->elt->encode(&sub, data);
+        }
+        /* The descriptor lies about the size */
+        if (rc == 0 && tn_xdr_stream_left(&sub) != 0)
+            rc = EINVAL;
+        if (rc != 0)
+        {
+            __atomic_compare_exchange_n(&job->rc, &expected, rc, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void *
+xdr_pool_worker(void *arg)
+{
+    unsigned index = (unsigned)(uintptr_t)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&xdr_pool.lock);
+    for (;;)
+    {
+        while (xdr_pool.generation == seen)
+            pthread_cond_wait(&xdr_pool.wake, &xdr_pool.lock);
+        seen = xdr_pool.generation;
+        if (index >= xdr_pool.job_workers)
+            continue;
+
+        pthread_mutex_unlock(&xdr_pool.lock);
+        xdr_parallel_run(xdr_pool.job);
+        pthread_mutex_lock(&xdr_pool.lock);
+        if (--xdr_pool.active == 0)
+            pthread_cond_signal(&xdr_pool.idle);
+    }
+    return NULL;
+}
+
+warn_unused_result
+static tn_status
+xdr_encode_parallel(xdr_parallel_job *job, unsigned nthreads)
+{
+    pthread_mutex_lock(&xdr_pool.busy);
+    pthread_mutex_lock(&xdr_pool.lock);
+    while (xdr_pool.nworkers < nthreads - 1)
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+        int rc;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = pthread_create(&thread, &attr, xdr_pool_worker,
+                            (void *)(uintptr_t)xdr_pool.nworkers);
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+            break;
+        xdr_pool.nworkers++;
+    }
+    xdr_pool.job_workers = xdr_pool.nworkers < nthreads - 1 ?
+        xdr_pool.nworkers : nthreads - 1;
+    xdr_pool.job = job;
+    xdr_pool.active = xdr_pool.job_workers;
+    xdr_pool.generation++;
+    pthread_cond_broadcast(&xdr_pool.wake);
+    pthread_mutex_unlock(&xdr_pool.lock);
+
+    xdr_parallel_run(job);
+
+    pthread_mutex_lock(&xdr_pool.lock);
+    while (xdr_pool.active > 0)
+        pthread_cond_wait(&xdr_pool.idle, &xdr_pool.lock);
+    pthread_mutex_unlock(&xdr_pool.lock);
+    pthread_mutex_unlock(&xdr_pool.busy);
+
+    return job->rc;
+}
+
+/*
+ * @return ENOTSUP if the array is not worth encoding in parallel
+ */
+warn_unused_result
+static tn_status
+xdr_try_encode_parallel(tn_xdr_stream * restrict stream,
+                        const tn_xdr_element_descr * restrict elt,
+                        size_t len, const void * restrict data)
+{
+    size_t total;
+    unsigned nthreads;
+    xdr_parallel_job job;
+    tn_status rc;
+
+    if (elt->fixed_size == 0 || stream->compact ||
+        __builtin_mul_overflow(len, elt->fixed_size, &total) ||
+        total < XDR_PARALLEL_MIN_SIZE ||
+        total > tn_xdr_write_room(stream))
+        return ENOTSUP;
+    nthreads = xdr_encode_threads();
+    if (nthreads < 2)
+        return ENOTSUP;
+
+    job.elt = elt;
+    job.width = xdr_bulk_width(elt);
+    job.data = data;
+    job.out = stream->cur;
+    job.len = len;
+    job.slice_len = XDR_PARALLEL_SLICE_SIZE / elt->fixed_size + 1;
+    job.nslices = (len + job.slice_len - 1) / job.slice_len;
+    job.next_slice = 0;
+    job.rc = 0;
+
+    rc = xdr_encode_parallel(&job, nthreads);
+    if (rc == 0)
+        stream->cur += total;
+    return rc;
+}
 
 tn_status
 tn_xdr_encode_array(tn_xdr_stream * restrict stream,
@@ -475,6 +1147,14 @@ tn_xdr_encode_array(tn_xdr_stream * restrict stream,
 {
     tn_status rc;
     size_t i;
+    size_t width = xdr_bulk_width(elt);
+
+    rc = xdr_try_encode_parallel(stream, elt, len, data);
+    if (rc != ENOTSUP)
+        return rc;
+
+    if (width != 0 && !stream->compact)
+        return xdr_encode_bulk(stream, width, len, data);
 
     for (i = 0; i < len; i++,
              data = (const uint8_t *restrict)data + elt->elsize)
@@ -494,15 +1174,22 @@ tn_xdr_decode_array(tn_xdr_stream * restrict stream,
 {
     tn_status rc;
     size_t i;
+    size_t width = xdr_bulk_width(elt);
+
+    if (width != 0 && !stream->compact)
+        return xdr_decode_bulk(stream, width, len, data);
 
+    rc = xdr_enter(stream);
+    if (rc != 0)
+        return rc;
     for (i = 0; i < len; i++,
              data = (uint8_t *restrict)data + elt->elsize)
     {
         rc = elt->decode(stream, data);
         if (rc != 0)
-            return rc;
+            break;
     }
-    return 0;
+    return xdr_leave(stream, rc);
 }
 
 tn_status
@@ -526,13 +1213,53 @@ tn_xdr_decode_var_array(tn_xdr_stream * restrict stream,
                         void ** restrict data)
 {
     size_t declen;
+    size_t width = xdr_bulk_width(elt);
+    size_t unit = width != 0 && !stream->compact ? width : 1;
+    size_t total;
+    size_t capacity;
+    size_t done = 0;
+    uint8_t *buf;
     tn_status rc = tn_xdr_decode_length(stream, &declen);
-    void *buf;
 
-    buf = tn_alloc(elt->elsize * declen);
-    rc = tn_xdr_decode_array(stream, elt, declen, buf);
     if (rc != 0)
         return rc;
+    /* Bulk elements take exactly one unit, so lengths which cannot
+     * fit into the rest of the stream are rejected early. Other
+     * elements may take any number of bytes, even none; like
+     * tn_xdr_decode_length(), they are counted as at least one byte
+     * here and in the budget, so that their lengths stay bounded */
+    if (declen > tn_xdr_stream_left(stream) / unit)
+        return EPROTO;
+    rc = tn_xdr_charge_alloc(stream, declen,
+                             elt->elsize == 0 ? 1 : elt->elsize, &total);
+    if (rc != 0)
+        return rc;
+
+    /* Unless the data are already in the window, large arrays
+     * grow as their elements actually arrive */
+    capacity = declen;
+    if (elt->elsize != 0 && total > XDR_DECODE_CHUNK_SIZE &&
+        declen > (size_t)(stream->end - stream->cur) / unit)
+    {
+        capacity = (size_t)(stream->end - stream->cur) / unit;
+        if (capacity <= XDR_DECODE_CHUNK_SIZE / elt->elsize)
+            capacity = XDR_DECODE_CHUNK_SIZE / elt->elsize + 1;
+    }
+    buf = tn_alloc(capacity * elt->elsize);
+
+    while (done < declen)
+    {
+        if (done == capacity)
+        {
+            capacity = capacity > declen - capacity ? declen : 2 * capacity;
+            buf = tn_realloc(buf, capacity * elt->elsize);
+        }
+        rc = tn_xdr_decode_array(stream, elt, capacity - done,
+                                 buf + done * elt->elsize);
+        if (rc != 0)
+            return rc;
+        done = capacity;
+    }
 
     *len = declen;
     *data = buf;
@@ -566,18 +1293,20 @@ tn_xdr_decode_struct(tn_xdr_stream * restrict stream,
                      const tn_xdr_element_descr elt[restrict var_size(nelts)],
                      void * restrict data)
 {
-    tn_status rc;
+    tn_status rc = xdr_enter(stream);
     size_t i;
 
+    if (rc != 0)
+        return rc;
     for (i = 0; i < nelts; i++)
     {
         rc = elt[i].decode(stream, data);
         if (rc != 0)
-            return rc;
+            break;
 
         data = (uint8_t * restrict)data + elt[i].elsize;
     }
-    return 0;
+    return xdr_leave(stream, rc);
 }
 
 tn_status
@@ -615,31 +1344,3318 @@ tn_xdr_decode_union(tn_xdr_stream * restrict stream,
         return EPROTO;
 
     *discr = discr32;
-    return elt[discr32].decode(stream, data);
-}
+    rc = xdr_enter(stream);
+    if (rc != 0)
+        return rc;
+    return xdr_leave(stream, elt[discr32].decode(stream, data));
+}
+
+/*
+ * Resumable decoding walks the schema with an explicit stack.
+ * Elements are decoded straight from the input when it holds
+ * them completely; otherwise the input is accumulated in the
+ * pending buffer, and the element is retried from there
+ */
+warn_unused_result
+static tn_status
+xdr_resume_decode_length(tn_xdr_stream * restrict stream,
+                         void * restrict data)
+{
+    return tn_xdr_decode_length(stream, data);
+}
+
+static void
+xdr_resume_push(tn_xdr_resumable *state, const tn_xdr_schema *schema,
+                uint8_t *data)
+{
+    tn_xdr_resume_frame *frame;
+
+    if (state->depth == state->capacity)
+    {
+        state->capacity = state->capacity * 2 + 4;
+        state->stack = tn_realloc(state->stack,
+                                  state->capacity * sizeof(*state->stack));
+    }
+    frame = &state->stack[state->depth++];
+    frame->schema = schema;
+    frame->data = data;
+    frame->index = 0;
+    frame->count = schema->count;
+    frame->allocated = 0;
+}
+
+static void
+xdr_resume_stash(tn_xdr_resumable *state, const uint8_t *buf, size_t len)
+{
+    if (len == 0)
+        return;
+    if (state->pending_len + len > state->pending_capacity)
+    {
+        uint8_t *newbuf;
+
+        state->pending_capacity = 2 * (state->pending_len + len);
+        newbuf = tn_alloc_blob(state->pending_capacity);
+        if (state->pending_len > 0)
+            memcpy(newbuf, state->pending, state->pending_len);
+        state->pending = newbuf;
+    }
+    memcpy(state->pending + state->pending_len, buf, len);
+    state->pending_len += len;
+}
+
+warn_unused_result
+static tn_status
+xdr_resume_element(tn_xdr_resumable * restrict state,
+                   tn_xdr_decoder decode, void * restrict data,
+                   const uint8_t ** restrict buf, size_t * restrict len)
+{
+    size_t prev_len = state->pending_len;
+    tn_xdr_stream stream;
+    size_t used;
+    tn_status rc;
+
+    if (prev_len == 0)
+        stream = tn_xdr_mem_stream((uint8_t *)(uintptr_t)*buf, *len);
+    else
+    {
+        xdr_resume_stash(state, *buf, *len);
+        stream = tn_xdr_mem_stream(state->pending, state->pending_len);
+    }
+
+    /* The rest of the value is yet to come, so the checks
+     * of lengths against the data left must pass. Decoders
+     * allocate for data beyond the window only as they arrive
+     * (see XDR_DECODE_CHUNK_SIZE), so retries of an element with
+     * a huge length take no more memory than the bytes received */
+    stream.limit = SIZE_MAX;
+    stream.alloc_left = state->alloc_left;
+    rc = decode(&stream, data);
+    if (rc == ENOMSG)
+    {
+        if (prev_len == 0)
+            xdr_resume_stash(state, *buf, *len);
+        *buf += *len;
+        *len = 0;
+        return EAGAIN;
+    }
+    if (rc != 0)
+        return rc;
+
+    /* Only the final attempt is charged */
+    state->alloc_left = stream.alloc_left;
+    used = tn_xdr_stream_pos(&stream) - prev_len;
+    state->pending_len = 0;
+    *buf += used;
+    *len -= used;
+    return 0;
+}
+
+void
+tn_xdr_resumable_init(tn_xdr_resumable * restrict state,
+                      const tn_xdr_schema * restrict schema,
+                      void * restrict data)
+{
+    state->depth = 0;
+    state->capacity = 0;
+    state->stack = NULL;
+    state->pending = NULL;
+    state->pending_len = 0;
+    state->pending_capacity = 0;
+    state->alloc_left = SIZE_MAX;
+    xdr_resume_push(state, schema, data);
+}
+
+tn_status
+tn_xdr_decode_resumable(tn_xdr_resumable * restrict state,
+                        const void * restrict buf, size_t len,
+                        size_t * restrict used)
+{
+    const uint8_t *in = buf;
+    tn_status rc = 0;
+
+    while (state->depth > 0)
+    {
+        tn_xdr_resume_frame *frame = &state->stack[state->depth - 1];
+        const tn_xdr_schema *schema = frame->schema;
+
+        switch (schema->kind)
+        {
+            case TN_XDR_SCHEMA_ELEMENT:
+                rc = xdr_resume_element(state, schema->elt->decode,
+                                        frame->data, &in, &len);
+                if (rc == 0)
+                    state->depth--;
+                break;
+            case TN_XDR_SCHEMA_STRUCT:
+                if (frame->index == frame->count)
+                    state->depth--;
+                else
+                {
+                    const tn_xdr_schema_field *field =
+                        &schema->fields[frame->index++];
+
+                    xdr_resume_push(state, field->schema,
+                                    frame->data + field->offset);
+                }
+                break;
+            case TN_XDR_SCHEMA_VAR_ARRAY:
+                if (frame->index == 0 && frame->count == 0)
+                {
+                    tn_xdr_vector *vec = (tn_xdr_vector *)frame->data;
+                    size_t count;
+                    size_t total;
+
+                    rc = xdr_resume_element(state, xdr_resume_decode_length,
+                                            &count, &in, &len);
+                    if (rc != 0)
+                        break;
+                    if (__builtin_mul_overflow(count, schema->item->size,
+                                               &total) ||
+                        total > state->alloc_left)
+                    {
+                        rc = EMSGSIZE;
+                        break;
+                    }
+                    state->alloc_left -= total;
+                    vec->len = count;
+                    /* Large arrays grow as their items arrive,
+                     * as in tn_xdr_decode_var_array() */
+                    frame->allocated = count;
+                    if (total > XDR_DECODE_CHUNK_SIZE)
+                    {
+                        frame->allocated = XDR_DECODE_CHUNK_SIZE /
+                            schema->item->size + 1;
+                    }
+                    vec->data = tn_alloc(frame->allocated *
+                                         schema->item->size);
+                    if (count == 0)
+                    {
+                        state->depth--;
+                        break;
+                    }
+                    frame->count = count;
+                }
+                /* fallthrough */
+            case TN_XDR_SCHEMA_ARRAY:
+            {
+                uint8_t *items = frame->data;
+
+                if (frame->index == frame->count)
+                {
+                    state->depth--;
+                    break;
+                }
+                if (schema->kind == TN_XDR_SCHEMA_VAR_ARRAY)
+                {
+                    tn_xdr_vector *vec = (tn_xdr_vector *)frame->data;
+
+                    if (frame->index == frame->allocated)
+                    {
+                        frame->allocated =
+                            frame->allocated >
+                            frame->count - frame->allocated ?
+                            frame->count : 2 * frame->allocated;
+                        vec->data = tn_realloc(vec->data,
+                                               frame->allocated *
+                                               schema->item->size);
+                    }
+                    items = vec->data;
+                }
+                xdr_resume_push(state, schema->item,
+                                items + frame->index++ *
+                                schema->item->size);
+                break;
+            }
+        }
+        if (rc != 0)
+            break;
+    }
+
+    *used = (size_t)(in - (const uint8_t *)buf);
+    return rc;
+}
+
+/*
+ * Values whose descriptors have no measurer are sized by encoding
+ * them into a stream which has an empty window and only counts bytes.
+ * The window is not NULL, so that zero-length writes stay defined
+ */
+static uint8_t xdr_count_window[1];
+
+static tn_status
+xdr_count_writer(tn_xdr_stream * restrict stream,
+                 unused const void * restrict src, size_t sz)
+{
+    stream->base += sz;
+    return 0;
+}
+
+warn_unused_result
+static tn_status
+xdr_count(const tn_xdr_element_descr * restrict elt,
+          const void * restrict data, bool compact, size_t * restrict size)
+{
+    tn_xdr_stream counter = {
+        .reader = tn_xdr_dummy_reader,
+        .writer = xdr_count_writer,
+        .flush = NULL,
+        .viewer = NULL,
+        .referrer = NULL,
+        .compact = compact,
+        .alloc_left = SIZE_MAX,
+        .depth_left = TN_XDR_MAX_DEPTH,
+        .data = NULL,
+        .start = xdr_count_window,
+        .cur = xdr_count_window,
+        .end = xdr_count_window,
+        .write_end = xdr_count_window,
+        .base = 0,
+        .limit = SIZE_MAX - *size
+    };
+    tn_status rc = elt->encode(&counter, data);
+
+    if (rc == 0)
+        *size += counter.base;
+    return rc;
+}
+
+warn_unused_result
+static tn_status
+xdr_measure(const tn_xdr_element_descr * restrict elt,
+            const void * restrict data, size_t * restrict size)
+{
+    if (elt->measure != NULL)
+        return elt->measure(data, size);
+
+    return xdr_count(elt, data, false, size);
+}
+
+tn_status
+tn_xdr_sizeof(const tn_xdr_element_descr * restrict elt,
+              const void * restrict data,
+              size_t * restrict size)
+{
+    *size = 0;
+    return xdr_measure(elt, data, size);
+}
+
+tn_status
+tn_xdr_sizeof_compact(const tn_xdr_element_descr * restrict elt,
+                      const void * restrict data,
+                      size_t * restrict size)
+{
+    *size = 0;
+    return xdr_count(elt, data, true, size);
+}
+
+warn_unused_result
+static tn_status
+xdr_measure_array(const tn_xdr_element_descr * restrict elt,
+                  size_t len,
+                  const void * restrict data,
+                  size_t * restrict size)
+{
+    tn_status rc;
+    size_t i;
+    size_t width = xdr_bulk_width(elt);
+
+    if (width != 0)
+    {
+        if (len > (SIZE_MAX - *size) / width)
+            return EOVERFLOW;
+        *size += len * width;
+        return 0;
+    }
+
+    for (i = 0; i < len; i++,
+             data = (const uint8_t *restrict)data + elt->elsize)
+    {
+        rc = xdr_measure(elt, data, size);
+        if (rc != 0)
+            return rc;
+    }
+    return 0;
+}
+
+tn_status
+tn_xdr_sizeof_array(const tn_xdr_element_descr * restrict elt,
+                    size_t len,
+                    const void * restrict data,
+                    size_t * restrict size)
+{
+    *size = 0;
+    return xdr_measure_array(elt, len, data, size);
+}
+
+tn_status
+tn_xdr_sizeof_var_array(const tn_xdr_element_descr * restrict elt,
+                        size_t len,
+                        const void * restrict data,
+                        size_t * restrict size)
+{
+#if SIZE_MAX > UINT32_MAX
+    if (len > UINT32_MAX)
+        return EOVERFLOW;
+#endif
+    *size = sizeof(uint32_t);
+    return xdr_measure_array(elt, len, data, size);
+}
+
+tn_status
+tn_xdr_sizeof_struct(size_t nelts,
+                     const tn_xdr_element_descr elt[restrict var_size(nelts)],
+                     const void * restrict data,
+                     size_t * restrict size)
+{
+    tn_status rc;
+    size_t i;
+
+    *size = 0;
+    for (i = 0; i < nelts; i++)
+    {
+        rc = xdr_measure(&elt[i], data, size);
+        if (rc != 0)
+            return rc;
+
+        data = (const uint8_t * restrict)data + elt[i].elsize;
+    }
+    return 0;
+}
+
+tn_status
+tn_xdr_sizeof_union(size_t nelts,
+                    const tn_xdr_element_descr elt[restrict var_size(nelts)],
+                    unsigned discr,
+                    const void * restrict data,
+                    size_t * restrict size)
+{
+    assert(discr < nelts);
+    *size = sizeof(uint32_t);
+    return xdr_measure(&elt[discr], data, size);
+}
+
+/*
+ * File descriptor streams keep their state in a GC-allocated
+ * record pointed to by the `data` field. The stream window is
+ * the buffer: when reading, it holds data which has been read but
+ * not yet consumed; when writing, `start` to `cur` holds data
+ * not yet written and `cur` to `end` is free space
+ */
+typedef struct xdr_fd_state {
+    int fd;
+    bool writing;
+    size_t bufsize;
+    uint8_t *buffer;
+} xdr_fd_state;
+
+warn_unused_result
+static tn_status
+xdr_fd_write_all(int fd, struct iovec *iov, size_t iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t rc = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX :
+                            (int)iovcnt);
+        size_t done;
+
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (rc == 0)
+            return EIO;
+
+        for (done = (size_t)rc; iovcnt > 0 && done >= iov->iov_len;
+             iov++, iovcnt--)
+            done -= iov->iov_len;
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+warn_unused_result
+static tn_status
+xdr_fd_read_some(int fd, void *dest, size_t sz, size_t *got)
+{
+    for (;;)
+    {
+        ssize_t rc = read(fd, dest, sz);
+
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (rc == 0)
+            return ENOMSG;
+        *got = (size_t)rc;
+        return 0;
+    }
+}
+
+/* Makes an empty window at the start of the buffer,
+ * at most @a size bytes long, but not past the stream limit */
+static void
+xdr_fd_reset_window(tn_xdr_stream *stream, size_t size)
+{
+    xdr_fd_state *state = stream->data;
+    size_t left = stream->limit - stream->base;
+
+    stream->start = stream->cur = state->buffer;
+    stream->end = state->buffer + (size < left ? size : left);
+    stream->write_end = state->writing ? stream->end : stream->start;
+}
+
+static tn_status
+xdr_fd_reader(tn_xdr_stream * restrict stream, void * restrict dest,
+              size_t sz)
+{
+    xdr_fd_state *state = stream->data;
+    uint8_t *out = dest;
+    size_t avail = (size_t)(stream->end - stream->cur);
+
+    assert(!state->writing);
+    memcpy(out, stream->cur, avail);
+    out += avail;
+    sz -= avail;
+    stream->base += (size_t)(stream->end - stream->start);
+    xdr_fd_reset_window(stream, 0);
+
+    while (sz > 0)
+    {
+        size_t got = 0;
+        tn_status rc;
+
+        /* Large reads go directly to the destination */
+        if (sz >= state->bufsize)
+        {
+            rc = xdr_fd_read_some(state->fd, out, sz, &got);
+            if (rc != 0)
+                return rc;
+            out += got;
+            sz -= got;
+            stream->base += got;
+        }
+        else
+        {
+            rc = xdr_fd_read_some(state->fd, state->buffer, state->bufsize,
+                                  &got);
+            if (rc != 0)
+                return rc;
+            if (got < sz)
+            {
+                memcpy(out, state->buffer, got);
+                out += got;
+                sz -= got;
+                stream->base += got;
+            }
+            else
+            {
+                memcpy(out, state->buffer, sz);
+                xdr_fd_reset_window(stream, got);
+                stream->cur += sz;
+                sz = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+static tn_status
+xdr_fd_flush(tn_xdr_stream *stream)
+{
+    xdr_fd_state *state = stream->data;
+    size_t pending = (size_t)(stream->cur - stream->start);
+    struct iovec iov = {.iov_base = stream->start, .iov_len = pending};
+    tn_status rc;
+
+    if (!state->writing || pending == 0)
+        return 0;
+
+    rc = xdr_fd_write_all(state->fd, &iov, 1);
+    if (rc != 0)
+        return rc;
+    stream->base += pending;
+    xdr_fd_reset_window(stream, state->bufsize);
+    return 0;
+}
+
+static tn_status
+xdr_fd_writer(tn_xdr_stream * restrict stream, const void * restrict src,
+              size_t sz)
+{
+    xdr_fd_state *state = stream->data;
+    size_t space;
+
+    if (!state->writing)
+    {
+        assert(stream->cur == stream->end);
+        state->writing = true;
+        stream->base += (size_t)(stream->end - stream->start);
+        xdr_fd_reset_window(stream, state->bufsize);
+    }
+
+    space = (size_t)(stream->end - stream->cur);
+    if (space >= sz)
+    {
+        memcpy(stream->cur, src, sz);
+        stream->cur += sz;
+        return 0;
+    }
+
+    /* Large writes are combined with the buffered data
+     * into a single system call */
+    if (sz >= state->bufsize)
+    {
+        size_t pending = (size_t)(stream->cur - stream->start);
+        struct iovec iov[2] = {
+            {.iov_base = stream->start, .iov_len = pending},
+            {.iov_base = (void *)src, .iov_len = sz}
+        };
+        tn_status rc = xdr_fd_write_all(state->fd, iov, 2);
+
+        if (rc != 0)
+            return rc;
+        stream->base += pending + sz;
+        xdr_fd_reset_window(stream, state->bufsize);
+        return 0;
+    }
+    else
+    {
+        tn_status rc;
+
+        memcpy(stream->cur, src, space);
+        stream->cur = stream->end;
+        rc = xdr_fd_flush(stream);
+        if (rc != 0)
+            return rc;
+        memcpy(stream->cur, (const uint8_t *)src + space, sz - space);
+        stream->cur += sz - space;
+        return 0;
+    }
+}
+
+tn_xdr_stream
+tn_xdr_fd_stream(int fd, size_t bufsize)
+{
+    xdr_fd_state *state = TN_NEW(xdr_fd_state);
+    tn_xdr_stream stream = {
+        .reader = xdr_fd_reader,
+        .writer = xdr_fd_writer,
+        .flush = xdr_fd_flush,
+        .viewer = NULL,
+        .referrer = NULL,
+        .compact = false,
+        .alloc_left = SIZE_MAX,
+        .depth_left = TN_XDR_MAX_DEPTH,
+        .data = state,
+        .base = 0,
+        .limit = SIZE_MAX
+    };
+
+    if (bufsize == 0)
+        bufsize = TN_XDR_FD_BUFSIZE;
+
+    state->fd = fd;
+    state->writing = false;
+    state->bufsize = bufsize;
+    state->buffer = tn_alloc_blob(bufsize);
+    xdr_fd_reset_window(&stream, 0);
+
+    return stream;
+}
+
+/*
+ * I/O vector streams keep the list of vectors in a GC-allocated
+ * record pointed to by the `data` field. The stream window is
+ * the unused part of the current chunk, and `start` is where
+ * data not yet covered by a vector begin
+ */
+typedef struct xdr_iov_state {
+    size_t threshold;
+    size_t count;
+    size_t capacity;
+    struct iovec *iov;
+} xdr_iov_state;
+
+#define XDR_IOV_CHUNK_SIZE 4096
+
+static void
+xdr_iov_append(xdr_iov_state *state, const void *base, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (state->count > 0)
+    {
+        struct iovec *last = &state->iov[state->count - 1];
+
+        if ((const uint8_t *)last->iov_base + last->iov_len == base)
+        {
+            last->iov_len += len;
+            return;
+        }
+    }
+
+    if (state->count == state->capacity)
+    {
+        state->capacity = state->capacity == 0 ? 16 : state->capacity * 2;
+        state->iov = tn_realloc(state->iov,
+                                state->capacity * sizeof(*state->iov));
+    }
+    state->iov[state->count].iov_base = (void *)base;
+    state->iov[state->count].iov_len = len;
+    state->count++;
+}
+
+/* Covers the pending data in the window by a vector */
+static void
+xdr_iov_close_window(tn_xdr_stream *stream)
+{
+    size_t pending = (size_t)(stream->cur - stream->start);
+
+    xdr_iov_append(stream->data, stream->start, pending);
+    stream->base += pending;
+    stream->start = stream->cur;
+}
+
+static tn_status
+xdr_iov_writer(tn_xdr_stream * restrict stream, const void * restrict src,
+               size_t sz)
+{
+    size_t chunk = sz > XDR_IOV_CHUNK_SIZE ? sz : XDR_IOV_CHUNK_SIZE;
+
+    xdr_iov_close_window(stream);
+    stream->start = stream->cur = tn_alloc_blob(chunk);
+    stream->end = stream->write_end = stream->start + chunk;
+
+    memcpy(stream->cur, src, sz);
+    stream->cur += sz;
+    return 0;
+}
+
+static tn_status
+xdr_iov_referrer(tn_xdr_stream * restrict stream, const void * restrict src,
+                 size_t sz)
+{
+    xdr_iov_state *state = stream->data;
+
+    if (sz < state->threshold)
+        return tn_xdr_write_to_stream(stream, src, sz);
+
+    xdr_iov_close_window(stream);
+    xdr_iov_append(state, src, sz);
+    stream->base += sz;
+    return 0;
+}
+
+tn_xdr_stream
+tn_xdr_iov_stream(size_t threshold)
+{
+    xdr_iov_state *state = TN_NEW(xdr_iov_state);
+
+    state->threshold = threshold == 0 ? TN_XDR_IOV_THRESHOLD : threshold;
+    state->count = state->capacity = 0;
+    state->iov = NULL;
+
+    return (tn_xdr_stream){
+        .reader = tn_xdr_dummy_reader,
+        .writer = xdr_iov_writer,
+        .flush = NULL,
+        .viewer = NULL,
+        .referrer = xdr_iov_referrer,
+        .compact = false,
+        .alloc_left = SIZE_MAX,
+        .depth_left = TN_XDR_MAX_DEPTH,
+        .data = state,
+        .start = NULL,
+        .cur = NULL,
+        .end = NULL,
+        .write_end = NULL,
+        .base = 0,
+        .limit = SIZE_MAX
+    };
+}
+
+void
+tn_xdr_iov_get(tn_xdr_stream * restrict stream,
+               const struct iovec ** restrict iov,
+               size_t * restrict count)
+{
+    xdr_iov_state *state = stream->data;
+
+    xdr_iov_close_window(stream);
+    *iov = state->iov;
+    *count = state->count;
+}
+
+tn_status
+tn_xdr_iov_writev(tn_xdr_stream *stream, int fd)
+{
+    xdr_iov_state *state = stream->data;
+    tn_status rc;
+
+    xdr_iov_close_window(stream);
+    rc = xdr_fd_write_all(fd, state->iov, state->count);
+    state->count = 0;
+    return rc;
+}
+
+/*
+ * CRC32C (Castagnoli) is computed with the SSE4.2 crc32 instruction
+ * where available, and with slicing-by-8 tables otherwise
+ */
+#define XDR_CRC32C_POLY 0x82f63b78u
+
+typedef uint32_t (*xdr_crc32c_func)(uint32_t crc, const uint8_t *data,
+                                    size_t len);
+
+static uint32_t xdr_crc32c_table[8][256];
+
+static uint32_t
+xdr_crc32c_slice8(uint32_t crc, const uint8_t *data, size_t len)
+{
+    const uint32_t (*table)[256] = xdr_crc32c_table;
+
+    while (len >= 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)data[0] |
+                             ((uint32_t)data[1] << 8) |
+                             ((uint32_t)data[2] << 16) |
+                             ((uint32_t)data[3] << 24));
+
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+            table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+            table[3][data[4]] ^ table[2][data[5]] ^
+            table[1][data[6]] ^ table[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if PLATFORM_ARCH_IS_amd64 && defined(target_isa)
+target_isa("sse4.2")
+static uint32_t
+xdr_crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    while (len >= sizeof(uint64_t))
+    {
+        uint64_t word;
+
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += sizeof(word);
+        len -= sizeof(word);
+    }
+    crc = (uint32_t)crc64;
+    while (len-- > 0)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+static xdr_crc32c_func xdr_crc32c = xdr_crc32c_slice8;
+
+constructor void
+init_xdr_crc32c(void)
+{
+    unsigned i;
+    unsigned k;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (crc & 1 ? XDR_CRC32C_POLY : 0);
+        xdr_crc32c_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++)
+    {
+        for (k = 1; k < 8; k++)
+        {
+            uint32_t prev = xdr_crc32c_table[k - 1][i];
+
+            xdr_crc32c_table[k][i] =
+                (prev >> 8) ^ xdr_crc32c_table[0][prev & 0xff];
+        }
+    }
+#if PLATFORM_ARCH_IS_amd64 && defined(target_isa)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        xdr_crc32c = xdr_crc32c_sse42;
+#endif
+}
+
+uint32_t
+tn_xdr_crc32c(uint32_t crc, const void *data, size_t len)
+{
+    return ~xdr_crc32c(~crc, data, len);
+}
+
+/*
+ * Block adapters are streams over another stream, which buffer
+ * a block of data in their window and transform it as a whole
+ * when it is full or flushed (write_block), or pull in and
+ * untransform the next block when the window is exhausted
+ * (read_block). As with fd streams, a block adapter is used
+ * either for reading or for writing
+ */
+typedef struct xdr_block_state {
+    tn_xdr_stream *inner;
+    size_t block_size;
+    bool writing;
+    uint8_t *block;
+    tn_status (*write_block)(tn_xdr_stream *stream);
+    tn_status (*read_block)(tn_xdr_stream *stream);
+} xdr_block_state;
+
+static tn_status
+xdr_block_reader(tn_xdr_stream * restrict stream, void * restrict dest,
+                 size_t sz)
+{
+    xdr_block_state *state = stream->data;
+    uint8_t *out = dest;
+
+    assert(!state->writing);
+    while (sz > 0)
+    {
+        size_t avail = (size_t)(stream->end - stream->cur);
+        size_t n = avail < sz ? avail : sz;
+        tn_status rc;
+
+        memcpy(out, stream->cur, n);
+        stream->cur += n;
+        out += n;
+        sz -= n;
+        if (sz == 0)
+            break;
+
+        stream->base += (size_t)(stream->end - stream->start);
+        stream->start = stream->cur = stream->end = state->block;
+        stream->write_end = state->block;
+        rc = state->read_block(stream);
+        if (rc != 0)
+            return rc;
+    }
+    return 0;
+}
+
+static tn_status
+xdr_block_writer(tn_xdr_stream * restrict stream, const void * restrict src,
+                 size_t sz)
+{
+    xdr_block_state *state = stream->data;
+    const uint8_t *in = src;
+
+    if (!state->writing)
+    {
+        assert(stream->cur == stream->end);
+        state->writing = true;
+        stream->base += (size_t)(stream->end - stream->start);
+        stream->start = stream->cur = state->block;
+        stream->end = stream->write_end = state->block + state->block_size;
+    }
+
+    while (sz > 0)
+    {
+        size_t space = (size_t)(stream->end - stream->cur);
+        size_t n = space < sz ? space : sz;
+
+        memcpy(stream->cur, in, n);
+        stream->cur += n;
+        in += n;
+        sz -= n;
+        if (sz > 0)
+        {
+            tn_status rc = state->write_block(stream);
+
+            if (rc != 0)
+                return rc;
+        }
+    }
+    return 0;
+}
+
+static tn_status
+xdr_block_flush(tn_xdr_stream *stream)
+{
+    xdr_block_state *state = stream->data;
+    tn_status rc;
+
+    if (!state->writing)
+        return 0;
+
+    if (stream->cur != stream->start)
+    {
+        rc = state->write_block(stream);
+        if (rc != 0)
+            return rc;
+    }
+    return tn_xdr_flush(state->inner);
+}
+
+static void
+xdr_init_block_state(xdr_block_state *state, tn_xdr_stream *inner,
+                     size_t block_size,
+                     tn_status (*write_block)(tn_xdr_stream *stream),
+                     tn_status (*read_block)(tn_xdr_stream *stream))
+{
+    state->inner = inner;
+    state->block_size = block_size;
+    state->writing = false;
+    state->block = tn_alloc_blob(block_size);
+    state->write_block = write_block;
+    state->read_block = read_block;
+}
+
+warn_unused_result
+static tn_xdr_stream
+xdr_block_stream(xdr_block_state *state)
+{
+    return (tn_xdr_stream){
+        .reader = xdr_block_reader,
+        .writer = xdr_block_writer,
+        .flush = xdr_block_flush,
+        .viewer = NULL,
+        .referrer = NULL,
+        .compact = false,
+        .alloc_left = SIZE_MAX,
+        .depth_left = TN_XDR_MAX_DEPTH,
+        .data = state,
+        .start = state->block,
+        .cur = state->block,
+        .end = state->block,
+        .write_end = state->block,
+        .base = 0,
+        .limit = SIZE_MAX
+    };
+}
+
+warn_unused_result
+static tn_status
+xdr_write_frame_word(tn_xdr_stream *inner, uint32_t word)
+{
+    uint32_t netword = htonl(word);
+
+    return tn_xdr_write_to_stream(inner, &netword, sizeof(netword));
+}
+
+warn_unused_result
+static tn_status
+xdr_read_frame_word(tn_xdr_stream *inner, uint32_t *word)
+{
+    uint32_t netword;
+    tn_status rc = tn_xdr_read_from_stream(inner, &netword, sizeof(netword));
+
+    if (rc == 0)
+        *word = ntohl(netword);
+    return rc;
+}
+
+/*
+ * Checksummed streams write each block as a frame of a 32-bit
+ * big-endian size, the data and a big-endian CRC32C.
+ * The CRC runs over all the data up to the end of the frame,
+ * so that lost or reordered frames are detected as well
+ */
+typedef struct xdr_crc_state {
+    xdr_block_state common;
+    uint32_t crc;
+} xdr_crc_state;
+
+warn_unused_result
+static tn_status
+xdr_crc_write_block(tn_xdr_stream *stream)
+{
+    xdr_crc_state *state = stream->data;
+    tn_xdr_stream *inner = state->common.inner;
+    size_t len = (size_t)(stream->cur - stream->start);
+    uint32_t crc = tn_xdr_crc32c(state->crc, stream->start, len);
+    tn_status rc;
+
+    rc = xdr_write_frame_word(inner, (uint32_t)len);
+    if (rc == 0)
+        rc = tn_xdr_write_to_stream(inner, stream->start, len);
+    if (rc == 0)
+        rc = xdr_write_frame_word(inner, crc);
+    if (rc != 0)
+        return rc;
+
+    state->crc = crc;
+    stream->base += len;
+    stream->cur = stream->start;
+    return 0;
+}
+
+warn_unused_result
+static tn_status
+xdr_crc_read_block(tn_xdr_stream *stream)
+{
+    xdr_crc_state *state = stream->data;
+    tn_xdr_stream *inner = state->common.inner;
+    uint8_t *data = state->common.block;
+    uint32_t len;
+    uint32_t crc;
+    tn_status rc;
+
+    rc = xdr_read_frame_word(inner, &len);
+    if (rc != 0)
+        return rc;
+    if (len == 0 || len > state->common.block_size)
+        return EPROTO;
+
+    if (inner->viewer != NULL && tn_xdr_stream_left(inner) >= len)
+    {
+        tn_xdr_view view;
+
+        /* The window is only read from, so it may be the view */
+        rc = inner->viewer(inner, len, &view);
+        data = (uint8_t *)view.data;
+    }
+    else
+        rc = tn_xdr_read_from_stream(inner, data, len);
+    if (rc == 0)
+        rc = xdr_read_frame_word(inner, &crc);
+    if (rc != 0)
+        return rc;
+
+    state->crc = tn_xdr_crc32c(state->crc, data, len);
+    if (crc != state->crc)
+        return EBADMSG;
+
+    stream->start = stream->cur = stream->write_end = data;
+    stream->end = data + len;
+    return 0;
+}
+
+tn_xdr_stream
+tn_xdr_checksum_stream(tn_xdr_stream *inner, size_t block_size)
+{
+    xdr_crc_state *state = TN_NEW(xdr_crc_state);
+
+    if (block_size == 0)
+        block_size = TN_XDR_CHECKSUM_BLOCK_SIZE;
+    assert(block_size <= UINT32_MAX);
+
+    xdr_init_block_state(&state->common, inner, block_size,
+                         xdr_crc_write_block, xdr_crc_read_block);
+    state->crc = 0;
+    return xdr_block_stream(&state->common);
+}
+
+/*
+ * Compressed streams cut the data into blocks, each of which
+ * is compressed with an LZ4-style compressor and written to
+ * the underlying stream as a frame:
+ *
+ * - a 32-bit big-endian word with the payload size in the lower
+ *   30 bits, XDR_LZ_STORED if the payload is not compressed and
+ *   XDR_LZ_CHECKSUM if a checksum follows the payload;
+ * - a 32-bit big-endian uncompressed size;
+ * - the payload;
+ * - optionally, a big-endian CRC32C of the uncompressed data.
+ *
+ * The payload uses the LZ4 block format: sequences of a token with
+ * literal and match lengths, literals, a 16-bit little-endian match
+ * offset and extra length bytes; the last sequence has no match
+ */
+#define XDR_LZ_STORED 0x80000000u
+#define XDR_LZ_CHECKSUM 0x40000000u
+#define XDR_LZ_SIZE_MASK 0x3fffffffu
+
+#define XDR_LZ_HASH_BITS 12
+#define XDR_LZ_MIN_MATCH 4
+#define XDR_LZ_LAST_LITERALS 5
+#define XDR_LZ_MATCH_LIMIT 12
+#define XDR_LZ_MAX_OFFSET 65535
+
+typedef struct xdr_lz_state {
+    xdr_block_state common;
+    bool checksums;
+    uint8_t *scratch;
+    uint32_t *table;
+} xdr_lz_state;
+
+warn_unused_result
+hint_no_shared_state
+static size_t
+xdr_lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+warn_unused_result
+static inline uint32_t
+xdr_lz_read32(const uint8_t *src)
+{
+    uint32_t val;
+
+    memcpy(&val, src, sizeof(val));
+    return val;
+}
+
+warn_unused_result
+hint_no_shared_state
+static inline unsigned
+xdr_lz_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - XDR_LZ_HASH_BITS);
+}
+
+static uint8_t *
+xdr_lz_put_length(uint8_t *dest, size_t len)
+{
+    while (len >= 255)
+    {
+        *dest++ = 255;
+        len -= 255;
+    }
+    *dest++ = (uint8_t)len;
+    return dest;
+}
+
+/* A match length of 0 makes the last sequence */
+static uint8_t *
+xdr_lz_put_sequence(uint8_t *dest, const uint8_t *literals, size_t nlit,
+                    size_t offset, size_t match)
+{
+    uint8_t *token = dest++;
+    size_t mcode = match == 0 ? 0 : match - XDR_LZ_MIN_MATCH;
+
+    *token = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) |
+                       (mcode < 15 ? mcode : 15));
+    if (nlit >= 15)
+        dest = xdr_lz_put_length(dest, nlit - 15);
+    memcpy(dest, literals, nlit);
+    dest += nlit;
+    if (match == 0)
+        return dest;
+
+    *dest++ = (uint8_t)(offset & 0xff);
+    *dest++ = (uint8_t)(offset >> 8);
+    if (mcode >= 15)
+        dest = xdr_lz_put_length(dest, mcode - 15);
+    return dest;
+}
+
+/*
+ * Compresses @a len bytes into @a dest, which must hold
+ * xdr_lz_bound(len) bytes. @a table holds 1 << XDR_LZ_HASH_BITS
+ * entries, which are positions + 1 of recently seen 4-byte sequences
+ */
+warn_unused_result
+static size_t
+xdr_lz_compress(const uint8_t *src, size_t len, uint8_t *dest,
+                uint32_t *table)
+{
+    uint8_t *out = dest;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    memset(table, 0, sizeof(*table) << XDR_LZ_HASH_BITS);
+    if (len >= XDR_LZ_MATCH_LIMIT)
+    {
+        size_t last = len - XDR_LZ_MATCH_LIMIT;
+        size_t match_end = len - XDR_LZ_LAST_LITERALS;
+
+        while (i <= last)
+        {
+            uint32_t seq = xdr_lz_read32(src + i);
+            unsigned hash = xdr_lz_hash(seq);
+            size_t ref = table[hash];
+
+            table[hash] = (uint32_t)(i + 1);
+            if (ref != 0 && i - (ref - 1) <= XDR_LZ_MAX_OFFSET &&
+                xdr_lz_read32(src + ref - 1) == seq)
+            {
+                size_t match = XDR_LZ_MIN_MATCH;
+
+                ref--;
+                while (i + match < match_end &&
+                       src[ref + match] == src[i + match])
+                    match++;
+                while (i > anchor && ref > 0 && src[i - 1] == src[ref - 1])
+                {
+                    i--;
+                    ref--;
+                    match++;
+                }
+                out = xdr_lz_put_sequence(out, src + anchor, i - anchor,
+                                          i - ref, match);
+                i += match;
+                anchor = i;
+            }
+            else
+            {
+                /* Skip faster through incompressible data */
+                i += 1 + ((i - anchor) >> 6);
+            }
+        }
+    }
+    out = xdr_lz_put_sequence(out, src + anchor, len - anchor, 0, 0);
+    return (size_t)(out - dest);
+}
+
+warn_unused_result
+static tn_status
+xdr_lz_get_length(const uint8_t *src, size_t srclen, size_t *pos,
+                  size_t *len)
+{
+    uint8_t byte;
+
+    do
+    {
+        if (*pos >= srclen)
+            return EPROTO;
+        byte = src[(*pos)++];
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/* Decompresses exactly @a destlen bytes, rejecting any malformed input */
+warn_unused_result
+static tn_status
+xdr_lz_decompress(const uint8_t *src, size_t srclen,
+                  uint8_t *dest, size_t destlen)
+{
+    size_t si = 0;
+    size_t di = 0;
+
+    while (si < srclen)
+    {
+        uint8_t token = src[si++];
+        size_t nlit = (size_t)(token >> 4);
+        size_t match = (size_t)(token & 0x0f);
+        size_t offset;
+
+        if (nlit == 15 && xdr_lz_get_length(src, srclen, &si, &nlit) != 0)
+            return EPROTO;
+        if (nlit > srclen - si || nlit > destlen - di)
+            return EPROTO;
+        memcpy(dest + di, src + si, nlit);
+        si += nlit;
+        di += nlit;
+        if (si == srclen)
+            break;
+
+        if (srclen - si < 2)
+            return EPROTO;
+        offset = (size_t)src[si] | ((size_t)src[si + 1] << 8);
+        si += 2;
+        if (offset == 0 || offset > di)
+            return EPROTO;
+        if (match == 15 && xdr_lz_get_length(src, srclen, &si, &match) != 0)
+            return EPROTO;
+        match += XDR_LZ_MIN_MATCH;
+        if (match > destlen - di)
+            return EPROTO;
+
+        if (offset >= match)
+            memcpy(dest + di, dest + di - offset, match);
+        else
+        {
+            size_t k;
+
+            for (k = 0; k < match; k++)
+                dest[di + k] = dest[di + k - offset];
+        }
+        di += match;
+    }
+    return di == destlen ? 0 : EPROTO;
+}
+
+warn_unused_result
+static tn_status
+xdr_lz_write_block(tn_xdr_stream *stream)
+{
+    xdr_lz_state *state = stream->data;
+    tn_xdr_stream *inner = state->common.inner;
+    size_t len = (size_t)(stream->cur - stream->start);
+    const uint8_t *payload = stream->start;
+    size_t payload_len;
+    uint32_t flags = 0;
+    tn_status rc;
+
+    if (state->table == NULL)
+        state->table = tn_alloc_blob(sizeof(*state->table) <<
+                                     XDR_LZ_HASH_BITS);
+    payload_len = xdr_lz_compress(stream->start, len, state->scratch,
+                                  state->table);
+    if (payload_len >= len)
+    {
+        flags |= XDR_LZ_STORED;
+        payload_len = len;
+    }
+    else
+        payload = state->scratch;
+    if (state->checksums)
+        flags |= XDR_LZ_CHECKSUM;
+
+    rc = xdr_write_frame_word(inner, flags | (uint32_t)payload_len);
+    if (rc == 0)
+        rc = xdr_write_frame_word(inner, (uint32_t)len);
+    if (rc == 0)
+        rc = tn_xdr_write_to_stream(inner, payload, payload_len);
+    if (rc == 0 && state->checksums)
+        rc = xdr_write_frame_word(inner,
+                                  tn_xdr_crc32c(0, stream->start, len));
+    if (rc != 0)
+        return rc;
+
+    stream->base += len;
+    stream->cur = stream->start;
+    return 0;
+}
+
+warn_unused_result
+static tn_status
+xdr_lz_read_block(tn_xdr_stream *stream)
+{
+    xdr_lz_state *state = stream->data;
+    tn_xdr_stream *inner = state->common.inner;
+    uint8_t *block = state->common.block;
+    uint32_t flags;
+    uint32_t len;
+    size_t payload_len;
+    const uint8_t *payload;
+    tn_status rc;
+
+    rc = xdr_read_frame_word(inner, &flags);
+    if (rc == 0)
+        rc = xdr_read_frame_word(inner, &len);
+    if (rc != 0)
+        return rc;
+    payload_len = flags & XDR_LZ_SIZE_MASK;
+
+    if (len > state->common.block_size || len == 0 ||
+        payload_len > xdr_lz_bound(state->common.block_size) ||
+        ((flags & XDR_LZ_STORED) && payload_len != len))
+        return EPROTO;
+
+    if (inner->viewer != NULL && tn_xdr_stream_left(inner) >= payload_len)
+    {
+        tn_xdr_view view;
+
+        rc = inner->viewer(inner, payload_len, &view);
+        payload = view.data;
+    }
+    else
+    {
+        rc = tn_xdr_read_from_stream(inner, state->scratch, payload_len);
+        payload = state->scratch;
+    }
+    if (rc != 0)
+        return rc;
+
+    if (flags & XDR_LZ_STORED)
+        memcpy(block, payload, len);
+    else
+    {
+        rc = xdr_lz_decompress(payload, payload_len, block, len);
+        if (rc != 0)
+            return rc;
+    }
+
+    if (flags & XDR_LZ_CHECKSUM)
+    {
+        uint32_t crc;
+
+        rc = xdr_read_frame_word(inner, &crc);
+        if (rc != 0)
+            return rc;
+        if (crc != tn_xdr_crc32c(0, block, len))
+            return EBADMSG;
+    }
+
+    stream->start = stream->cur = stream->write_end = block;
+    stream->end = block + len;
+    return 0;
+}
+
+tn_xdr_stream
+tn_xdr_compressed_stream(tn_xdr_stream *inner, size_t block_size,
+                         bool checksums)
+{
+    xdr_lz_state *state = TN_NEW(xdr_lz_state);
+
+    if (block_size == 0)
+        block_size = TN_XDR_COMPRESS_BLOCK_SIZE;
+    assert(block_size <= XDR_LZ_SIZE_MASK / 2);
+
+    xdr_init_block_state(&state->common, inner, block_size,
+                         xdr_lz_write_block, xdr_lz_read_block);
+    state->checksums = checksums;
+    state->scratch = tn_alloc_blob(xdr_lz_bound(block_size));
+    state->table = NULL;
+    return xdr_block_stream(&state->common);
+}
+
+/*
+ * Mapped file streams point their `data` field to a GC-allocated
+ * mapping record, which is finalized by unmapping the file.
+ * The whole mapping is the stream window
+ */
+typedef struct xdr_mapping {
+    uint8_t *addr;
+    size_t len;
+} xdr_mapping;
+
+static void
+xdr_mapping_finalize(void *obj, unused void *data)
+{
+    xdr_mapping *mapping = obj;
+
+    munmap(mapping->addr, mapping->len);
+}
+
+tn_status
+tn_xdr_mmap_stream(tn_xdr_stream *stream, int fd)
+{
+    struct stat st;
+    xdr_mapping *mapping;
+
+    if (fstat(fd, &st) != 0)
+        return errno;
+    if (!S_ISREG(st.st_mode))
+        return ENODEV;
+    if ((uintmax_t)st.st_size > SIZE_MAX)
+        return EFBIG;
+
+    mapping = TN_NEW(xdr_mapping);
+    mapping->len = (size_t)st.st_size;
+    mapping->addr = NULL;
+    if (mapping->len > 0)
+    {
+        void *addr = mmap(NULL, mapping->len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (addr == MAP_FAILED)
+            return errno;
+#ifdef MADV_SEQUENTIAL
+        madvise(addr, mapping->len, MADV_SEQUENTIAL);
+#endif
+        mapping->addr = addr;
+        tn_set_finalizer(mapping, xdr_mapping_finalize, NULL);
+    }
+
+    *stream = (tn_xdr_stream){
+        .reader = tn_xdr_dummy_reader,
+        .writer = tn_xdr_dummy_writer,
+        .flush = NULL,
+        .viewer = tn_xdr_window_viewer,
+        .referrer = NULL,
+        .compact = false,
+        .alloc_left = SIZE_MAX,
+        .depth_left = TN_XDR_MAX_DEPTH,
+        .data = mapping,
+        .start = mapping->addr,
+        .cur = mapping->addr,
+        .end = mapping->addr + mapping->len,
+        .write_end = mapping->addr,
+        .base = 0,
+        .limit = mapping->len
+    };
+    return 0;
+}
+
+/*
+ * Containers start with a header of the magic, the format version
+ * and the record alignment, padded to the alignment. Records follow
+ * at aligned offsets from the start of the container. The index
+ * is plain XDR: the number of records, then for each of them the id,
+ * the name, and the 64-bit offset and length. The trailer is
+ * the 64-bit offset of the index, its CRC32C and the trailer magic.
+ * All the numbers are big-endian and never compact
+ */
+#define XDR_CONTAINER_MAGIC 0x544e5843u /* TNXC */
+#define XDR_CONTAINER_INDEX_MAGIC 0x544e5849u /* TNXI */
+#define XDR_CONTAINER_VERSION 1
+#define XDR_CONTAINER_HEADER_SIZE 12
+#define XDR_CONTAINER_TRAILER_SIZE 16
+/* The id, an empty name, the offset and the length */
+#define XDR_CONTAINER_MIN_ENTRY_SIZE 24
+
+static const uint8_t xdr_container_padding[TN_XDR_CONTAINER_MAX_ALIGN];
+
+warn_unused_result
+static tn_status
+xdr_container_pad(tn_xdr_container_writer *writer)
+{
+    size_t pos = tn_xdr_stream_pos(writer->stream) - writer->origin;
+    size_t pad = -pos & (writer->align - 1);
+
+    return tn_xdr_write_to_stream(writer->stream, xdr_container_padding,
+                                  pad);
+}
+
+warn_unused_result
+static tn_status
+xdr_container_write_u64(tn_xdr_stream *stream, uint64_t word)
+{
+    tn_status rc = xdr_write_frame_word(stream, (uint32_t)(word >> 32));
+
+    if (rc == 0)
+        rc = xdr_write_frame_word(stream, (uint32_t)word);
+    return rc;
+}
+
+tn_status
+tn_xdr_container_begin(tn_xdr_container_writer * restrict writer,
+                       tn_xdr_stream * restrict stream,
+                       size_t align)
+{
+    tn_status rc;
+
+    if (align == 0)
+        align = TN_XDR_CONTAINER_ALIGN;
+    if (align < 4 || align > TN_XDR_CONTAINER_MAX_ALIGN ||
+        (align & (align - 1)) != 0)
+        return EINVAL;
+
+    *writer = (tn_xdr_container_writer){
+        .stream = stream,
+        .origin = tn_xdr_stream_pos(stream),
+        .align = align,
+        .count = 0,
+        .capacity = 0,
+        .entries = NULL,
+        .in_record = false
+    };
+
+    rc = xdr_write_frame_word(stream, XDR_CONTAINER_MAGIC);
+    if (rc == 0)
+        rc = xdr_write_frame_word(stream, XDR_CONTAINER_VERSION);
+    if (rc == 0)
+        rc = xdr_write_frame_word(stream, (uint32_t)align);
+    if (rc == 0)
+        rc = xdr_container_pad(writer);
+    return rc;
+}
+
+tn_status
+tn_xdr_container_start_record(tn_xdr_container_writer * restrict writer,
+                              uint32_t id,
+                              const char * restrict name)
+{
+    tn_xdr_container_entry *entry;
+    tn_status rc;
+
+    assert(!writer->in_record);
+    if (writer->count == UINT32_MAX)
+        return EOVERFLOW;
+
+    rc = xdr_container_pad(writer);
+    if (rc != 0)
+        return rc;
+
+    if (writer->count == writer->capacity)
+    {
+        writer->capacity = writer->capacity * 2 + 8;
+        writer->entries = tn_realloc(writer->entries,
+                                     writer->capacity *
+                                     sizeof(*writer->entries));
+    }
+    entry = &writer->entries[writer->count++];
+    entry->id = id;
+    entry->name = name == NULL ? "" : tn_cstrdup(name);
+    entry->offset = tn_xdr_stream_pos(writer->stream) - writer->origin;
+    entry->length = 0;
+    writer->in_record = true;
+    return 0;
+}
+
+void
+tn_xdr_container_end_record(tn_xdr_container_writer *writer)
+{
+    tn_xdr_container_entry *entry = &writer->entries[writer->count - 1];
+
+    assert(writer->in_record);
+    entry->length = tn_xdr_stream_pos(writer->stream) - writer->origin -
+        entry->offset;
+    writer->in_record = false;
+}
+
+tn_status
+tn_xdr_container_finish(tn_xdr_container_writer *writer)
+{
+    size_t size = 4;
+    size_t index_offset;
+    uint8_t *index;
+    tn_xdr_stream mem;
+    uint32_t count = (uint32_t)writer->count;
+    size_t i;
+    tn_status rc;
+
+    assert(!writer->in_record);
+    for (i = 0; i < writer->count; i++)
+    {
+        size += XDR_CONTAINER_MIN_ENTRY_SIZE +
+            ((strlen(writer->entries[i].name) + 3) & ~(size_t)3);
+    }
+
+    index = tn_alloc_blob(size);
+    mem = tn_xdr_mem_stream(index, size);
+    rc = tn_xdr_encode_uint32(&mem, &count);
+    for (i = 0; rc == 0 && i < writer->count; i++)
+    {
+        const tn_xdr_container_entry *entry = &writer->entries[i];
+
+        rc = tn_xdr_encode_uint32(&mem, &entry->id);
+        if (rc == 0)
+            rc = tn_xdr_encode_cstring(&mem, entry->name);
+        if (rc == 0)
+            rc = tn_xdr_encode_uint64(&mem, &entry->offset);
+        if (rc == 0)
+            rc = tn_xdr_encode_uint64(&mem, &entry->length);
+    }
+    assert(rc != 0 || tn_xdr_stream_left(&mem) == 0);
+
+    if (rc == 0)
+        rc = xdr_container_pad(writer);
+    if (rc != 0)
+        return rc;
+    index_offset = tn_xdr_stream_pos(writer->stream) - writer->origin;
+
+    rc = tn_xdr_write_to_stream(writer->stream, index, size);
+    if (rc == 0)
+        rc = xdr_container_write_u64(writer->stream, index_offset);
+    if (rc == 0)
+        rc = xdr_write_frame_word(writer->stream,
+                                  tn_xdr_crc32c(0, index, size));
+    if (rc == 0)
+        rc = xdr_write_frame_word(writer->stream,
+                                  XDR_CONTAINER_INDEX_MAGIC);
+    if (rc == 0)
+        rc = tn_xdr_flush(writer->stream);
+    return rc;
+}
+
+warn_unused_result
+hint_no_shared_state
+static inline size_t
+xdr_container_hash_id(uint32_t id)
+{
+    return (size_t)((id * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+warn_unused_result
+static inline size_t
+xdr_container_hash_name(const char *name)
+{
+    return tn_xdr_crc32c(0, name, strlen(name));
+}
+
+static void
+xdr_container_build_tables(tn_xdr_container *container)
+{
+    size_t capacity = 8;
+    size_t i;
+
+    while (capacity < container->count * 2)
+        capacity *= 2;
+    container->mask = capacity - 1;
+    container->by_id = tn_alloc_blob(capacity * sizeof(uint32_t));
+    container->by_name = tn_alloc_blob(capacity * sizeof(uint32_t));
+    memset(container->by_id, 0, capacity * sizeof(uint32_t));
+    memset(container->by_name, 0, capacity * sizeof(uint32_t));
+
+    for (i = 0; i < container->count; i++)
+    {
+        const tn_xdr_container_entry *entry = &container->entries[i];
+        size_t slot;
+
+        /* Later duplicates are shadowed by the first entry */
+        for (slot = xdr_container_hash_id(entry->id) & container->mask;
+             container->by_id[slot] != 0;
+             slot = (slot + 1) & container->mask)
+        {
+            if (container->entries[container->by_id[slot] - 1].id ==
+                entry->id)
+                break;
+        }
+        if (container->by_id[slot] == 0)
+            container->by_id[slot] = (uint32_t)(i + 1);
+
+        if (*entry->name == '\0')
+            continue;
+        for (slot = xdr_container_hash_name(entry->name) & container->mask;
+             container->by_name[slot] != 0;
+             slot = (slot + 1) & container->mask)
+        {
+            if (strcmp(container->entries[container->by_name[slot] - 1].name,
+                       entry->name) == 0)
+                break;
+        }
+        if (container->by_name[slot] == 0)
+            container->by_name[slot] = (uint32_t)(i + 1);
+    }
+}
+
+warn_unused_result
+static tn_status
+xdr_container_decode_index(tn_xdr_container * restrict container,
+                           tn_xdr_stream * restrict index,
+                           size_t header_size, size_t index_offset)
+{
+    uint32_t count;
+    size_t total;
+    size_t i;
+    tn_status rc;
+
+    rc = tn_xdr_decode_uint32(index, &count);
+    if (rc != 0)
+        return rc;
+    if (count > tn_xdr_stream_left(index) / XDR_CONTAINER_MIN_ENTRY_SIZE)
+        return EPROTO;
+    rc = tn_xdr_charge_alloc(index, count,
+                             sizeof(*container->entries), &total);
+    if (rc != 0)
+        return rc;
+
+    container->count = count;
+    container->entries = tn_alloc(total);
+    for (i = 0; i < count; i++)
+    {
+        tn_xdr_container_entry *entry = &container->entries[i];
+        tn_xdr_view name;
+        char *copy;
+
+        rc = tn_xdr_decode_uint32(index, &entry->id);
+        if (rc == 0)
+            rc = tn_xdr_decode_var_bytes_view(index, &name);
+        if (rc == 0)
+            rc = tn_xdr_charge_alloc(index, name.len + 1, 1, &total);
+        if (rc == 0)
+            rc = tn_xdr_decode_uint64(index, &entry->offset);
+        if (rc == 0)
+            rc = tn_xdr_decode_uint64(index, &entry->length);
+        if (rc != 0)
+            return rc;
+
+        if (entry->offset < header_size || entry->offset > index_offset ||
+            entry->length > index_offset - entry->offset ||
+            memchr(name.data, '\0', name.len) != NULL)
+            return EPROTO;
+
+        copy = tn_alloc_blob(total);
+        memcpy(copy, name.data, name.len);
+        copy[name.len] = '\0';
+        entry->name = copy;
+    }
+    return tn_xdr_stream_left(index) == 0 ? 0 : EPROTO;
+}
+
+tn_status
+tn_xdr_container_open(tn_xdr_container * restrict container,
+                      const tn_xdr_stream * restrict stream)
+{
+    const uint8_t *data = stream->cur;
+    size_t size = tn_xdr_stream_left(stream);
+    const uint8_t *trailer;
+    uint32_t header[3];
+    uint32_t crc;
+    uint64_t index_offset;
+    size_t align;
+    size_t header_size;
+    tn_xdr_stream index;
+    tn_status rc;
+
+    if ((size_t)(stream->end - stream->cur) < size)
+        return ENOTSUP;
+    if (size < XDR_CONTAINER_HEADER_SIZE + XDR_CONTAINER_TRAILER_SIZE)
+        return EPROTO;
+
+    memcpy(header, data, sizeof(header));
+    if (ntohl(header[0]) != XDR_CONTAINER_MAGIC ||
+        ntohl(header[1]) != XDR_CONTAINER_VERSION)
+        return EPROTO;
+    align = ntohl(header[2]);
+    if (align < 4 || align > TN_XDR_CONTAINER_MAX_ALIGN ||
+        (align & (align - 1)) != 0)
+        return EPROTO;
+    header_size = (XDR_CONTAINER_HEADER_SIZE + align - 1) & ~(align - 1);
+
+    trailer = data + size - XDR_CONTAINER_TRAILER_SIZE;
+    memcpy(header, trailer, sizeof(header));
+    index_offset = (uint64_t)ntohl(header[0]) << 32 | ntohl(header[1]);
+    crc = ntohl(header[2]);
+    memcpy(header, trailer + 12, sizeof(header[0]));
+    if (ntohl(header[0]) != XDR_CONTAINER_INDEX_MAGIC ||
+        index_offset < header_size ||
+        index_offset > size - XDR_CONTAINER_TRAILER_SIZE)
+        return EPROTO;
+
+    index = tn_xdr_mem_stream((uint8_t *)data + index_offset,
+                              size - XDR_CONTAINER_TRAILER_SIZE -
+                              (size_t)index_offset);
+    if (tn_xdr_crc32c(0, index.start, index.limit) != crc)
+        return EBADMSG;
+    index.alloc_left = stream->alloc_left;
+
+    container->file = *stream;
+    rc = xdr_container_decode_index(container, &index, header_size,
+                                    (size_t)index_offset);
+    if (rc == ENOMSG)
+        rc = EPROTO;
+    if (rc != 0)
+        return rc;
+
+    container->file.alloc_left = index.alloc_left;
+    xdr_container_build_tables(container);
+    return 0;
+}
+
+const tn_xdr_container_entry *
+tn_xdr_container_find_id(const tn_xdr_container *container, uint32_t id)
+{
+    size_t slot;
+
+    for (slot = xdr_container_hash_id(id) & container->mask;
+         container->by_id[slot] != 0;
+         slot = (slot + 1) & container->mask)
+    {
+        const tn_xdr_container_entry *entry =
+            &container->entries[container->by_id[slot] - 1];
+
+        if (entry->id == id)
+            return entry;
+    }
+    return NULL;
+}
+
+const tn_xdr_container_entry *
+tn_xdr_container_find_name(const tn_xdr_container * restrict container,
+                           const char * restrict name)
+{
+    size_t slot;
+
+    for (slot = xdr_container_hash_name(name) & container->mask;
+         container->by_name[slot] != 0;
+         slot = (slot + 1) & container->mask)
+    {
+        const tn_xdr_container_entry *entry =
+            &container->entries[container->by_name[slot] - 1];
+
+        if (strcmp(entry->name, name) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+tn_xdr_stream
+tn_xdr_container_record(const tn_xdr_container * restrict container,
+                        const tn_xdr_container_entry * restrict entry)
+{
+    uint8_t *start = container->file.cur + (size_t)entry->offset;
+
+    return (tn_xdr_stream){
+        .reader = tn_xdr_dummy_reader,
+        .writer = tn_xdr_dummy_writer,
+        .flush = NULL,
+        .viewer = tn_xdr_window_viewer,
+        .referrer = NULL,
+        .compact = container->file.compact,
+        .alloc_left = container->file.alloc_left,
+        .depth_left = container->file.depth_left,
+        .data = container->file.data,
+        .start = start,
+        .cur = start,
+        .end = start + (size_t)entry->length,
+        .write_end = start,
+        .base = 0,
+        .limit = (size_t)entry->length
+    };
+}
+
+#if DO_TESTS
+static void test_fd_stream(void)
+{
+    TEST_START;
+    FILE *tmp = tmpfile();
+    tn_xdr_stream stream = tn_xdr_fd_stream(fileno(tmp), 16);
+    uint8_t payload[100];
+    uint8_t *decoded = NULL;
+    size_t decoded_len = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0x0123456789abcdefull;
+    char *str = NULL;
+    size_t i;
+
+    for (i = 0; i < sizeof(payload); i++)
+        payload[i] = (uint8_t)i;
+
+    for (i = 0; i < 10; i++)
+    {
+        u32 = (uint32_t)i;
+        assert(tn_xdr_encode_uint32(&stream, &u32) == 0);
+    }
+    assert(tn_xdr_encode_var_bytes(&stream, sizeof(payload), payload) == 0);
+    assert(tn_xdr_encode_uint64(&stream, &u64) == 0);
+    assert(tn_xdr_encode_cstring(&stream, "abcde") == 0);
+    assert(tn_xdr_flush(&stream) == 0);
+    assert(tn_xdr_flush(&stream) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_END) == (off_t)tn_xdr_stream_pos(&stream));
+
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 16);
+    for (i = 0; i < 10; i++)
+    {
+        assert(tn_xdr_decode_uint32(&stream, &u32) == 0);
+        assert(u32 == i);
+    }
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len, &decoded) == 0);
+    assert(decoded_len == sizeof(payload));
+    assert(memcmp(decoded, payload, sizeof(payload)) == 0);
+    u64 = 0;
+    assert(tn_xdr_decode_uint64(&stream, &u64) == 0);
+    assert(u64 == 0x0123456789abcdefull);
+    assert(tn_xdr_decode_cstring(&stream, &str) == 0);
+    assert(strcmp(str, "abcde") == 0);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == ENOMSG);
+
+    fclose(tmp);
+}
+
+#define TEST_PIPE_COUNT 1000
+
+static void *
+test_pipe_feeder(void *arg)
+{
+    int fd = *(int *)arg;
+    uint32_t i;
+
+    /* Write in odd-sized pieces, so that the reader gets
+     * short reads which split values */
+    for (i = 0; i < TEST_PIPE_COUNT; i++)
+    {
+        uint32_t val = htonl(i);
+        const uint8_t *bytes = (const uint8_t *)&val;
+
+        assert(write(fd, bytes, 3) == 3);
+        assert(write(fd, bytes + 3, 1) == 1);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void test_fd_stream_short_reads(void)
+{
+    TEST_START;
+    int fds[2];
+    pthread_t feeder;
+    tn_xdr_stream stream;
+    uint32_t val;
+    uint32_t i;
+
+    assert(pipe(fds) == 0);
+    stream = tn_xdr_fd_stream(fds[0], 0);
+    assert(pthread_create(&feeder, NULL, test_pipe_feeder, &fds[1]) == 0);
+    for (i = 0; i < TEST_PIPE_COUNT; i++)
+    {
+        assert(tn_xdr_decode_uint32(&stream, &val) == 0);
+        assert(val == i);
+    }
+    assert(tn_xdr_decode_uint32(&stream, &val) == ENOMSG);
+    assert(pthread_join(feeder, NULL) == 0);
+    close(fds[0]);
+}
+#endif
+
+#if DO_TESTS
+
+#define CALL_BASIC_INTEROP(_suffix)             \
+    test_encode_##_suffix();                    \
+    test_decode_##_suffix()
+
+#define CALL_UNSIGNED(_suffix)                  \
+    CALL_BASIC_INTEROP(_suffix);                \
+    test_decode_##_suffix##_max()
+
+#define CALL_SIGNED(_suffix)                  \
+    CALL_UNSIGNED(_suffix);                   \
+    test_decode_##_suffix##_min()
+
+#define CALL_UNSIGNED_OVR(_suffix)               \
+    CALL_UNSIGNED(_suffix);                      \
+    test_decode_##_suffix##_ovrmax()
+
+#define CALL_SIGNED_OVR(_suffix)                 \
+    CALL_SIGNED(_suffix);                        \
+    test_decode_##_suffix##_ovrmax();            \
+    test_decode_##_suffix##_ovrmin()
+
+static void test_mmap_stream(void)
+{
+    TEST_START;
+    FILE *tmp = tmpfile();
+    tn_xdr_stream stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    static const uint8_t payload[] = "\x01\x02\x03\x04\x05";
+    tn_xdr_view view;
+    uint32_t u32 = 42;
+    const xdr_mapping *mapping;
+
+    assert(tn_xdr_encode_uint32(&stream, &u32) == 0);
+    assert(tn_xdr_encode_var_bytes(&stream, sizeof(payload) - 1,
+                                   payload) == 0);
+    assert(tn_xdr_encode_cstring(&stream, "abcd") == 0);
+    assert(tn_xdr_encode_cstring(&stream, "") == 0);
+    assert(tn_xdr_flush(&stream) == 0);
+
+    /* Streams without a viewer return copies */
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == 0);
+    assert(tn_xdr_decode_var_bytes_view(&stream, &view) == 0);
+    assert(view.len == sizeof(payload) - 1);
+    assert(view.owner == view.data);
+    assert(memcmp(view.data, payload, view.len) == 0);
+
+    assert(tn_xdr_mmap_stream(&stream, fileno(tmp)) == 0);
+    fclose(tmp);
+    mapping = stream.data;
+    assert(stream.limit == 28);
+    /* The mapping is read-only, so writes go to the dummy writer */
+    assert(tn_xdr_encode_uint32(&stream, &u32) == ENOSPC);
+    assert(tn_xdr_encode_cstring(&stream, "") == ENOSPC);
+    assert(tn_xdr_stream_pos(&stream) == 0);
+    u32 = 0;
+    assert(tn_xdr_decode_uint32(&stream, &u32) == 0);
+    assert(u32 == 42);
+    assert(tn_xdr_decode_var_bytes_view(&stream, &view) == 0);
+    assert(view.len == sizeof(payload) - 1);
+    assert(view.owner == mapping);
+    assert(view.data == mapping->addr + 8);
+    assert(memcmp(view.data, payload, view.len) == 0);
+    assert(tn_xdr_stream_pos(&stream) == 16);
+    assert(tn_xdr_decode_var_bytes_view(&stream, &view) == 0);
+    assert(view.len == 4);
+    assert(memcmp(view.data, "abcd", 4) == 0);
+    assert(tn_xdr_decode_var_bytes_view(&stream, &view) == 0);
+    assert(view.len == 0);
+    assert(tn_xdr_stream_left(&stream) == 0);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == ENOMSG);
+    assert(tn_xdr_encode_uint32(&stream, &u32) == ENOSPC);
+
+    /* Static arrays are viewed in place */
+    {
+        uint8_t buffer[] = {0, 0, 0, 2, 'x', 'y', 0, 0};
+        tn_xdr_stream mem = TN_XDR_STREAM_STATIC_ARRAY(buffer);
+
+        assert(tn_xdr_decode_var_bytes_view(&mem, &view) == 0);
+        assert(view.data == buffer + 4);
+        assert(view.len == 2);
+        assert(view.owner == NULL);
+        assert(tn_xdr_stream_pos(&mem) == sizeof(buffer));
+    }
+}
+
+static tn_status
+test_encode_iov_sample(tn_xdr_stream *stream, const uint8_t *big,
+                       size_t big_len)
+{
+    uint32_t u32 = 1;
+    tn_status rc = tn_xdr_encode_uint32(stream, &u32);
+
+    if (rc == 0)
+        rc = tn_xdr_encode_var_bytes(stream, big_len, big);
+    if (rc == 0)
+        rc = tn_xdr_encode_cstring(stream, "abc");
+    if (rc == 0)
+        rc = tn_xdr_encode_var_bytes(stream, big_len, big);
+    if (rc == 0)
+        rc = tn_xdr_encode_uint32(stream, &u32);
+    return rc;
+}
+
+static void test_iov_stream(void)
+{
+    TEST_START;
+    static uint8_t big[1001];
+    static uint8_t expected[2 * 1024 + 32];
+    tn_xdr_stream mem = TN_XDR_STREAM_STATIC_ARRAY(expected);
+    tn_xdr_stream stream = tn_xdr_iov_stream(0);
+    const struct iovec *iov;
+    size_t count;
+    size_t i;
+    size_t offset = 0;
+    size_t refs = 0;
+    FILE *tmp = tmpfile();
+    uint8_t *decoded;
+    size_t decoded_len;
+    uint32_t u32;
+
+    for (i = 0; i < sizeof(big); i++)
+        big[i] = (uint8_t)(i * 7);
+
+    assert(test_encode_iov_sample(&mem, big, sizeof(big)) == 0);
+    assert(test_encode_iov_sample(&stream, big, sizeof(big)) == 0);
+    assert(tn_xdr_stream_pos(&stream) == tn_xdr_stream_pos(&mem));
+
+    tn_xdr_iov_get(&stream, &iov, &count);
+    assert(count == 5);
+    for (i = 0; i < count; i++)
+    {
+        if (iov[i].iov_base == big)
+        {
+            assert(iov[i].iov_len == sizeof(big));
+            refs++;
+        }
+        assert(memcmp(iov[i].iov_base, expected + offset,
+                      iov[i].iov_len) == 0);
+        offset += iov[i].iov_len;
+    }
+    assert(refs == 2);
+    assert(offset == tn_xdr_stream_pos(&mem));
+
+    assert(tn_xdr_iov_writev(&stream, fileno(tmp)) == 0);
+    u32 = 42;
+    assert(tn_xdr_encode_uint32(&stream, &u32) == 0);
+    assert(tn_xdr_iov_writev(&stream, fileno(tmp)) == 0);
+    tn_xdr_iov_get(&stream, &iov, &count);
+    assert(count == 0);
+
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == 0);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len, &decoded) == 0);
+    assert(decoded_len == sizeof(big));
+    assert(memcmp(decoded, big, sizeof(big)) == 0);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len, &decoded) == 0);
+    assert(decoded_len == 3);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len, &decoded) == 0);
+    assert(memcmp(decoded, big, sizeof(big)) == 0);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == 0);
+    assert(u32 == 1);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == 0);
+    assert(u32 == 42);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == ENOMSG);
+    fclose(tmp);
+}
+
+#define TEST_BULK_LEN 37
+
+static void
+test_bulk_roundtrip(const tn_xdr_element_descr *elt, const void *data)
+{
+    tn_xdr_element_descr generic = *elt;
+    uint8_t bulk[TEST_BULK_LEN * sizeof(uint64_t)] = {};
+    uint8_t single[sizeof(bulk)] = {};
+    uint8_t decoded[sizeof(bulk)] = {};
+    uint8_t small[sizeof(bulk) - 1];
+    tn_xdr_stream bstream = TN_XDR_STREAM_STATIC_ARRAY(bulk);
+    tn_xdr_stream sstream = TN_XDR_STREAM_STATIC_ARRAY(single);
+    tn_xdr_stream small_stream = TN_XDR_STREAM_STATIC_ARRAY(small);
+    size_t size = TEST_BULK_LEN * elt->elsize;
+    FILE *tmp = tmpfile();
+    tn_xdr_stream fd_stream = tn_xdr_fd_stream(fileno(tmp), 20);
+
+    assert(tn_xdr_encode_array(&bstream, elt, TEST_BULK_LEN, data) == 0);
+    assert(tn_xdr_encode_array(&sstream, &generic, TEST_BULK_LEN, data) == 0);
+    assert(tn_xdr_stream_pos(&bstream) == size);
+    assert(memcmp(bulk, single, sizeof(bulk)) == 0);
+
+    bstream = TN_XDR_STREAM_STATIC_ARRAY(bulk);
+    assert(tn_xdr_decode_array(&bstream, elt, TEST_BULK_LEN, decoded) == 0);
+    assert(memcmp(decoded, data, size) == 0);
+
+    small_stream.limit = size - 1;
+    small_stream.end = small_stream.write_end = small + size - 1;
+    assert(tn_xdr_encode_array(&small_stream, elt,
+                               TEST_BULK_LEN, data) == ENOSPC);
+
+    /* Elements crossing the buffer boundary of a file stream */
+    assert(tn_xdr_encode_uint32(&fd_stream, &(uint32_t){1}) == 0);
+    assert(tn_xdr_encode_array(&fd_stream, elt, TEST_BULK_LEN, data) == 0);
+    assert(tn_xdr_flush(&fd_stream) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    fd_stream = tn_xdr_fd_stream(fileno(tmp), 20);
+    memset(decoded, 0, sizeof(decoded));
+    assert(tn_xdr_decode_uint32(&fd_stream, &(uint32_t){0}) == 0);
+    assert(tn_xdr_decode_array(&fd_stream, elt, TEST_BULK_LEN, decoded) == 0);
+    assert(memcmp(decoded, data, size) == 0);
+    assert(tn_xdr_decode_array(&fd_stream, elt, 1, decoded) == ENOMSG);
+    fclose(tmp);
+}
+
+static void test_bulk_arrays(void)
+{
+    TEST_START;
+    int32_t i32[TEST_BULK_LEN];
+    uint64_t u64[TEST_BULK_LEN];
+    double dbl[TEST_BULK_LEN];
+    unsigned i;
+#if PLATFORM_ARCH_IS_amd64 && defined(target_isa)
+    const struct {
+        bool usable;
+        xdr_bswap_func func;
+    } variants[] = {
+        {true, xdr_bswap_scalar},
+        {__builtin_cpu_supports("ssse3"), xdr_bswap_ssse3},
+        {__builtin_cpu_supports("avx2"), xdr_bswap_avx2},
+    };
+    xdr_bswap_func saved = xdr_bswap;
+    unsigned v;
+#endif
+
+    for (i = 0; i < TEST_BULK_LEN; i++)
+    {
+        i32[i] = (int32_t)(i * 0x01020304u) * (i % 2 ? -1 : 1);
+        u64[i] = i * 0x0102030405060708ull;
+        dbl[i] = -1.5 * i;
+    }
+
+#if PLATFORM_ARCH_IS_amd64 && defined(target_isa)
+    for (v = 0; v < sizeof(variants) / sizeof(*variants); v++)
+    {
+        if (!variants[v].usable)
+            continue;
+        xdr_bswap = variants[v].func;
+#endif
+        test_bulk_roundtrip(&tn_xdr_int32_descr, i32);
+        test_bulk_roundtrip(&tn_xdr_uint64_descr, u64);
+        test_bulk_roundtrip(&tn_xdr_double_descr, dbl);
+#if PLATFORM_ARCH_IS_amd64 && defined(target_isa)
+    }
+    xdr_bswap = saved;
+#endif
+}
+
+typedef struct test_point {
+    int32_t x;
+    int32_t y;
+    double weight;
+} test_point;
+
+#define TEST_POINT_FIELDS(_) _(int32, x) _(int32, y) _(double, weight)
+TN_XDR_DEFINE_STRUCT(test_point, test_point, TEST_POINT_FIELDS);
+
+typedef struct test_segment {
+    test_point from;
+    test_point to;
+    bool closed;
+    uint16_t tag;
+} test_segment;
+
+#define TEST_SEGMENT_FIELDS(_)                                  \
+    _(test_point, from) _(test_point, to) _(bool, closed) _(uint16, tag)
+TN_XDR_DEFINE_STRUCT(test_segment, test_segment, TEST_SEGMENT_FIELDS);
+
+typedef struct test_shape {
+    uint32_t kind;
+    union {
+        test_point point;
+        test_segment segment;
+        uint32_t radius;
+    } u;
+} test_shape;
+
+#define TEST_SHAPE_ARMS(_)                                              \
+    _(0, test_point, u.point) _(1, test_segment, u.segment)             \
+    _(7, uint32, u.radius)
+TN_XDR_DEFINE_UNION(test_shape, test_shape, kind, TEST_SHAPE_ARMS);
+
+static bool
+test_segment_equal(const test_segment *s1, const test_segment *s2)
+{
+    return s1->from.x == s2->from.x && s1->from.y == s2->from.y &&
+        s1->from.weight == s2->from.weight &&
+        s1->to.x == s2->to.x && s1->to.y == s2->to.y &&
+        s1->to.weight == s2->to.weight &&
+        s1->closed == s2->closed && s1->tag == s2->tag;
+}
+
+static void test_compiled_schema(void)
+{
+    TEST_START;
+    const tn_xdr_element_descr point_fields[] = {
+        tn_xdr_int32_descr, tn_xdr_int32_descr, tn_xdr_double_descr
+    };
+    static const tn_xdr_element_descr segment_descr =
+        TN_XDR_STRUCT_DESCR(test_segment, test_segment);
+    test_segment segs[3] = {
+        {{1, -2, 0.5}, {3, 4, -1.0}, true, 65535},
+        {{INT32_MIN, INT32_MAX, 1e100}, {0, 0, 0}, false, 0},
+        {{7, 8, 9}, {10, 11, 12}, true, 13},
+    };
+    test_segment decoded[3];
+    test_shape shape = {.kind = 1, .u.segment = segs[0]};
+    test_shape decoded_shape;
+    uint8_t compiled[TN_XDR_SIZE_test_segment * 3];
+    uint8_t interpreted[TN_XDR_SIZE_test_point];
+    tn_xdr_stream stream = TN_XDR_STREAM_STATIC_ARRAY(compiled);
+    tn_xdr_stream istream = TN_XDR_STREAM_STATIC_ARRAY(interpreted);
+    FILE *tmp = tmpfile();
+    tn_xdr_stream fd_stream = tn_xdr_fd_stream(fileno(tmp), 20);
+    unsigned i;
+
+    assert(TN_XDR_SIZE_test_point == 16);
+    assert(TN_XDR_SIZE_test_segment == 40);
+
+    assert(tn_xdr_encode_test_point(&stream, &segs[0].from) == 0);
+    assert(tn_xdr_encode_struct(&istream, 3, point_fields,
+                                &segs[0].from) == 0);
+    assert(memcmp(compiled, interpreted, sizeof(interpreted)) == 0);
+
+    stream = TN_XDR_STREAM_STATIC_ARRAY(compiled);
+    assert(tn_xdr_encode_array(&stream, &segment_descr, 3, segs) == 0);
+    assert(tn_xdr_stream_left(&stream) == 0);
+    assert(tn_xdr_encode_test_segment(&stream, &segs[0]) == ENOSPC);
+    stream = TN_XDR_STREAM_STATIC_ARRAY(compiled);
+    assert(tn_xdr_decode_array(&stream, &segment_descr, 3, decoded) == 0);
+    for (i = 0; i < 3; i++)
+        assert(test_segment_equal(&segs[i], &decoded[i]));
+
+    /* A record which does not fit is rejected before anything
+     * is written */
+    stream = TN_XDR_STREAM_STATIC_ARRAY(compiled);
+    stream.limit = stream.base + TN_XDR_SIZE_test_segment - 1;
+    stream.end = stream.write_end = stream.start + stream.limit;
+    assert(tn_xdr_encode_test_segment(&stream, &segs[0]) == ENOSPC);
+    assert(tn_xdr_stream_pos(&stream) == 0);
+
+    /* Invalid values are detected in the fast path */
+    stream = TN_XDR_STREAM_STATIC_ARRAY(compiled);
+    compiled[2 * TN_XDR_SIZE_test_point + 3] = 2;
+    assert(tn_xdr_decode_test_segment(&stream, &decoded[0]) == EOVERFLOW);
+    assert(tn_xdr_stream_pos(&stream) == 0);
+
+    /* Records crossing buffer boundaries take the slow path */
+    for (i = 0; i < 3; i++)
+        assert(tn_xdr_encode_test_segment(&fd_stream, &segs[i]) == 0);
+    assert(tn_xdr_encode_test_shape(&fd_stream, &shape) == 0);
+    shape.kind = 7;
+    shape.u.radius = 42;
+    assert(tn_xdr_encode_test_shape(&fd_stream, &shape) == 0);
+    shape.kind = 3;
+    assert(tn_xdr_encode_test_shape(&fd_stream, &shape) == EINVAL);
+    assert(tn_xdr_encode_uint32(&fd_stream, &shape.kind) == 0);
+    assert(tn_xdr_flush(&fd_stream) == 0);
+
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    fd_stream = tn_xdr_fd_stream(fileno(tmp), 20);
+    for (i = 0; i < 3; i++)
+    {
+        assert(tn_xdr_decode_test_segment(&fd_stream, &decoded[i]) == 0);
+        assert(test_segment_equal(&segs[i], &decoded[i]));
+    }
+    assert(tn_xdr_decode_test_shape(&fd_stream, &decoded_shape) == 0);
+    assert(decoded_shape.kind == 1);
+    assert(test_segment_equal(&segs[0], &decoded_shape.u.segment));
+    assert(tn_xdr_decode_test_shape(&fd_stream, &decoded_shape) == 0);
+    assert(decoded_shape.kind == 7);
+    assert(decoded_shape.u.radius == 42);
+    assert(tn_xdr_decode_test_shape(&fd_stream, &decoded_shape) == EPROTO);
+    assert(tn_xdr_decode_test_segment(&fd_stream, &decoded[0]) == ENOMSG);
+    fclose(tmp);
+}
+
+static tn_status
+test_encode_string_elt(tn_xdr_stream * restrict stream,
+                       const void * restrict data)
+{
+    return tn_xdr_encode_cstring(stream, *(const char * const *)data);
+}
+
+static void test_sizeof(void)
+{
+    TEST_START;
+    const tn_xdr_element_descr string_descr = {
+        .elsize = sizeof(const char *),
+        .encode = test_encode_string_elt,
+        .decode = NULL,
+        .measure = NULL,
+        .fixed_size = 0
+    };
+    const tn_xdr_element_descr segment_descr =
+        TN_XDR_STRUCT_DESCR(test_segment, test_segment);
+    const tn_xdr_element_descr shape_descr =
+        TN_XDR_STRUCT_DESCR(test_shape, test_shape);
+    const tn_xdr_element_descr record_fields[] = {
+        string_descr, segment_descr, tn_xdr_int32_descr
+    };
+    const tn_xdr_element_descr arms[] = {
+        tn_xdr_int32_descr, tn_xdr_double_descr
+    };
+    const char *strings[] = {"", "a", "abcde"};
+    struct {
+        const char *name;
+        test_segment seg;
+        int32_t id;
+    } record = {"xyz", {{1, 2, 3}, {4, 5, 6}, true, 7}, 1};
+    test_shape shape = {.kind = 7, .u.radius = 1};
+    double dbl[TEST_BULK_LEN] = {};
+    test_segment segs[3] = {};
+    size_t size = 0;
+    uint8_t *buffer;
+    tn_xdr_stream stream;
+
+    assert(tn_xdr_sizeof_bytes(0) == 0);
+    assert(tn_xdr_sizeof_bytes(1) == 4);
+    assert(tn_xdr_sizeof_bytes(4) == 4);
+    assert(tn_xdr_sizeof_bytes(5) == 8);
+    assert(tn_xdr_sizeof_var_bytes(5) == 12);
+    assert(tn_xdr_sizeof_cstring("abcd") == 8);
+
+    assert(tn_xdr_sizeof(&tn_xdr_int64_descr, dbl, &size) == 0);
+    assert(size == 8);
+    assert(tn_xdr_sizeof_array(&tn_xdr_double_descr, TEST_BULK_LEN,
+                               dbl, &size) == 0);
+    assert(size == TEST_BULK_LEN * 8);
+    assert(tn_xdr_sizeof_var_array(&segment_descr, 3, segs, &size) == 0);
+    assert(size == 4 + 3 * TN_XDR_SIZE_test_segment);
+    assert(tn_xdr_sizeof(&shape_descr, &shape, &size) == 0);
+    assert(size == 8);
+    shape.kind = 1;
+    assert(tn_xdr_sizeof(&shape_descr, &shape, &size) == 0);
+    assert(size == 4 + TN_XDR_SIZE_test_segment);
+    assert(tn_xdr_sizeof_test_shape(&shape) == size);
+    shape.kind = 2;
+    assert(tn_xdr_sizeof(&shape_descr, &shape, &size) == EINVAL);
+    assert(tn_xdr_sizeof_union(2, arms, 1, dbl, &size) == 0);
+    assert(size == 12);
+
+    /* Descriptors without a measurer are sized by encoding */
+    assert(tn_xdr_sizeof_var_array(&string_descr, 3, strings, &size) == 0);
+    assert(size == 4 + 4 + 8 + 12);
+    buffer = tn_alloc_blob(size);
+    stream = tn_xdr_mem_stream(buffer, size);
+    assert(tn_xdr_encode_var_array(&stream, &string_descr,
+                                   3, strings) == 0);
+    assert(tn_xdr_stream_left(&stream) == 0);
+
+    assert(tn_xdr_sizeof_struct(3, record_fields, &record, &size) == 0);
+    assert(size == 4 + 8 + TN_XDR_SIZE_test_segment);
+    buffer = tn_alloc_blob(size);
+    stream = tn_xdr_mem_stream(buffer, size);
+    assert(tn_xdr_encode_struct(&stream, 3, record_fields, &record) == 0);
+    assert(tn_xdr_stream_left(&stream) == 0);
+}
+
+static tn_status
+test_encode_compact_sample(tn_xdr_stream *stream)
+{
+    static const int32_t ints[] = {1, -1, 1000};
+    tn_status rc;
+
+#define TEST_COMPACT_ENCODE(_type, _value)                          \
+    if ((rc = tn_xdr_encode_##_type(stream, &(_value))) != 0)       \
+        return rc
+    TEST_COMPACT_ENCODE(bool, (bool){true});
+    TEST_COMPACT_ENCODE(int8, (int8_t){-1});
+    TEST_COMPACT_ENCODE(int16, (int16_t){300});
+    TEST_COMPACT_ENCODE(uint32, (uint32_t){0});
+    TEST_COMPACT_ENCODE(uint32, (uint32_t){UINT32_MAX});
+    TEST_COMPACT_ENCODE(int32, (int32_t){INT32_MIN});
+    TEST_COMPACT_ENCODE(int64, (int64_t){INT64_MIN});
+    TEST_COMPACT_ENCODE(uint64, (uint64_t){UINT64_MAX});
+    TEST_COMPACT_ENCODE(double, (double){1.5});
+#undef TEST_COMPACT_ENCODE
+    rc = tn_xdr_encode_cstring(stream, "abcde");
+    if (rc == 0)
+        rc = tn_xdr_encode_var_array(stream, &tn_xdr_int32_descr, 3, ints);
+    return rc;
+}
+
+static void
+test_decode_compact_sample(tn_xdr_stream *stream)
+{
+    bool b = false;
+    int8_t i8 = 0;
+    int16_t i16 = 0;
+    uint32_t u32 = 1;
+    int32_t i32 = 0;
+    int64_t i64 = 0;
+    uint64_t u64 = 0;
+    double dbl = 0;
+    char *str = NULL;
+    int32_t *ints = NULL;
+    size_t len = 0;
+
+    assert(tn_xdr_decode_bool(stream, &b) == 0 && b);
+    assert(tn_xdr_decode_int8(stream, &i8) == 0 && i8 == -1);
+    assert(tn_xdr_decode_int16(stream, &i16) == 0 && i16 == 300);
+    assert(tn_xdr_decode_uint32(stream, &u32) == 0 && u32 == 0);
+    assert(tn_xdr_decode_uint32(stream, &u32) == 0 && u32 == UINT32_MAX);
+    assert(tn_xdr_decode_int32(stream, &i32) == 0 && i32 == INT32_MIN);
+    assert(tn_xdr_decode_int64(stream, &i64) == 0 && i64 == INT64_MIN);
+    assert(tn_xdr_decode_uint64(stream, &u64) == 0 && u64 == UINT64_MAX);
+    assert(tn_xdr_decode_double(stream, &dbl) == 0 && dbl == 1.5);
+    assert(tn_xdr_decode_cstring(stream, &str) == 0);
+    assert(strcmp(str, "abcde") == 0);
+    assert(tn_xdr_decode_var_array(stream, &tn_xdr_int32_descr,
+                                   &len, (void **)&ints) == 0);
+    assert(len == 3 && ints[0] == 1 && ints[1] == -1 && ints[2] == 1000);
+}
+
+static void test_compact_mode(void)
+{
+    TEST_START;
+    uint8_t buffer[64];
+    tn_xdr_stream stream = TN_XDR_STREAM_STATIC_ARRAY(buffer);
+    const uint8_t overlong[] = {0x80, 0x80, 0x80, 0x80, 0x80,
+                                0x80, 0x80, 0x80, 0x80, 0x80, 0x01};
+    const uint8_t too_big[] = {0xff, 0xff, 0xff, 0xff, 0xff,
+                               0xff, 0xff, 0xff, 0xff, 0x02};
+    const uint8_t truncated[] = {0x80};
+    const uint8_t over32[] = {0x80, 0x80, 0x80, 0x80, 0x10};
+    test_segment seg = {{1, -2, 0.5}, {3, 4, -1.0}, true, 65535};
+    test_segment decoded_seg;
+    const tn_xdr_element_descr segment_descr =
+        TN_XDR_STRUCT_DESCR(test_segment, test_segment);
+    FILE *tmp = tmpfile();
+    size_t size;
+    uint64_t u64;
+    uint32_t u32;
+
+    tn_xdr_set_compact(&stream, true);
+    assert(test_encode_compact_sample(&stream) == 0);
+    assert(tn_xdr_stream_pos(&stream) ==
+           1 + 1 + 2 + 1 + 5 + 5 + 10 + 10 + 8 + 6 + 5);
+    assert(buffer[2] == 0xd8 && buffer[3] == 0x04);
+
+    stream = TN_XDR_STREAM_STATIC_ARRAY(buffer);
+    tn_xdr_set_compact(&stream, true);
+    test_decode_compact_sample(&stream);
+
+    /* Varints crossing buffer boundaries */
+    stream = tn_xdr_fd_stream(fileno(tmp), 3);
+    tn_xdr_set_compact(&stream, true);
+    assert(test_encode_compact_sample(&stream) == 0);
+    assert(tn_xdr_encode_test_segment(&stream, &seg) == 0);
+    assert(tn_xdr_flush(&stream) == 0);
+    assert(tn_xdr_stream_pos(&stream) < 54 + TN_XDR_SIZE_test_segment);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 3);
+    tn_xdr_set_compact(&stream, true);
+    test_decode_compact_sample(&stream);
+    assert(tn_xdr_decode_test_segment(&stream, &decoded_seg) == 0);
+    assert(test_segment_equal(&seg, &decoded_seg));
+    assert(tn_xdr_decode_varint(&stream, &u64) == ENOMSG);
+    fclose(tmp);
+
+    stream = TN_XDR_STREAM_STATIC_ARRAY(overlong);
+    assert(tn_xdr_decode_varint(&stream, &u64) == EPROTO);
+    stream = TN_XDR_STREAM_STATIC_ARRAY(too_big);
+    assert(tn_xdr_decode_varint(&stream, &u64) == EPROTO);
+    stream = TN_XDR_STREAM_STATIC_ARRAY(truncated);
+    assert(tn_xdr_decode_varint(&stream, &u64) == ENOMSG);
+    stream = TN_XDR_STREAM_STATIC_ARRAY(over32);
+    tn_xdr_set_compact(&stream, true);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == EOVERFLOW);
+
+    stream = TN_XDR_STREAM_STATIC_ARRAY(buffer);
+    tn_xdr_set_compact(&stream, true);
+    assert(tn_xdr_encode_test_segment(&stream, &seg) == 0);
+    assert(tn_xdr_sizeof_compact(&segment_descr, &seg, &size) == 0);
+    assert(size == tn_xdr_stream_pos(&stream));
+    assert(tn_xdr_sizeof(&segment_descr, &seg, &size) == 0);
+    assert(size == TN_XDR_SIZE_test_segment);
+}
+
+#define TEST_LZ_SAMPLE_LEN 5000
+
+static void
+test_fill_lz_sample(uint8_t *sample)
+{
+    static const char text[] = "the quick brown fox jumps over the lazy dog ";
+    uint32_t seed = 12345;
+    size_t i;
+
+    for (i = 0; i < TEST_LZ_SAMPLE_LEN / 2; i++)
+        sample[i] = (uint8_t)text[i % (sizeof(text) - 1)];
+    for (; i < TEST_LZ_SAMPLE_LEN; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        sample[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+static tn_status
+test_encode_lz_sample(tn_xdr_stream *inner, bool checksums,
+                      const uint8_t *sample)
+{
+    tn_xdr_stream stream = tn_xdr_compressed_stream(inner, 1024, checksums);
+    uint32_t u32 = 42;
+    tn_status rc = tn_xdr_encode_uint32(&stream, &u32);
+
+    if (rc == 0)
+        rc = tn_xdr_encode_var_bytes(&stream, TEST_LZ_SAMPLE_LEN, sample);
+    if (rc == 0)
+        rc = tn_xdr_encode_cstring(&stream, "abcde");
+    if (rc == 0)
+        rc = tn_xdr_flush(&stream);
+    if (rc == 0)
+        assert(tn_xdr_stream_pos(&stream) == 4 + 4 + TEST_LZ_SAMPLE_LEN + 12);
+    return rc;
+}
+
+static void
+test_decode_lz_sample(tn_xdr_stream *inner, const uint8_t *sample)
+{
+    tn_xdr_stream stream = tn_xdr_compressed_stream(inner, 1024, false);
+    uint32_t u32 = 0;
+    uint8_t *decoded = NULL;
+    size_t decoded_len = 0;
+    char *str = NULL;
+
+    assert(tn_xdr_decode_uint32(&stream, &u32) == 0);
+    assert(u32 == 42);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len, &decoded) == 0);
+    assert(decoded_len == TEST_LZ_SAMPLE_LEN);
+    assert(memcmp(decoded, sample, TEST_LZ_SAMPLE_LEN) == 0);
+    assert(tn_xdr_decode_cstring(&stream, &str) == 0);
+    assert(strcmp(str, "abcde") == 0);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == ENOMSG);
+}
+
+static void test_compressed_stream(void)
+{
+    TEST_START;
+    static const size_t lengths[] = {0, 1, 11, 12, 13, 100,
+                                     TEST_LZ_SAMPLE_LEN / 2,
+                                     TEST_LZ_SAMPLE_LEN};
+    uint8_t sample[TEST_LZ_SAMPLE_LEN];
+    uint8_t *packed = tn_alloc_blob(xdr_lz_bound(TEST_LZ_SAMPLE_LEN));
+    uint8_t *unpacked = tn_alloc_blob(TEST_LZ_SAMPLE_LEN);
+    uint32_t *table = tn_alloc_blob(sizeof(*table) << XDR_LZ_HASH_BITS);
+    uint8_t buffer[2 * TEST_LZ_SAMPLE_LEN];
+    tn_xdr_stream inner = TN_XDR_STREAM_STATIC_ARRAY(buffer);
+    FILE *tmp = tmpfile();
+    size_t written;
+    size_t packed_len;
+    uint32_t flags;
+    uint32_t u32;
+    unsigned i;
+
+    test_fill_lz_sample(sample);
+    for (i = 0; i < sizeof(lengths) / sizeof(*lengths); i++)
+    {
+        packed_len = xdr_lz_compress(sample, lengths[i], packed, table);
+        assert(packed_len <= xdr_lz_bound(lengths[i]));
+        assert(xdr_lz_decompress(packed, packed_len,
+                                 unpacked, lengths[i]) == 0);
+        assert(memcmp(unpacked, sample, lengths[i]) == 0);
+    }
+    packed_len = xdr_lz_compress(sample, TEST_LZ_SAMPLE_LEN / 2,
+                                 packed, table);
+    assert(packed_len < TEST_LZ_SAMPLE_LEN / 20);
+    assert(xdr_lz_decompress(packed, packed_len - 1, unpacked,
+                             TEST_LZ_SAMPLE_LEN / 2) == EPROTO);
+    assert(xdr_lz_decompress(packed, packed_len, unpacked,
+                             TEST_LZ_SAMPLE_LEN / 2 - 1) == EPROTO);
+
+    assert(test_encode_lz_sample(&inner, true, sample) == 0);
+    written = tn_xdr_stream_pos(&inner);
+    assert(written < TEST_LZ_SAMPLE_LEN * 3 / 4);
+    inner = tn_xdr_mem_stream(buffer, written);
+    test_decode_lz_sample(&inner, sample);
+
+    assert(test_encode_lz_sample(&inner, false, sample) == ENOSPC);
+
+    inner = tn_xdr_fd_stream(fileno(tmp), 100);
+    assert(test_encode_lz_sample(&inner, false, sample) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    inner = tn_xdr_fd_stream(fileno(tmp), 100);
+    test_decode_lz_sample(&inner, sample);
+    assert(tn_xdr_mmap_stream(&inner, fileno(tmp)) == 0);
+    fclose(tmp);
+    test_decode_lz_sample(&inner, sample);
+
+    /* A corrupted checksum of the first frame */
+    (void)tn_xdr_get_uint32(buffer, &flags);
+    buffer[8 + (flags & XDR_LZ_SIZE_MASK)] ^= 1;
+    inner = tn_xdr_mem_stream(buffer, written);
+    {
+        tn_xdr_stream stream = tn_xdr_compressed_stream(&inner, 1024, false);
+
+        assert(tn_xdr_decode_uint32(&stream, &u32) == EBADMSG);
+    }
+
+    /* Frames larger than the block size */
+    inner = tn_xdr_mem_stream(buffer, written);
+    {
+        tn_xdr_stream stream = tn_xdr_compressed_stream(&inner, 512, false);
+
+        assert(tn_xdr_decode_uint32(&stream, &u32) == EPROTO);
+    }
+}
+
+static void test_checksum_stream(void)
+{
+    TEST_START;
+    uint8_t sample[TEST_LZ_SAMPLE_LEN];
+    uint8_t buffer[TEST_LZ_SAMPLE_LEN + 64];
+    tn_xdr_stream inner = TN_XDR_STREAM_STATIC_ARRAY(buffer);
+    tn_xdr_stream stream;
+    FILE *tmp = tmpfile();
+    uint8_t *decoded = NULL;
+    size_t decoded_len = 0;
+    size_t written;
+    uint32_t u32 = 0;
+    unsigned i;
+
+    assert(tn_xdr_crc32c(0, "123456789", 9) == 0xe3069283u);
+    assert(tn_xdr_crc32c(tn_xdr_crc32c(0, "1234", 4), "56789", 5) ==
+           0xe3069283u);
+    test_fill_lz_sample(sample);
+    for (i = 0; i < 64; i++)
+    {
+        assert(~xdr_crc32c_slice8(~0u, sample + i, TEST_LZ_SAMPLE_LEN - i) ==
+               tn_xdr_crc32c(0, sample + i, TEST_LZ_SAMPLE_LEN - i));
+    }
+
+    stream = tn_xdr_checksum_stream(&inner, 1000);
+    assert(tn_xdr_encode_var_bytes(&stream, TEST_LZ_SAMPLE_LEN, sample) == 0);
+    assert(tn_xdr_flush(&stream) == 0);
+    written = tn_xdr_stream_pos(&inner);
+    assert(written == 4 + TEST_LZ_SAMPLE_LEN + 6 * 8);
+
+    inner = tn_xdr_mem_stream(buffer, written);
+    stream = tn_xdr_checksum_stream(&inner, 1000);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len, &decoded) == 0);
+    assert(decoded_len == TEST_LZ_SAMPLE_LEN);
+    assert(memcmp(decoded, sample, TEST_LZ_SAMPLE_LEN) == 0);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == ENOMSG);
+
+    /* Through a file, and back through a mapping */
+    inner = tn_xdr_fd_stream(fileno(tmp), 0);
+    stream = tn_xdr_checksum_stream(&inner, 0);
+    assert(tn_xdr_encode_var_bytes(&stream, TEST_LZ_SAMPLE_LEN, sample) == 0);
+    assert(tn_xdr_flush(&stream) == 0);
+    assert(tn_xdr_mmap_stream(&inner, fileno(tmp)) == 0);
+    fclose(tmp);
+    stream = tn_xdr_checksum_stream(&inner, 0);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len, &decoded) == 0);
+    assert(memcmp(decoded, sample, TEST_LZ_SAMPLE_LEN) == 0);
+
+    /* Corrupted data in the last frame */
+    buffer[written - 5] ^= 0x80;
+    inner = tn_xdr_mem_stream(buffer, written);
+    stream = tn_xdr_checksum_stream(&inner, 1000);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len,
+                                   &decoded) == EBADMSG);
+
+    /* A dropped frame breaks the running CRC */
+    buffer[written - 5] ^= 0x80;
+    memmove(buffer + 1008, buffer + 2016, written - 2016);
+    inner = tn_xdr_mem_stream(buffer, written - 1008);
+    stream = tn_xdr_checksum_stream(&inner, 1000);
+    assert(tn_xdr_decode_var_bytes(&stream, &decoded_len,
+                                   &decoded) == EBADMSG);
+
+    inner = tn_xdr_mem_stream(buffer, written);
+    stream = tn_xdr_checksum_stream(&inner, 500);
+    assert(tn_xdr_decode_uint32(&stream, &u32) == EPROTO);
+}
+
+typedef struct test_message {
+    uint32_t id;
+    tn_xdr_vector points;
+    tn_xdr_vector rows;
+    uint64_t stamps[3];
+} test_message;
+
+static const tn_xdr_element_descr test_point_descr =
+    TN_XDR_STRUCT_DESCR(test_point, test_point);
+static const tn_xdr_schema test_uint32_schema =
+    TN_XDR_SCHEMA_ELEMENT(tn_xdr_uint32_descr, uint32_t);
+static const tn_xdr_schema test_int32_schema =
+    TN_XDR_SCHEMA_ELEMENT(tn_xdr_int32_descr, int32_t);
+static const tn_xdr_schema test_uint64_schema =
+    TN_XDR_SCHEMA_ELEMENT(tn_xdr_uint64_descr, uint64_t);
+static const tn_xdr_schema test_point_schema =
+    TN_XDR_SCHEMA_ELEMENT(test_point_descr, test_point);
+static const tn_xdr_schema test_points_schema =
+    TN_XDR_SCHEMA_VAR_ARRAY(test_point_schema);
+static const tn_xdr_schema test_row_schema =
+    TN_XDR_SCHEMA_VAR_ARRAY(test_int32_schema);
+static const tn_xdr_schema test_rows_schema =
+    TN_XDR_SCHEMA_VAR_ARRAY(test_row_schema);
+static const tn_xdr_schema test_stamps_schema =
+    TN_XDR_SCHEMA_ARRAY(uint64_t, 3, test_uint64_schema);
+static const tn_xdr_schema_field test_message_fields[] = {
+    TN_XDR_SCHEMA_FIELD(test_message, id, test_uint32_schema),
+    TN_XDR_SCHEMA_FIELD(test_message, points, test_points_schema),
+    TN_XDR_SCHEMA_FIELD(test_message, rows, test_rows_schema),
+    TN_XDR_SCHEMA_FIELD(test_message, stamps, test_stamps_schema),
+};
+static const tn_xdr_schema test_message_schema =
+    TN_XDR_SCHEMA_STRUCT(test_message, test_message_fields);
+
+static tn_status
+test_encode_message(tn_xdr_stream *stream, uint32_t id)
+{
+    static const test_point points[] = {{1, 2, 0.5}, {-3, 4, 2.0}};
+    static const int32_t row0[] = {1, 2, 3};
+    static const int32_t row2[] = {-1};
+    static const uint64_t stamps[] = {1, UINT64_MAX, 0x123456789ull};
+    tn_status rc = tn_xdr_encode_uint32(stream, &id);
+
+    if (rc == 0)
+        rc = tn_xdr_encode_var_array(stream, &test_point_descr, 2, points);
+    if (rc == 0)
+        rc = tn_xdr_encode_length(stream, 3);
+    if (rc == 0)
+        rc = tn_xdr_encode_var_array(stream, &tn_xdr_int32_descr, 3, row0);
+    if (rc == 0)
+        rc = tn_xdr_encode_var_array(stream, &tn_xdr_int32_descr, 0, row0);
+    if (rc == 0)
+        rc = tn_xdr_encode_var_array(stream, &tn_xdr_int32_descr, 1, row2);
+    if (rc == 0)
+        rc = tn_xdr_encode_array(stream, &tn_xdr_uint64_descr, 3, stamps);
+    return rc;
+}
+
+static void
+test_check_message(const test_message *msg, uint32_t id)
+{
+    const test_point *points = msg->points.data;
+    const tn_xdr_vector *rows = msg->rows.data;
+
+    assert(msg->id == id);
+    assert(msg->points.len == 2);
+    assert(points[0].x == 1 && points[0].y == 2 && points[0].weight == 0.5);
+    assert(points[1].x == -3 && points[1].y == 4 && points[1].weight == 2.0);
+    assert(msg->rows.len == 3);
+    assert(rows[0].len == 3 && ((int32_t *)rows[0].data)[2] == 3);
+    assert(rows[1].len == 0);
+    assert(rows[2].len == 1 && ((int32_t *)rows[2].data)[0] == -1);
+    assert(msg->stamps[0] == 1 && msg->stamps[1] == UINT64_MAX &&
+           msg->stamps[2] == 0x123456789ull);
+}
+
+typedef struct test_socket_feed {
+    int fd;
+    const uint8_t *data;
+    size_t len;
+} test_socket_feed;
+
+static void *
+test_socket_feeder(void *arg)
+{
+    const test_socket_feed *feed = arg;
+    size_t i;
+
+    for (i = 0; i < feed->len; i++)
+        assert(write(feed->fd, feed->data + i, 1) == 1);
+    close(feed->fd);
+    return NULL;
+}
+
+static void test_resumable_decode(void)
+{
+    TEST_START;
+    uint8_t buffer[256];
+    tn_xdr_stream stream = TN_XDR_STREAM_STATIC_ARRAY(buffer);
+    tn_xdr_resumable state;
+    test_message msg;
+    test_socket_feed feed;
+    pthread_t feeder;
+    int fds[2];
+    size_t written;
+    size_t used;
+    unsigned nmsg = 0;
+    tn_status rc = EAGAIN;
+
+    assert(test_encode_message(&stream, 1) == 0);
+    assert(test_encode_message(&stream, 2) == 0);
+    written = tn_xdr_stream_pos(&stream);
+
+    /* Everything at once: the second message is left over */
+    tn_xdr_resumable_init(&state, &test_message_schema, &msg);
+    assert(tn_xdr_decode_resumable(&state, buffer, written, &used) == 0);
+    assert(used == written / 2);
+    test_check_message(&msg, 1);
+    assert(tn_xdr_decode_resumable(&state, buffer, written, &used) == 0);
+    assert(used == 0);
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    feed.fd = fds[1];
+    feed.data = buffer;
+    feed.len = written;
+    assert(pthread_create(&feeder, NULL, test_socket_feeder, &feed) == 0);
+
+    tn_xdr_resumable_init(&state, &test_message_schema, &msg);
+    for (;;)
+    {
+        struct pollfd pfd = {.fd = fds[0], .events = POLLIN, .revents = 0};
+        uint8_t chunk[1];
+        ssize_t got;
 
-#if DO_TESTS
+        assert(poll(&pfd, 1, -1) == 1);
+        got = read(fds[0], chunk, sizeof(chunk));
+        if (got < 0 && errno == EAGAIN)
+            continue;
+        assert(got >= 0);
+        if (got == 0)
+            break;
 
-#define CALL_BASIC_INTEROP(_suffix)             \
-    test_encode_##_suffix();                    \
-    test_decode_##_suffix()
+        rc = tn_xdr_decode_resumable(&state, chunk, (size_t)got, &used);
+        assert(used == (size_t)got);
+        if (rc == 0)
+        {
+            nmsg++;
+            test_check_message(&msg, nmsg);
+            tn_xdr_resumable_init(&state, &test_message_schema, &msg);
+            memset(&msg, 0, sizeof(msg));
+        }
+        else
+            assert(rc == EAGAIN);
+    }
+    assert(nmsg == 2);
+    assert(rc == 0);
+    assert(pthread_join(feeder, NULL) == 0);
+    close(fds[0]);
 
-#define CALL_UNSIGNED(_suffix)                  \
-    CALL_BASIC_INTEROP(_suffix);                \
-    test_decode_##_suffix##_max()
+}
 
-#define CALL_SIGNED(_suffix)                  \
-    CALL_UNSIGNED(_suffix);                   \
-    test_decode_##_suffix##_min()
+static tn_status
+test_decode_nested_elt(tn_xdr_stream * restrict stream, void * restrict data);
 
-#define CALL_UNSIGNED_OVR(_suffix)               \
-    CALL_UNSIGNED(_suffix);                      \
-    test_decode_##_suffix##_ovrmax()
+static const tn_xdr_element_descr test_nested_descr = {
+    .elsize = sizeof(tn_xdr_vector),
+    .encode = NULL,
+    .decode = test_decode_nested_elt,
+    .measure = NULL,
+    .fixed_size = 0
+};
 
-#define CALL_SIGNED_OVR(_suffix)                 \
-    CALL_SIGNED(_suffix);                        \
-    test_decode_##_suffix##_ovrmax();            \
-    test_decode_##_suffix##_ovrmin()
+static tn_status
+test_decode_nested_elt(tn_xdr_stream * restrict stream, void * restrict data)
+{
+    tn_xdr_vector *vec = data;
+
+    return tn_xdr_decode_var_array(stream, &test_nested_descr,
+                                   &vec->len, &vec->data);
+}
+
+static tn_status
+test_decode_empty_elt(unused tn_xdr_stream * restrict stream,
+                      unused void * restrict data)
+{
+    return 0;
+}
+
+static const tn_xdr_element_descr test_empty_descr = {
+    .elsize = 0,
+    .encode = NULL,
+    .decode = test_decode_empty_elt,
+    .measure = NULL,
+    .fixed_size = 0
+};
+
+static tn_status
+test_decode_cstring_elt(tn_xdr_stream * restrict stream, void * restrict data)
+{
+    return tn_xdr_decode_cstring(stream, data);
+}
+
+static const tn_xdr_element_descr test_cstring_descr = {
+    .elsize = sizeof(char *),
+    .encode = NULL,
+    .decode = test_decode_cstring_elt,
+    .measure = NULL,
+    .fixed_size = 0
+};
+static const tn_xdr_schema test_cstring_schema =
+    TN_XDR_SCHEMA_ELEMENT(test_cstring_descr, char *);
+
+#define TEST_NESTED_DEPTH 100
+#define TEST_LARGE_ARRAY_LEN 100000
+
+static void test_decode_budgets(void)
+{
+    TEST_START;
+    uint8_t short_array[] = {0, 0, 0, 4, 0, 0, 0, 1, 0, 0, 0, 2};
+    uint8_t huge_array[] = {0x40, 0, 0, 0, 0, 0, 0, 1};
+    uint8_t string[] = {0, 0, 0, 4, 'a', 'b', 'c', 'd'};
+    uint8_t long_string[20];
+    uint8_t nested[4 * (TEST_NESTED_DEPTH + 1)] = {0};
+    tn_xdr_resumable state;
+    tn_xdr_view view;
+    int32_t *ints = tn_alloc_blob(TEST_LARGE_ARRAY_LEN * sizeof(*ints));
+    int32_t *decoded = NULL;
+    tn_xdr_vector vec;
+    tn_xdr_stream stream;
+    FILE *tmp = tmpfile();
+    size_t len;
+    size_t total;
+    size_t used;
+    char *str;
+    unsigned i;
+
+    /* Lengths which cannot fit are rejected before allocating */
+    stream = TN_XDR_STREAM_STATIC_ARRAY(short_array);
+    tn_xdr_set_budgets(&stream, 0, TN_XDR_MAX_DEPTH);
+    assert(tn_xdr_decode_var_array(&stream, &tn_xdr_int32_descr,
+                                   &len, (void **)&decoded) == EPROTO);
+
+    assert(tn_xdr_charge_alloc(&stream, SIZE_MAX / 2 + 1, 2,
+                               &total) == EMSGSIZE);
+
+    /* Elements which take no bytes count as one byte */
+    stream = TN_XDR_STREAM_STATIC_ARRAY(string);
+    tn_xdr_set_budgets(&stream, 4, TN_XDR_MAX_DEPTH);
+    assert(tn_xdr_decode_var_array(&stream, &test_empty_descr,
+                                   &len, (void **)&decoded) == 0);
+    assert(len == 4);
+    assert(tn_xdr_stream_left(&stream) == 4);
+    assert(stream.alloc_left == 0);
+    stream = TN_XDR_STREAM_STATIC_ARRAY(string);
+    tn_xdr_set_budgets(&stream, 3, TN_XDR_MAX_DEPTH);
+    assert(tn_xdr_decode_var_array(&stream, &test_empty_descr,
+                                   &len, (void **)&decoded) == EMSGSIZE);
+
+    stream = TN_XDR_STREAM_STATIC_ARRAY(string);
+    tn_xdr_set_budgets(&stream, 4, TN_XDR_MAX_DEPTH);
+    assert(tn_xdr_decode_cstring(&stream, &str) == EMSGSIZE);
+    stream = TN_XDR_STREAM_STATIC_ARRAY(string);
+    tn_xdr_set_budgets(&stream, 5, TN_XDR_MAX_DEPTH);
+    assert(tn_xdr_decode_cstring(&stream, &str) == 0);
+    assert(strcmp(str, "abcd") == 0);
+    assert(stream.alloc_left == 0);
+
+    /* Streams of unknown length rely on the budget, and otherwise
+     * only allocate as much as has actually arrived */
+    assert(fwrite(huge_array, 4, 1, tmp) == 1);
+    assert(fflush(tmp) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_decode_var_bytes(&stream, &len,
+                                   (uint8_t **)&decoded) == ENOMSG);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_decode_cstring(&stream, &str) == ENOMSG);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_decode_var_bytes_view(&stream, &view) == ENOMSG);
+
+    assert(ftruncate(fileno(tmp), 0) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    assert(fwrite(huge_array, sizeof(huge_array), 1, tmp) == 1);
+    assert(fflush(tmp) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    tn_xdr_set_budgets(&stream, 1024 * 1024, TN_XDR_MAX_DEPTH);
+    assert(tn_xdr_decode_var_array(&stream, &tn_xdr_int64_descr,
+                                   &len, (void **)&decoded) == EMSGSIZE);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_decode_var_array(&stream, &tn_xdr_int32_descr,
+                                   &len, (void **)&decoded) == ENOMSG);
+
+    /* So does resumable decoding, which does not allocate
+     * for items that have not arrived */
+    tn_xdr_resumable_init(&state, &test_row_schema, &vec);
+    tn_xdr_resumable_set_budget(&state, 1024 * 1024);
+    assert(tn_xdr_decode_resumable(&state, huge_array, sizeof(huge_array),
+                                   &used) == EMSGSIZE);
+    tn_xdr_resumable_init(&state, &test_row_schema, &vec);
+    assert(tn_xdr_decode_resumable(&state, huge_array, sizeof(huge_array),
+                                   &used) == EAGAIN);
+    assert(vec.len == 0x40000000);
+    assert(((int32_t *)vec.data)[0] == 1);
+
+    /* Retries of an incomplete element are not charged again */
+    stream = TN_XDR_STREAM_STATIC_ARRAY(long_string);
+    assert(tn_xdr_encode_cstring(&stream, "0123456789abcdef") == 0);
+    tn_xdr_resumable_init(&state, &test_cstring_schema, &str);
+    tn_xdr_resumable_set_budget(&state, 64);
+    for (i = 0; i < sizeof(long_string) - 1; i++)
+    {
+        assert(tn_xdr_decode_resumable(&state, long_string + i, 1,
+                                       &used) == EAGAIN);
+    }
+    assert(tn_xdr_decode_resumable(&state, long_string + i, 1, &used) == 0);
+    assert(strcmp(str, "0123456789abcdef") == 0);
+    assert(state.alloc_left == 64 - 17);
+
+    /* A stalled element with a huge length is not allocated */
+    tn_xdr_resumable_init(&state, &test_cstring_schema, &str);
+    assert(tn_xdr_decode_resumable(&state, "\x7f\xff\xff\xf0", 4,
+                                   &used) == EAGAIN);
+    for (i = 0; i < 1000; i++)
+        assert(tn_xdr_decode_resumable(&state, "x", 1, &used) == EAGAIN);
+    assert(state.alloc_left == SIZE_MAX);
+
+    /* Large arrays grow piecewise */
+    for (i = 0; i < TEST_LARGE_ARRAY_LEN; i++)
+        ints[i] = (int32_t)i * 7;
+    assert(ftruncate(fileno(tmp), 0) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_encode_var_array(&stream, &tn_xdr_int32_descr,
+                                   TEST_LARGE_ARRAY_LEN, ints) == 0);
+    assert(tn_xdr_flush(&stream) == 0);
+    assert(lseek(fileno(tmp), 0, SEEK_SET) == 0);
+    stream = tn_xdr_fd_stream(fileno(tmp), 0);
+    assert(tn_xdr_decode_var_array(&stream, &tn_xdr_int32_descr,
+                                   &len, (void **)&decoded) == 0);
+    assert(len == TEST_LARGE_ARRAY_LEN);
+    assert(memcmp(decoded, ints, TEST_LARGE_ARRAY_LEN * sizeof(*ints)) == 0);
+    fclose(tmp);
+
+    for (i = 0; i < TEST_NESTED_DEPTH; i++)
+        nested[4 * i + 3] = 1;
+    stream = TN_XDR_STREAM_STATIC_ARRAY(nested);
+    assert(test_decode_nested_elt(&stream, &vec) == ELOOP);
+    assert(stream.depth_left == TN_XDR_MAX_DEPTH);
+    stream = TN_XDR_STREAM_STATIC_ARRAY(nested);
+    tn_xdr_set_budgets(&stream, SIZE_MAX, TEST_NESTED_DEPTH);
+    assert(test_decode_nested_elt(&stream, &vec) == 0);
+    assert(vec.len == 1);
+    assert(tn_xdr_stream_left(&stream) == 0);
+}
+
+#define TEST_PARALLEL_INTS 300000
+#define TEST_PARALLEL_POINTS 100000
+
+static void test_parallel_encode(void)
+{
+    TEST_START;
+    size_t size = TEST_PARALLEL_INTS * sizeof(int32_t) +
+        TEST_PARALLEL_POINTS * TN_XDR_SIZE_test_point;
+    uint8_t *serial = tn_alloc_blob(size);
+    uint8_t *parallel = tn_alloc_blob(size);
+    int32_t *ints = tn_alloc_blob(TEST_PARALLEL_INTS * sizeof(*ints));
+    test_point *points = tn_alloc_blob(TEST_PARALLEL_POINTS *
+                                       sizeof(*points));
+    int32_t *decoded = tn_alloc_blob(TEST_PARALLEL_INTS * sizeof(*ints));
+    tn_xdr_element_descr liar = tn_xdr_int32_descr;
+    tn_xdr_stream stream;
+    size_t i;
+
+    for (i = 0; i < TEST_PARALLEL_INTS; i++)
+        ints[i] = (int32_t)(i * 2654435761u);
+    for (i = 0; i < TEST_PARALLEL_POINTS; i++)
+        points[i] = (test_point){(int32_t)i, -(int32_t)i, (double)i / 3};
+
+    tn_xdr_set_encode_threads(1);
+    stream = tn_xdr_mem_stream(serial, size);
+    assert(tn_xdr_encode_array(&stream, &tn_xdr_int32_descr,
+                               TEST_PARALLEL_INTS, ints) == 0);
+    assert(tn_xdr_encode_array(&stream, &test_point_descr,
+                               TEST_PARALLEL_POINTS, points) == 0);
+    assert(tn_xdr_stream_left(&stream) == 0);
+
+    tn_xdr_set_encode_threads(4);
+    stream = tn_xdr_mem_stream(parallel, size);
+    assert(tn_xdr_encode_array(&stream, &tn_xdr_int32_descr,
+                               TEST_PARALLEL_INTS, ints) == 0);
+    assert(tn_xdr_encode_array(&stream, &test_point_descr,
+                               TEST_PARALLEL_POINTS, points) == 0);
+    assert(tn_xdr_stream_left(&stream) == 0);
+    assert(memcmp(serial, parallel, size) == 0);
+
+    stream = tn_xdr_mem_stream(parallel, size);
+    assert(tn_xdr_decode_array(&stream, &tn_xdr_int32_descr,
+                               TEST_PARALLEL_INTS, decoded) == 0);
+    assert(memcmp(decoded, ints, TEST_PARALLEL_INTS * sizeof(*ints)) == 0);
+
+    /* Descriptors must not lie about the size */
+    liar.fixed_size = 2 * sizeof(int32_t);
+    stream = tn_xdr_mem_stream(parallel, size);
+    assert(tn_xdr_encode_array(&stream, &liar,
+                               TEST_PARALLEL_INTS, ints) == EINVAL);
+    assert(tn_xdr_stream_pos(&stream) == 0);
+    tn_xdr_set_encode_threads(1);
+}
+
+#define TEST_CONTAINER_RECORDS 100
+
+static void test_container(void)
+{
+    TEST_START;
+    FILE *tmp = tmpfile();
+    tn_xdr_stream stream = tn_xdr_fd_stream(fileno(tmp), 64);
+    tn_xdr_container_writer writer;
+    tn_xdr_container container;
+    const tn_xdr_container_entry *entry;
+    tn_xdr_stream record;
+    tn_xdr_stream mapped;
+    test_point point;
+    char name[16];
+    char *str;
+    uint8_t *copy;
+    size_t size;
+    uint32_t i;
+
+    assert(tn_xdr_container_begin(&writer, &stream, 3) == EINVAL);
+    assert(tn_xdr_container_begin(&writer, &stream, 0) == 0);
+    for (i = 0; i < TEST_CONTAINER_RECORDS; i++)
+    {
+        point = (test_point){(int32_t)i, -(int32_t)i, (double)i / 2};
+        snprintf(name, sizeof(name), "rec%u", i);
+        assert(tn_xdr_container_start_record(&writer, i * 7,
+                                             i % 2 == 0 ? name : NULL) == 0);
+        assert(tn_xdr_encode_test_point(&stream, &point) == 0);
+        assert(tn_xdr_encode_cstring(&stream, name) == 0);
+        tn_xdr_container_end_record(&writer);
+    }
+    assert(tn_xdr_container_finish(&writer) == 0);
+
+    assert(tn_xdr_mmap_stream(&mapped, fileno(tmp)) == 0);
+    fclose(tmp);
+    assert(tn_xdr_container_open(&container, &mapped) == 0);
+    assert(container.count == TEST_CONTAINER_RECORDS);
+
+    entry = tn_xdr_container_find_id(&container, 42 * 7);
+    assert(entry != NULL);
+    assert(entry->offset % TN_XDR_CONTAINER_ALIGN == 0);
+    assert(strcmp(entry->name, "rec42") == 0);
+    record = tn_xdr_container_record(&container, entry);
+    assert(tn_xdr_decode_test_point(&record, &point) == 0);
+    assert(point.x == 42 && point.y == -42 && point.weight == 21.0);
+    assert(tn_xdr_decode_cstring(&record, &str) == 0);
+    assert(strcmp(str, "rec42") == 0);
+    assert(tn_xdr_stream_left(&record) == 0);
+    assert(tn_xdr_decode_uint32(&record, &i) == ENOMSG);
+    record = tn_xdr_container_record(&container, entry);
+    assert(tn_xdr_encode_uint32(&record, &i) == ENOSPC);
+
+    entry = tn_xdr_container_find_name(&container, "rec98");
+    assert(entry != NULL);
+    assert(entry->id == 98 * 7);
+    record = tn_xdr_container_record(&container, entry);
+    assert(tn_xdr_decode_test_point(&record, &point) == 0);
+    assert(point.x == 98);
+
+    assert(tn_xdr_container_find_id(&container, 1) == NULL);
+    assert(tn_xdr_container_find_name(&container, "rec99") == NULL);
+    assert(tn_xdr_container_find_name(&container, "") == NULL);
+    assert(tn_xdr_container_find_id(&container, 99 * 7)->name[0] == '\0');
+
+    /* Memory streams hold whole containers as well */
+    size = tn_xdr_stream_left(&mapped);
+    copy = tn_alloc_blob(size);
+    memcpy(copy, mapped.cur, size);
+    stream = tn_xdr_mem_stream(copy, size);
+    assert(tn_xdr_container_open(&container, &stream) == 0);
+    assert(tn_xdr_container_find_id(&container, 0)->offset ==
+           TN_XDR_CONTAINER_ALIGN);
+
+    stream = tn_xdr_mem_stream(copy, size - 1);
+    assert(tn_xdr_container_open(&container, &stream) == EPROTO);
+    copy[size - 20] ^= 1;
+    stream = tn_xdr_mem_stream(copy, size);
+    assert(tn_xdr_container_open(&container, &stream) == EBADMSG);
+    stream = tn_xdr_fd_stream(0, 0);
+    assert(tn_xdr_container_open(&container, &stream) == ENOTSUP);
+}
 
 int main()
 {
@@ -660,8 +4676,611 @@ int main()
 
     test_read_not_enough_data();
     test_write_not_enough_space();
-    
+    test_fd_stream();
+    test_fd_stream_short_reads();
+    test_mmap_stream();
+    test_iov_stream();
+    test_bulk_arrays();
+    test_compiled_schema();
+    test_sizeof();
+    test_compact_mode();
+    test_compressed_stream();
+    test_checksum_stream();
+    test_resumable_decode();
+    test_decode_budgets();
+    test_parallel_encode();
+    test_container();
+
     puts("OK");
     return 0;
 }
 #endif
+
+#if DO_BENCHMARKS
+/*
+ * Codec benchmarks process BENCH_COUNT elements per operation and
+ * report their timings per element, so that different types and
+ * backends are directly comparable; MB/s are of the encoded data
+ */
+#define BENCH_COUNT 1024
+#define BENCH_ARRAY_LEN 16384
+
+static bool_t
+bench_xdr_bool(XDR *xdrs, bool *data)
+{
+    bool_t val = *data;
+
+    if (!xdr_bool(xdrs, &val))
+        return FALSE;
+    *data = val != 0;
+    return TRUE;
+}
+
+static void
+bench_report_codec(const char *bench, const char *variant, size_t nelts,
+                   size_t bytes, unsigned long iters, double elapsed)
+{
+    char params[32];
+
+    snprintf(params, sizeof(params), "elements=%zu", nelts);
+    tn_bench_report_elements(bench, variant, params, bytes, nelts,
+                             iters, elapsed);
+}
+
+#define DEFINE_BENCH_PRIMITIVE(_suffix, _type, _xdrproc, _gen)          \
+    static size_t                                                       \
+    bench_encode_##_suffix(tn_xdr_stream *stream, const _type *values)  \
+    {                                                                   \
+        size_t i;                                                       \
+                                                                        \
+        for (i = 0; i < BENCH_COUNT; i++)                               \
+            (void)!tn_xdr_encode_##_suffix(stream, &values[i]);         \
+        return tn_xdr_stream_pos(stream);                               \
+    }                                                                   \
+                                                                        \
+    static size_t                                                       \
+    bench_decode_##_suffix(tn_xdr_stream *stream, _type *values)        \
+    {                                                                   \
+        size_t i;                                                       \
+                                                                        \
+        for (i = 0; i < BENCH_COUNT; i++)                               \
+            (void)!tn_xdr_decode_##_suffix(stream, &values[i]);         \
+        return tn_xdr_stream_pos(stream);                               \
+    }                                                                   \
+                                                                        \
+    static size_t                                                       \
+    bench_glibc_##_suffix(XDR *xdrs, _type *values)                     \
+    {                                                                   \
+        size_t i;                                                       \
+                                                                        \
+        for (i = 0; i < BENCH_COUNT; i++)                               \
+            (void)!_xdrproc(xdrs, &values[i]);                          \
+        return xdr_getpos(xdrs);                                        \
+    }                                                                   \
+                                                                        \
+    static void                                                         \
+    bench_##_suffix(void)                                               \
+    {                                                                   \
+        static _type values[BENCH_COUNT];                               \
+        static uint8_t buffer[BENCH_COUNT * TN_XDR_VARINT_MAX];         \
+        tn_xdr_stream stream;                                           \
+        XDR xdrs;                                                       \
+        unsigned long iters;                                            \
+        double elapsed;                                                 \
+        size_t len = 0;                                                 \
+        unsigned i;                                                     \
+                                                                        \
+        for (i = 0; i < BENCH_COUNT; i++)                               \
+            values[i] = (_gen);                                         \
+                                                                        \
+        TN_BENCH_RUN(iters, elapsed,                                    \
+                     stream = tn_xdr_mem_stream(buffer, sizeof(buffer)); \
+                     tn_bench_sink = len =                              \
+                     bench_encode_##_suffix(&stream, values));          \
+        bench_report_codec("encode_" #_suffix, "tn_xdr_mem",            \
+                           BENCH_COUNT, len, iters, elapsed);           \
+        TN_BENCH_RUN(iters, elapsed,                                    \
+                     stream = tn_xdr_mem_stream(buffer, len);           \
+                     tn_bench_sink =                                    \
+                     bench_decode_##_suffix(&stream, values));          \
+        bench_report_codec("decode_" #_suffix, "tn_xdr_mem",            \
+                           BENCH_COUNT, len, iters, elapsed);           \
+                                                                        \
+        TN_BENCH_RUN(iters, elapsed,                                    \
+                     stream = tn_xdr_mem_stream(buffer, sizeof(buffer)); \
+                     tn_xdr_set_compact(&stream, true);                 \
+                     tn_bench_sink = len =                              \
+                     bench_encode_##_suffix(&stream, values));          \
+        bench_report_codec("encode_" #_suffix, "tn_xdr_compact",        \
+                           BENCH_COUNT, len, iters, elapsed);           \
+        TN_BENCH_RUN(iters, elapsed,                                    \
+                     stream = tn_xdr_mem_stream(buffer, len);           \
+                     tn_xdr_set_compact(&stream, true);                 \
+                     tn_bench_sink =                                    \
+                     bench_decode_##_suffix(&stream, values));          \
+        bench_report_codec("decode_" #_suffix, "tn_xdr_compact",        \
+                           BENCH_COUNT, len, iters, elapsed);           \
+                                                                        \
+        TN_BENCH_RUN(iters, elapsed,                                    \
+                     xdrmem_create(&xdrs, (char *)buffer,               \
+                                   sizeof(buffer), XDR_ENCODE);         \
+                     tn_bench_sink = len =                              \
+                     bench_glibc_##_suffix(&xdrs, values));             \
+        bench_report_codec("encode_" #_suffix, "glibc_xdrmem",          \
+                           BENCH_COUNT, len, iters, elapsed);           \
+        TN_BENCH_RUN(iters, elapsed,                                    \
+                     xdrmem_create(&xdrs, (char *)buffer,               \
+                                   (unsigned)len, XDR_DECODE);          \
+                     tn_bench_sink =                                    \
+                     bench_glibc_##_suffix(&xdrs, values));             \
+        bench_report_codec("decode_" #_suffix, "glibc_xdrmem",          \
+                           BENCH_COUNT, len, iters, elapsed);           \
+    }                                                                   \
+    struct fake
+
+DEFINE_BENCH_PRIMITIVE(bool, bool, bench_xdr_bool, (i & 1) != 0);
+DEFINE_BENCH_PRIMITIVE(int8, int8_t, xdr_int8_t, (int8_t)(i * 37));
+DEFINE_BENCH_PRIMITIVE(uint8, uint8_t, xdr_uint8_t, (uint8_t)(i * 37));
+DEFINE_BENCH_PRIMITIVE(int16, int16_t, xdr_int16_t, (int16_t)(i * 997));
+DEFINE_BENCH_PRIMITIVE(uint16, uint16_t, xdr_uint16_t, (uint16_t)(i * 997));
+DEFINE_BENCH_PRIMITIVE(int32, int32_t, xdr_int32_t,
+                       (int32_t)(i * 2654435761u));
+DEFINE_BENCH_PRIMITIVE(uint32, uint32_t, xdr_uint32_t, i * 2654435761u);
+DEFINE_BENCH_PRIMITIVE(int64, int64_t, xdr_int64_t,
+                       (int64_t)(i * 0x9e3779b97f4a7c15ull));
+DEFINE_BENCH_PRIMITIVE(uint64, uint64_t, xdr_uint64_t,
+                       i * 0x9e3779b97f4a7c15ull);
+DEFINE_BENCH_PRIMITIVE(float, float, xdr_float, (float)i * 0.5f);
+DEFINE_BENCH_PRIMITIVE(double, double, xdr_double, (double)i * 0.25);
+
+/*
+ * Backends for the array, struct and var_bytes benchmarks.
+ * Streams for decoding read what the last encoding wrote
+ */
+typedef struct bench_io {
+    uint8_t *buffer;
+    size_t size;
+    size_t len;
+    FILE *file;
+    tn_xdr_stream inner;
+    tn_xdr_stream mapped;
+} bench_io;
+
+typedef struct bench_backend {
+    const char *name;
+    tn_xdr_stream (*open)(bench_io *io, bool writing);
+    /** Whether the backend can be used for writing */
+    bool writable;
+} bench_backend;
+
+static tn_xdr_stream
+bench_open_mem(bench_io *io, bool writing)
+{
+    return tn_xdr_mem_stream(io->buffer, writing ? io->size : io->len);
+}
+
+static tn_xdr_stream
+bench_open_compact(bench_io *io, bool writing)
+{
+    tn_xdr_stream stream = bench_open_mem(io, writing);
+
+    tn_xdr_set_compact(&stream, true);
+    return stream;
+}
+
+static tn_xdr_stream
+bench_open_checksum(bench_io *io, bool writing)
+{
+    io->inner = bench_open_mem(io, writing);
+    return tn_xdr_checksum_stream(&io->inner, 0);
+}
+
+static tn_xdr_stream
+bench_open_compressed(bench_io *io, bool writing)
+{
+    io->inner = bench_open_mem(io, writing);
+    return tn_xdr_compressed_stream(&io->inner, 0, false);
+}
+
+static tn_xdr_stream
+bench_open_fd(bench_io *io, unused bool writing)
+{
+    (void)!lseek(fileno(io->file), 0, SEEK_SET);
+    return tn_xdr_fd_stream(fileno(io->file), 0);
+}
+
+static tn_xdr_stream
+bench_open_mmap(bench_io *io, unused bool writing)
+{
+    return io->mapped;
+}
+
+static tn_xdr_stream
+bench_open_iov(unused bench_io *io, unused bool writing)
+{
+    return tn_xdr_iov_stream(0);
+}
+
+static const bench_backend bench_backends[] = {
+    {"tn_xdr_mem", bench_open_mem, true},
+    {"tn_xdr_compact", bench_open_compact, true},
+    {"tn_xdr_checksum", bench_open_checksum, true},
+    {"tn_xdr_compressed", bench_open_compressed, true},
+    {"tn_xdr_fd", bench_open_fd, true},
+    {"tn_xdr_mmap", bench_open_mmap, false},
+    {"tn_xdr_iov", bench_open_iov, true},
+};
+
+static void
+bench_io_init(bench_io *io, size_t size)
+{
+    io->size = size;
+    io->buffer = tn_alloc_blob(size);
+    io->len = 0;
+    io->file = tmpfile();
+}
+
+/* Makes the encoded data available to decoding streams */
+static void
+bench_io_commit(bench_io *io, const bench_backend *backend,
+                tn_xdr_stream *stream)
+{
+    (void)!tn_xdr_flush(stream);
+    if (backend->open == bench_open_fd)
+        (void)!tn_xdr_mmap_stream(&io->mapped, fileno(io->file));
+    else if (backend->open == bench_open_checksum ||
+             backend->open == bench_open_compressed)
+        io->len = tn_xdr_stream_pos(&io->inner);
+    else
+        io->len = tn_xdr_stream_pos(stream);
+}
+
+typedef tn_status (*bench_encoder)(tn_xdr_stream *stream, const void *data);
+typedef tn_status (*bench_decoder)(tn_xdr_stream *stream, void *data);
+typedef bool_t (*bench_xdrproc)(XDR *xdrs, void *data);
+
+/*
+ * Runs encoding and decoding of @a nelts elements through all
+ * the backends, and through glibc if @a xdrproc is not NULL
+ */
+static void
+bench_codec(const char *name, size_t nelts, size_t size,
+            bench_encoder encode, bench_decoder decode,
+            bench_xdrproc xdrproc, void *data)
+{
+    char encname[64];
+    char decname[64];
+    bench_io io;
+    unsigned long iters;
+    double elapsed;
+    size_t b;
+    XDR xdrs;
+
+    snprintf(encname, sizeof(encname), "encode_%s", name);
+    snprintf(decname, sizeof(decname), "decode_%s", name);
+    bench_io_init(&io, size);
+
+    for (b = 0; b < sizeof(bench_backends) / sizeof(*bench_backends); b++)
+    {
+        const bench_backend *backend = &bench_backends[b];
+        tn_xdr_stream stream;
+        size_t len = 0;
+
+        if (backend->writable)
+        {
+            TN_BENCH_RUN(iters, elapsed,
+                         stream = backend->open(&io, true);
+                         (void)!encode(&stream, data);
+                         (void)!tn_xdr_flush(&stream);
+                         tn_bench_sink = len = tn_xdr_stream_pos(&stream));
+            bench_report_codec(encname, backend->name, nelts, len,
+                               iters, elapsed);
+            /* The iov stream is write-only */
+            if (backend->open == bench_open_iov)
+                continue;
+            stream = backend->open(&io, true);
+            (void)!encode(&stream, data);
+            bench_io_commit(&io, backend, &stream);
+        }
+        else
+            len = io.mapped.limit;
+
+        TN_BENCH_RUN(iters, elapsed,
+                     stream = backend->open(&io, false);
+                     (void)!decode(&stream, data);
+                     tn_bench_sink = tn_xdr_stream_pos(&stream));
+        bench_report_codec(decname, backend->name, nelts, len,
+                           iters, elapsed);
+    }
+
+    if (xdrproc != NULL)
+    {
+        size_t len = 0;
+
+        TN_BENCH_RUN(iters, elapsed,
+                     xdrmem_create(&xdrs, (char *)io.buffer,
+                                   (unsigned)size, XDR_ENCODE);
+                     (void)!xdrproc(&xdrs, data);
+                     tn_bench_sink = len = xdr_getpos(&xdrs));
+        bench_report_codec(encname, "glibc_xdrmem", nelts, len,
+                           iters, elapsed);
+        TN_BENCH_RUN(iters, elapsed,
+                     xdrmem_create(&xdrs, (char *)io.buffer,
+                                   (unsigned)len, XDR_DECODE);
+                     (void)!xdrproc(&xdrs, data);
+                     tn_bench_sink = xdr_getpos(&xdrs));
+        bench_report_codec(decname, "glibc_xdrmem", nelts, len,
+                           iters, elapsed);
+    }
+    fclose(io.file);
+}
+
+static tn_status
+bench_encode_int32_array(tn_xdr_stream *stream, const void *data)
+{
+    return tn_xdr_encode_array(stream, &tn_xdr_int32_descr,
+                               BENCH_ARRAY_LEN, data);
+}
+
+static tn_status
+bench_decode_int32_array(tn_xdr_stream *stream, void *data)
+{
+    return tn_xdr_decode_array(stream, &tn_xdr_int32_descr,
+                               BENCH_ARRAY_LEN, data);
+}
+
+static bool_t
+bench_xdr_int32_array(XDR *xdrs, void *data)
+{
+    return xdr_vector(xdrs, data, BENCH_ARRAY_LEN, sizeof(int32_t),
+                      (xdrproc_t)xdr_int32_t);
+}
+
+static tn_status
+bench_encode_double_array(tn_xdr_stream *stream, const void *data)
+{
+    return tn_xdr_encode_array(stream, &tn_xdr_double_descr,
+                               BENCH_ARRAY_LEN, data);
+}
+
+static tn_status
+bench_decode_double_array(tn_xdr_stream *stream, void *data)
+{
+    return tn_xdr_decode_array(stream, &tn_xdr_double_descr,
+                               BENCH_ARRAY_LEN, data);
+}
+
+static bool_t
+bench_xdr_double_array(XDR *xdrs, void *data)
+{
+    return xdr_vector(xdrs, data, BENCH_ARRAY_LEN, sizeof(double),
+                      (xdrproc_t)xdr_double);
+}
+
+static void
+bench_arrays(void)
+{
+    int32_t *ints = tn_alloc_blob(BENCH_ARRAY_LEN * sizeof(*ints));
+    double *dbls = tn_alloc_blob(BENCH_ARRAY_LEN * sizeof(*dbls));
+    size_t i;
+
+    for (i = 0; i < BENCH_ARRAY_LEN; i++)
+    {
+        ints[i] = (int32_t)(i * 2654435761u);
+        dbls[i] = (double)i * 0.25;
+    }
+    bench_codec("int32_array", BENCH_ARRAY_LEN,
+                BENCH_ARRAY_LEN * TN_XDR_VARINT_MAX,
+                bench_encode_int32_array, bench_decode_int32_array,
+                bench_xdr_int32_array, ints);
+    bench_codec("double_array", BENCH_ARRAY_LEN,
+                BENCH_ARRAY_LEN * TN_XDR_VARINT_MAX,
+                bench_encode_double_array, bench_decode_double_array,
+                bench_xdr_double_array, dbls);
+}
+
+typedef struct bench_point {
+    int32_t x;
+    int32_t y;
+    double weight;
+} bench_point;
+
+#define BENCH_POINT_FIELDS(_) _(int32, x) _(int32, y) _(double, weight)
+TN_XDR_DEFINE_STRUCT(bench_point, bench_point, BENCH_POINT_FIELDS);
+
+typedef struct bench_shape {
+    uint32_t kind;
+    union {
+        bench_point point;
+        uint32_t radius;
+    } u;
+} bench_shape;
+
+#define BENCH_SHAPE_ARMS(_) _(0, bench_point, u.point) _(1, uint32, u.radius)
+TN_XDR_DEFINE_UNION(bench_shape, bench_shape, kind, BENCH_SHAPE_ARMS);
+
+static const tn_xdr_element_descr bench_point_fields[] = {
+    {sizeof(int32_t), xdr_encode_int32_elt, xdr_decode_int32_elt, NULL, 4},
+    {sizeof(int32_t), xdr_encode_int32_elt, xdr_decode_int32_elt, NULL, 4},
+    {sizeof(double), xdr_encode_double_elt, xdr_decode_double_elt, NULL, 8},
+};
+
+static bool_t
+bench_xdr_point(XDR *xdrs, bench_point *point)
+{
+    return xdr_int32_t(xdrs, &point->x) && xdr_int32_t(xdrs, &point->y) &&
+        xdr_double(xdrs, &point->weight);
+}
+
+static bool_t
+bench_xdr_shape(XDR *xdrs, bench_shape *shape)
+{
+    if (!xdr_uint32_t(xdrs, &shape->kind))
+        return FALSE;
+    switch (shape->kind)
+    {
+        case 0:
+            return bench_xdr_point(xdrs, &shape->u.point);
+        case 1:
+            return xdr_uint32_t(xdrs, &shape->u.radius);
+        default:
+            return FALSE;
+    }
+}
+
+#define DEFINE_BENCH_COMPOSITE(_name, _type, _encode, _decode, _xdrproc) \
+    static tn_status                                                    \
+    bench_encode_##_name(tn_xdr_stream *stream, const void *data)       \
+    {                                                                   \
+        const _type *values = data;                                     \
+        size_t i;                                                       \
+                                                                        \
+        for (i = 0; i < BENCH_COUNT; i++)                               \
+            (void)!_encode;                                             \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    static tn_status                                                    \
+    bench_decode_##_name(tn_xdr_stream *stream, void *data)             \
+    {                                                                   \
+        _type *values = data;                                           \
+        size_t i;                                                       \
+                                                                        \
+        for (i = 0; i < BENCH_COUNT; i++)                               \
+            (void)!_decode;                                             \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    static bool_t                                                       \
+    bench_xdr_##_name(XDR *xdrs, void *data)                            \
+    {                                                                   \
+        _type *values = data;                                           \
+        size_t i;                                                       \
+                                                                        \
+        for (i = 0; i < BENCH_COUNT; i++)                               \
+        {                                                               \
+            if (!_xdrproc(xdrs, &values[i]))                            \
+                return FALSE;                                           \
+        }                                                               \
+        return TRUE;                                                    \
+    }                                                                   \
+    struct fake
+
+DEFINE_BENCH_COMPOSITE(struct, bench_point,
+                       tn_xdr_encode_bench_point(stream, &values[i]),
+                       tn_xdr_decode_bench_point(stream, &values[i]),
+                       bench_xdr_point);
+DEFINE_BENCH_COMPOSITE(interpreted_struct, bench_point,
+                       tn_xdr_encode_struct(stream, 3, bench_point_fields,
+                                            &values[i]),
+                       tn_xdr_decode_struct(stream, 3, bench_point_fields,
+                                            &values[i]),
+                       bench_xdr_point);
+DEFINE_BENCH_COMPOSITE(union, bench_shape,
+                       tn_xdr_encode_bench_shape(stream, &values[i]),
+                       tn_xdr_decode_bench_shape(stream, &values[i]),
+                       bench_xdr_shape);
+
+static void
+bench_composites(void)
+{
+    bench_point *points = tn_alloc_blob(BENCH_COUNT * sizeof(*points));
+    bench_shape *shapes = tn_alloc_blob(BENCH_COUNT * sizeof(*shapes));
+    size_t size = BENCH_COUNT * 4 * TN_XDR_VARINT_MAX;
+    size_t i;
+
+    for (i = 0; i < BENCH_COUNT; i++)
+    {
+        points[i] = (bench_point){(int32_t)i, -(int32_t)i, (double)i};
+        shapes[i].kind = (uint32_t)(i & 1);
+        if (shapes[i].kind == 0)
+            shapes[i].u.point = points[i];
+        else
+            shapes[i].u.radius = (uint32_t)i;
+    }
+    bench_codec("struct", BENCH_COUNT, size, bench_encode_struct,
+                bench_decode_struct, bench_xdr_struct, points);
+    bench_codec("interpreted_struct", BENCH_COUNT, size,
+                bench_encode_interpreted_struct,
+                bench_decode_interpreted_struct,
+                bench_xdr_interpreted_struct, points);
+    bench_codec("union", BENCH_COUNT, size, bench_encode_union,
+                bench_decode_union, bench_xdr_union, shapes);
+}
+
+/* A single opaque blob, whose size is set by bench_var_bytes() */
+static size_t bench_blob_len;
+
+static tn_status
+bench_encode_blob(tn_xdr_stream *stream, const void *data)
+{
+    return tn_xdr_encode_var_bytes(stream, bench_blob_len, data);
+}
+
+static tn_status
+bench_decode_blob(tn_xdr_stream *stream, void *data)
+{
+    tn_xdr_view view;
+    tn_status rc = tn_xdr_decode_var_bytes_view(stream, &view);
+
+    if (rc == 0 && view.owner != view.data)
+        memcpy(data, view.data, view.len);
+    return rc;
+}
+
+static bool_t
+bench_xdr_blob(XDR *xdrs, void *data)
+{
+    char *ptr = data;
+    unsigned len = (unsigned)bench_blob_len;
+
+    return xdr_bytes(xdrs, &ptr, &len, len);
+}
+
+/*
+ * Views are copied out unless they are copies already,
+ * so that all backends deliver the data into the same buffer
+ */
+static void
+bench_var_bytes(void)
+{
+    static const size_t sizes[] = {16, 256, 4096, 65536, 1048576};
+    size_t i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        uint8_t *blob = tn_alloc_blob(sizes[i]);
+        char name[32];
+        size_t k;
+
+        for (k = 0; k < sizes[i]; k++)
+            blob[k] = (uint8_t)(k * 31 + (k >> 8));
+        bench_blob_len = sizes[i];
+        snprintf(name, sizeof(name), "var_bytes_%zu", sizes[i]);
+        bench_codec(name, 1, sizes[i] + sizes[i] / 128 + 64, bench_encode_blob,
+                    bench_decode_blob, bench_xdr_blob, blob);
+    }
+}
+
+int main()
+{
+    GC_INIT();
+    puts(TN_BENCH_CSV_HEADER);
+    bench_bool();
+    bench_int8();
+    bench_uint8();
+    bench_int16();
+    bench_uint16();
+    bench_int32();
+    bench_uint32();
+    bench_int64();
+    bench_uint64();
+    bench_float();
+    bench_double();
+    bench_arrays();
+    bench_composites();
+    bench_var_bytes();
+
+    return 0;
+}
+#endif
@@ -35,55 +35,197 @@ extern "C"
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 #include "compiler.h"
 #include "status.h"
 
+/**
+ * A view of decoded bytes which may point directly into
+ * the stream's storage instead of being copied
+ */
+typedef struct tn_xdr_view {
+    const uint8_t *data;
+    size_t len;
+    /**
+     * An object which keeps the viewed memory alive as long as it
+     * is reachable, or NULL if the memory is owned by the caller
+     * of the stream (as for static array streams)
+     */
+    const void *owner;
+} tn_xdr_view;
+
+/**
+ * Encoders and decoders work directly on a contiguous window of
+ * the stream between `cur` and `end`; the window never extends past
+ * `limit`. `start` is the beginning of the window, which corresponds
+ * to the stream position `base`. Data are only written between `cur`
+ * and `write_end`, which is the same as `end` for writable windows
+ * and `start` for windows that must not be written to, such as
+ * read-only mappings.
+ *
+ * The `reader` and `writer` are only called when the window has not
+ * enough data or space, but the stream limit has not been reached.
+ * They must transfer the whole request, including whatever remains
+ * in the window, and may set up a new window.
+ */
 typedef struct tn_xdr_stream {
     tn_status (*reader)(struct tn_xdr_stream * restrict,
                         void * restrict , size_t);
     tn_status (*writer)(struct tn_xdr_stream * restrict,
                         const void * restrict, size_t);
+    /**
+     * Pushes buffered output to the underlying medium.
+     * May be NULL for unbuffered streams
+     */
+    tn_status (*flush)(struct tn_xdr_stream *);
+    /**
+     * Returns a view of the next bytes of the stream without copying
+     * and advances past them. It is only called when the stream
+     * has enough data left. May be NULL, then views are made from copies
+     */
+    tn_status (*viewer)(struct tn_xdr_stream * restrict, size_t,
+                        tn_xdr_view * restrict);
+    /**
+     * Writes opaque data, possibly by keeping a reference to it
+     * instead of copying. It is only called when the stream has
+     * enough space left. May be NULL, then the data are written
+     */
+    tn_status (*referrer)(struct tn_xdr_stream * restrict,
+                          const void * restrict, size_t);
 
     void *data;
-    size_t pos;
+    uint8_t *start;
+    uint8_t *cur;
+    uint8_t *end;
+    uint8_t *write_end;
+    size_t base;
     size_t limit;
+    /**
+     * Use the compact encoding: integers and lengths are LEB128
+     * varints (zigzag-encoded if signed), and opaque data are
+     * not padded. Floating-point numbers are the same as in XDR
+     */
+    bool compact;
+    /**
+     * How many more bytes decoders may allocate, so that hostile
+     * lengths fail with EMSGSIZE before anything is allocated
+     */
+    size_t alloc_left;
+    /**
+     * How many more levels of structs, unions and arrays decoders
+     * may nest into before failing with ELOOP
+     */
+    unsigned depth_left;
 } tn_xdr_stream;
 
+/**
+ * The default nesting limit of decoding
+ */
+#define TN_XDR_MAX_DEPTH 64
+
+/**
+ * @return The current position of the stream
+ */
 warn_unused_result
 warn_any_null_arg
-extern tn_status tn_xdr_read_from_stream(tn_xdr_stream * restrict stream,
-                                         void * restrict dest, size_t sz);
+hint_no_side_effects
+static inline size_t
+tn_xdr_stream_pos(const tn_xdr_stream *stream)
+{
+    return stream->base + (size_t)(stream->cur - stream->start);
+}
 
+/**
+ * @return The number of bytes that may be read or written
+ * before the stream limit is reached
+ */
+warn_unused_result
+warn_any_null_arg
+hint_no_side_effects
+static inline size_t
+tn_xdr_stream_left(const tn_xdr_stream *stream)
+{
+    return stream->limit - tn_xdr_stream_pos(stream);
+}
+
+/**
+ * @return The number of bytes that may be written to the window
+ */
+warn_unused_result
+warn_any_null_arg
+hint_no_side_effects
+static inline size_t
+tn_xdr_write_room(const tn_xdr_stream *stream)
+{
+    return stream->write_end > stream->cur ?
+        (size_t)(stream->write_end - stream->cur) : 0;
+}
+
+/**
+ * The slow paths of tn_xdr_read_from_stream() and
+ * tn_xdr_write_to_stream(), going through the stream's reader or writer
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_read_from_backend(tn_xdr_stream * restrict stream,
+                                          void * restrict dest, size_t sz);
+
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_write_to_backend(tn_xdr_stream * restrict stream,
+                                         const void * restrict dest,
+                                         size_t sz);
 
 warn_unused_result
 warn_any_null_arg
-extern tn_status tn_xdr_write_to_stream(tn_xdr_stream * restrict stream,
-                                        const void * restrict dest,
-                                        size_t sz);
+static inline tn_status
+tn_xdr_read_from_stream(tn_xdr_stream * restrict stream,
+                        void * restrict dest, size_t sz)
+{
+    if ((size_t)(stream->end - stream->cur) < sz)
+        return tn_xdr_read_from_backend(stream, dest, sz);
+
+    memcpy(dest, stream->cur, sz);
+    stream->cur += sz;
+    return 0;
+}
 
 warn_unused_result
 warn_any_null_arg
 static inline tn_status
-tn_xdr_mem_reader(tn_xdr_stream * restrict stream, void * restrict dest,
-                  size_t sz)
+tn_xdr_write_to_stream(tn_xdr_stream * restrict stream,
+                       const void * restrict dest, size_t sz)
 {
-    memcpy(dest, stream->data, sz);
-    stream->data = (uint8_t *)stream->data + sz;
+    if (tn_xdr_write_room(stream) < sz)
+        return tn_xdr_write_to_backend(stream, dest, sz);
+
+    memcpy(stream->cur, dest, sz);
+    stream->cur += sz;
     return 0;
 }
 
+/**
+ * A viewer for streams whose window covers all their data;
+ * the owner of the views is the stream's `data`
+ */
 warn_unused_result
 warn_any_null_arg
 static inline tn_status
-tn_xdr_mem_writer(tn_xdr_stream * restrict stream,
-                  const void * restrict dest, size_t sz)
+tn_xdr_window_viewer(tn_xdr_stream * restrict stream, size_t sz,
+                     tn_xdr_view * restrict view)
 {
-    memcpy(stream->data, dest, sz);
-    stream->data = (uint8_t *)stream->data + sz;
+    if ((size_t)(stream->end - stream->cur) < sz)
+        return ENOMSG;
+
+    view->data = stream->cur;
+    view->len = sz;
+    view->owner = stream->data;
+    stream->cur += sz;
     return 0;
 }
 
@@ -105,15 +247,185 @@ tn_xdr_dummy_writer(unused tn_xdr_stream * restrict stream,
     return ENOSPC;
 }
 
-#define TN_XDR_STREAM_STATIC_ARRAY(_array) \
-    ((tn_xdr_stream) {                     \
-            .reader = tn_xdr_mem_reader,   \
-            .writer = tn_xdr_mem_writer,   \
-            .data = (_array),              \
-            .pos = 0,                      \
-            .limit = sizeof(_array)        \
+#define TN_XDR_STREAM_STATIC_ARRAY(_array)                      \
+    ((tn_xdr_stream) {                                          \
+            .reader = tn_xdr_dummy_reader,                      \
+            .writer = tn_xdr_dummy_writer,                      \
+            .flush = NULL,                                      \
+            .viewer = tn_xdr_window_viewer,                     \
+            .referrer = NULL,                                   \
+            .compact = false,                                   \
+            .alloc_left = SIZE_MAX,                             \
+            .depth_left = TN_XDR_MAX_DEPTH,                     \
+            .data = NULL,                                       \
+            .start = (uint8_t *)(_array),                       \
+            .cur = (uint8_t *)(_array),                         \
+            .end = (uint8_t *)(_array) + sizeof(_array),        \
+            .write_end = (uint8_t *)(_array) + sizeof(_array),  \
+            .base = 0,                                          \
+            .limit = sizeof(_array)                             \
             })
 
+/**
+ * Creates a stream over a buffer of @a size bytes.
+ * If the size is computed with tn_xdr_sizeof() (or
+ * tn_xdr_sizeof_compact() for compact streams), encoding into
+ * the stream never leaves the inline fast path
+ */
+warn_unused_result
+static inline tn_xdr_stream
+tn_xdr_mem_stream(void *buffer, size_t size)
+{
+    return (tn_xdr_stream){
+        .reader = tn_xdr_dummy_reader,
+        .writer = tn_xdr_dummy_writer,
+        .flush = NULL,
+        .viewer = tn_xdr_window_viewer,
+        .referrer = NULL,
+        .compact = false,
+        .alloc_left = SIZE_MAX,
+        .depth_left = TN_XDR_MAX_DEPTH,
+        .data = NULL,
+        .start = buffer,
+        .cur = buffer,
+        .end = (uint8_t *)buffer + size,
+        .write_end = (uint8_t *)buffer + size,
+        .base = 0,
+        .limit = size
+    };
+}
+
+/**
+ * The default buffer size for tn_xdr_fd_stream()
+ */
+#define TN_XDR_FD_BUFSIZE (64 * 1024)
+
+/**
+ * Creates a stream reading from or writing to a file descriptor
+ * through a buffer of @a bufsize bytes (TN_XDR_FD_BUFSIZE if 0).
+ * Transfers larger than the buffer bypass it. Interrupted system calls
+ * are restarted, and short reads and writes are continued.
+ *
+ * A stream may be used either for reading or for writing, but not both.
+ * Written data must be pushed out by tn_xdr_flush(), it is not
+ * flushed automatically when the stream is garbage-collected.
+ * The file descriptor is never closed by the stream
+ */
+warn_unused_result
+extern tn_xdr_stream tn_xdr_fd_stream(int fd, size_t bufsize);
+
+warn_unused_result
+warn_any_null_arg
+static inline tn_status
+tn_xdr_flush(tn_xdr_stream *stream)
+{
+    return stream->flush == NULL ? 0 : stream->flush(stream);
+}
+
+/**
+ * The default size of opaque data which tn_xdr_iov_stream()
+ * references instead of copying
+ */
+#define TN_XDR_IOV_THRESHOLD 512
+
+/**
+ * Creates a write-only stream which collects encoded data into
+ * a list of I/O vectors. Opaque data and strings of at least
+ * @a threshold bytes (TN_XDR_IOV_THRESHOLD if 0) are not copied,
+ * the vectors point to the caller's memory, which must stay
+ * unchanged until the data are written out; everything else
+ * is copied into buffers owned by the stream
+ */
+warn_unused_result
+extern tn_xdr_stream tn_xdr_iov_stream(size_t threshold);
+
+/**
+ * Returns the I/O vectors collected so far by a stream created
+ * with tn_xdr_iov_stream(). The stream may be written to afterwards,
+ * but that invalidates the vectors
+ */
+warn_any_null_arg
+extern void tn_xdr_iov_get(tn_xdr_stream * restrict stream,
+                           const struct iovec ** restrict iov,
+                           size_t * restrict count);
+
+/**
+ * Writes the data collected by a stream created with
+ * tn_xdr_iov_stream() to @a fd, restarting interrupted and
+ * continuing short writes. The collected vectors are then discarded,
+ * so the stream may be reused
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_iov_writev(tn_xdr_stream *stream, int fd);
+
+/**
+ * Updates a CRC32C (Castagnoli) of data, starting with @a crc
+ * being 0. The hardware instruction is used when available
+ */
+warn_unused_result
+extern uint32_t tn_xdr_crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * The default block size for tn_xdr_checksum_stream()
+ */
+#define TN_XDR_CHECKSUM_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Creates a stream which protects data passing through it
+ * with CRC32C checksums, using @a inner for the framed data.
+ * Data are cut into frames of at most @a block_size bytes
+ * (TN_XDR_CHECKSUM_BLOCK_SIZE if 0), each followed by
+ * a CRC of all the data so far. When reading, a mismatch
+ * is reported as EBADMSG, and frames larger than @a block_size
+ * as EPROTO. Frames are viewed in place if @a inner has a viewer.
+ * Since each CRC covers all the preceding frames, dropped or
+ * reordered frames are detected as well. Flushing and the direction
+ * of use are the same as for tn_xdr_compressed_stream()
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_xdr_stream tn_xdr_checksum_stream(tn_xdr_stream *inner,
+                                            size_t block_size);
+
+/**
+ * The default block size for tn_xdr_compressed_stream()
+ */
+#define TN_XDR_COMPRESS_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Creates a stream which compresses data written to it and
+ * decompresses data read from it, using @a inner for the compressed
+ * data. The data are cut into blocks of @a block_size bytes
+ * (TN_XDR_COMPRESS_BLOCK_SIZE if 0), which are compressed with
+ * an LZ4-style compressor and framed; incompressible blocks are
+ * stored as is. If @a checksums is true, frames also carry
+ * a CRC32C checksum, which is then verified when reading.
+ *
+ * As with tn_xdr_fd_stream(), a stream is used either for reading
+ * or for writing, and written data must be pushed out with
+ * tn_xdr_flush(), which flushes @a inner as well. When reading,
+ * frames larger than @a block_size are rejected with EPROTO,
+ * corrupted frames with EPROTO or EBADMSG
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_xdr_stream tn_xdr_compressed_stream(tn_xdr_stream *inner,
+                                              size_t block_size,
+                                              bool checksums);
+
+/**
+ * Creates a read-only stream over the whole contents of a file
+ * mapped into memory. Views decoded from the stream point directly
+ * into the mapping, which is kept until the stream and all views
+ * are garbage-collected. The file descriptor may be closed afterwards
+ *
+ * @return 0 or an errno value from fstat() or mmap()
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_mmap_stream(tn_xdr_stream *stream, int fd);
+
 typedef tn_status (*warn_unused_result warn_any_null_arg tn_xdr_encoder)(
         tn_xdr_stream * restrict,
         const void * restrict);
@@ -122,12 +434,98 @@ typedef tn_status (*warn_unused_result warn_any_null_arg tn_xdr_decoder)(
         tn_xdr_stream * restrict,
         void * restrict);
 
+/**
+ * Switches the stream to or from the compact encoding
+ * (see tn_xdr_stream::compact). Both sides must agree on that,
+ * the encoding is not recorded in the stream
+ */
+warn_any_null_arg
+static inline void
+tn_xdr_set_compact(tn_xdr_stream *stream, bool compact)
+{
+    stream->compact = compact;
+}
+
+/**
+ * Limits the memory decoders may allocate from the stream to
+ * @a alloc bytes in total, and the nesting of decoded structs,
+ * unions and arrays to @a depth levels. Streams are created
+ * with no allocation limit and TN_XDR_MAX_DEPTH
+ */
+warn_any_null_arg
+static inline void
+tn_xdr_set_budgets(tn_xdr_stream *stream, size_t alloc, unsigned depth)
+{
+    stream->alloc_left = alloc;
+    stream->depth_left = depth;
+}
+
+/**
+ * Charges @a nelts items of @a elsize bytes against the allocation
+ * budget of the stream, and stores their total size in @a total.
+ * Decoders which allocate memory should call it before allocating
+ *
+ * @return 0 or EMSGSIZE if the size overflows or exceeds the budget
+ */
+warn_unused_result
+warn_any_null_arg
+static inline tn_status
+tn_xdr_charge_alloc(tn_xdr_stream * restrict stream, size_t nelts,
+                    size_t elsize, size_t * restrict total)
+{
+    if (__builtin_mul_overflow(nelts, elsize, total) ||
+        *total > stream->alloc_left)
+        return EMSGSIZE;
+
+    stream->alloc_left -= *total;
+    return 0;
+}
+
+/** The maximum size of a 64-bit varint */
+#define TN_XDR_VARINT_MAX 10
+
+warn_unused_result
+hint_no_shared_state
+static inline uint64_t
+tn_xdr_zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+warn_unused_result
+hint_no_shared_state
+static inline int64_t
+tn_xdr_unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * Encodes and decodes a LEB128 varint regardless of the stream
+ * encoding. Decoding fails with EPROTO for varints longer than
+ * TN_XDR_VARINT_MAX or overflowing 64 bits
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_encode_varint(tn_xdr_stream * restrict stream,
+                                      uint64_t value);
+
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_decode_varint(tn_xdr_stream * restrict stream,
+                                      uint64_t * restrict value);
+
 warn_unused_result warn_any_null_arg
 static inline tn_status
 tn_xdr_encode_int32(tn_xdr_stream * restrict stream,
                     const int32_t * restrict data)
 {
-    int32_t val = (int32_t)htonl((uint32_t)*data);
+    int32_t val;
+
+    if (stream->compact)
+        return tn_xdr_encode_varint(stream, tn_xdr_zigzag(*data));
+
+    val = (int32_t)htonl((uint32_t)*data);
     return tn_xdr_write_to_stream(stream, &val, sizeof(val));
 }
 
@@ -136,8 +534,24 @@ static inline tn_status
 tn_xdr_decode_int32(tn_xdr_stream * restrict stream, int32_t * restrict data) 
 {
     int32_t val;
-    tn_status rc = tn_xdr_read_from_stream(stream, &val, sizeof(val));
-    
+    tn_status rc;
+
+    if (stream->compact)
+    {
+        uint64_t var;
+        int64_t sval;
+
+        rc = tn_xdr_decode_varint(stream, &var);
+        if (rc != 0)
+            return rc;
+        sval = tn_xdr_unzigzag(var);
+        if (sval < INT32_MIN || sval > INT32_MAX)
+            return EOVERFLOW;
+        *data = (int32_t)sval;
+        return 0;
+    }
+
+    rc = tn_xdr_read_from_stream(stream, &val, sizeof(val));
     if (rc != 0)
         return rc;
     *data = (int32_t)ntohl((uint32_t)val);
@@ -149,7 +563,12 @@ static inline tn_status
 tn_xdr_encode_uint32(tn_xdr_stream * restrict stream,
                      const uint32_t * restrict data)
 {
-    uint32_t val = htonl(*data);
+    uint32_t val;
+
+    if (stream->compact)
+        return tn_xdr_encode_varint(stream, *data);
+
+    val = htonl(*data);
     return tn_xdr_write_to_stream(stream, &val, sizeof(val));
 }
 
@@ -160,8 +579,22 @@ tn_xdr_decode_uint32(tn_xdr_stream * restrict stream,
                      uint32_t * restrict data)
 {
     uint32_t val;
-    tn_status rc = tn_xdr_read_from_stream(stream, &val, sizeof(val));
-    
+    tn_status rc;
+
+    if (stream->compact)
+    {
+        uint64_t var;
+
+        rc = tn_xdr_decode_varint(stream, &var);
+        if (rc != 0)
+            return rc;
+        if (var > UINT32_MAX)
+            return EOVERFLOW;
+        *data = (uint32_t)var;
+        return 0;
+    }
+
+    rc = tn_xdr_read_from_stream(stream, &val, sizeof(val));
     if (rc != 0)
         return rc;
     *data = ntohl(val);
@@ -188,6 +621,8 @@ warn_any_null_arg
 extern tn_status tn_xdr_decode_uint64(tn_xdr_stream * restrict stream,
                                       uint64_t * restrict data);
 
+/* Floating-point numbers are never varints, so they do not go
+ * through the integer encoders */
 warn_unused_result warn_any_null_arg
 static inline tn_status
 tn_xdr_encode_float(tn_xdr_stream * restrict stream,
@@ -195,7 +630,8 @@ tn_xdr_encode_float(tn_xdr_stream * restrict stream,
 {
     uint32_t tmp;
     memcpy(&tmp, data, sizeof(tmp));
-    return tn_xdr_encode_uint32(stream, &tmp);
+    tmp = htonl(tmp);
+    return tn_xdr_write_to_stream(stream, &tmp, sizeof(tmp));
 }
 
 warn_unused_result warn_any_null_arg
@@ -204,9 +640,10 @@ tn_xdr_decode_float(tn_xdr_stream * restrict stream, float * restrict data)
 {
     tn_status rc;
     uint32_t tmp;
-    rc = tn_xdr_decode_uint32(stream, &tmp);
+    rc = tn_xdr_read_from_stream(stream, &tmp, sizeof(tmp));
     if (rc != 0)
         return rc;
+    tmp = ntohl(tmp);
     memcpy(data, &tmp, sizeof(tmp));
     return 0;
 }
@@ -217,8 +654,12 @@ tn_xdr_encode_double(tn_xdr_stream * restrict stream,
                      const double * restrict data)
 {
     uint64_t tmp;
+    uint32_t halves[2];
+
     memcpy(&tmp, data, sizeof(tmp));
-    return tn_xdr_encode_uint64(stream, &tmp);
+    halves[0] = htonl((uint32_t)(tmp >> 32));
+    halves[1] = htonl((uint32_t)(tmp & 0xffffffffu));
+    return tn_xdr_write_to_stream(stream, halves, sizeof(halves));
 }
 
 warn_unused_result warn_any_null_arg
@@ -227,9 +668,12 @@ tn_xdr_decode_double(tn_xdr_stream * restrict stream, double * restrict data)
 {
     tn_status rc;
     uint64_t tmp;
-    rc = tn_xdr_decode_uint64(stream, &tmp);
+    uint32_t halves[2];
+
+    rc = tn_xdr_read_from_stream(stream, halves, sizeof(halves));
     if (rc != 0)
         return rc;
+    tmp = ((uint64_t)ntohl(halves[0]) << 32) | ntohl(halves[1]);
     memcpy(data, &tmp, sizeof(tmp));
     return 0;
 }
@@ -284,13 +728,77 @@ warn_any_null_arg
 extern tn_status tn_xdr_decode_cstring(tn_xdr_stream * restrict stream,
                                        char ** restrict str);
 
+/**
+ * The same as tn_xdr_decode_bytes(), but returns a view of the data,
+ * which is not copied if the stream supports that
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_decode_bytes_view(tn_xdr_stream * restrict stream,
+                                          size_t len,
+                                          tn_xdr_view * restrict view);
+
+/**
+ * The same as tn_xdr_decode_var_bytes(), but returns a view of
+ * the data. Strings are encoded the same way as variable-length bytes,
+ * but note that a view of a string is generally not NUL-terminated
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_decode_var_bytes_view(tn_xdr_stream * restrict stream,
+                                              tn_xdr_view * restrict view);
+
+
+/**
+ * Adds the exact size of a value in the standard encoding
+ * to the second argument
+ */
+typedef tn_status (*warn_unused_result warn_any_null_arg tn_xdr_measurer)(
+        const void * restrict,
+        size_t * restrict);
 
 typedef struct tn_xdr_element_descr {
     size_t elsize;
     tn_xdr_encoder encode;
     tn_xdr_decoder decode;
+    /**
+     * May be NULL, then the size is found by running
+     * the encoder without storing anything
+     */
+    tn_xdr_measurer measure;
+    /**
+     * The encoded size of every element if it is always the same,
+     * otherwise 0. Large arrays of fixed-size elements may be encoded
+     * in parallel (see tn_xdr_set_encode_threads()), so the encoders
+     * of such descriptors must be thread-safe and must not allocate
+     * GC memory: the pool threads are not registered with the collector
+     */
+    size_t fixed_size;
 } tn_xdr_element_descr;
 
+/**
+ * Sets the number of threads, including the calling one, which
+ * encode large arrays of fixed-size elements into a stream window
+ * that can hold the whole array. 1 (the default) disables parallel
+ * encoding, 0 uses as many threads as there are online CPUs.
+ * Only descriptors with a nonzero `fixed_size` are encoded
+ * in parallel; see tn_xdr_element_descr::fixed_size for what their
+ * encoders must not do
+ */
+extern void tn_xdr_set_encode_threads(unsigned nthreads);
+
+/**
+ * Descriptors for the built-in numeric types.
+ * Arrays of these are encoded and decoded in bulk
+ * by tn_xdr_encode_array() and tn_xdr_decode_array()
+ */
+extern const tn_xdr_element_descr tn_xdr_int32_descr;
+extern const tn_xdr_element_descr tn_xdr_uint32_descr;
+extern const tn_xdr_element_descr tn_xdr_int64_descr;
+extern const tn_xdr_element_descr tn_xdr_uint64_descr;
+extern const tn_xdr_element_descr tn_xdr_float_descr;
+extern const tn_xdr_element_descr tn_xdr_double_descr;
+
 warn_unused_result
 warn_any_null_arg
 extern tn_status tn_xdr_encode_array(
@@ -322,6 +830,94 @@ extern tn_status tn_xdr_decode_var_array(
         size_t *len,
         void ** restrict data);
 
+/**
+ * @return The encoded size of @a len bytes of opaque data,
+ * including the padding
+ */
+warn_unused_result
+hint_no_shared_state
+static inline size_t
+tn_xdr_sizeof_bytes(size_t len)
+{
+    return (len + 3u) & ~(size_t)3u;
+}
+
+warn_unused_result
+hint_no_shared_state
+static inline size_t
+tn_xdr_sizeof_var_bytes(size_t len)
+{
+    return sizeof(uint32_t) + tn_xdr_sizeof_bytes(len);
+}
+
+warn_unused_result
+warn_any_null_arg
+hint_no_side_effects
+static inline size_t
+tn_xdr_sizeof_cstring(const char *str)
+{
+    return tn_xdr_sizeof_var_bytes(strlen(str));
+}
+
+/**
+ * Computes the exact encoded size of a value, so that an exactly
+ * sized buffer may be allocated before encoding.
+ * The sizes are those of the standard (not compact) encoding,
+ * see tn_xdr_sizeof_compact() for the compact one.
+ * The tn_xdr_sizeof_X() functions set @a size; they fail for the same
+ * invalid arguments as the corresponding encoders would
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_sizeof(const tn_xdr_element_descr * restrict elt,
+                               const void * restrict data,
+                               size_t * restrict size);
+
+/**
+ * The same as tn_xdr_sizeof() for the compact encoding. Measurers
+ * only know the standard encoding, so the value is always sized
+ * by running its encoder
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_sizeof_compact(
+        const tn_xdr_element_descr * restrict elt,
+        const void * restrict data,
+        size_t * restrict size);
+
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_sizeof_array(
+        const tn_xdr_element_descr * restrict elt,
+        size_t len,
+        const void * restrict data,
+        size_t * restrict size);
+
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_sizeof_var_array(
+        const tn_xdr_element_descr * restrict elt,
+        size_t len,
+        const void * restrict data,
+        size_t * restrict size);
+
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_sizeof_struct(
+        size_t nelts,
+        const tn_xdr_element_descr elt[restrict var_size(nelts)],
+        const void * restrict data,
+        size_t * restrict size);
+
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_sizeof_union(
+        size_t nelts,
+        const tn_xdr_element_descr elt[restrict var_size(nelts)],
+        unsigned discr,
+        const void * restrict data,
+        size_t * restrict size);
+
 warn_unused_result
 warn_any_null_arg
 extern tn_status tn_xdr_encode_struct(
@@ -356,6 +952,158 @@ extern tn_status tn_xdr_decode_union(
         unsigned * restrict discr,
         void * restrict data);
 
+/**
+ * Schemas describe values for resumable decoding, which unlike
+ * element descriptors expose the nesting of structs and arrays.
+ * Element schemas are decoded as a whole by their descriptor.
+ */
+typedef enum tn_xdr_schema_kind {
+    TN_XDR_SCHEMA_ELEMENT,
+    TN_XDR_SCHEMA_STRUCT,
+    TN_XDR_SCHEMA_ARRAY,
+    TN_XDR_SCHEMA_VAR_ARRAY
+} tn_xdr_schema_kind;
+
+struct tn_xdr_schema_field;
+
+typedef struct tn_xdr_schema {
+    tn_xdr_schema_kind kind;
+    /** The size of the decoded value */
+    size_t size;
+    /** The descriptor of an element */
+    const tn_xdr_element_descr *elt;
+    /** The number of struct fields or fixed array items */
+    size_t count;
+    const struct tn_xdr_schema_field *fields;
+    /** The schema of array items */
+    const struct tn_xdr_schema *item;
+} tn_xdr_schema;
+
+typedef struct tn_xdr_schema_field {
+    size_t offset;
+    const tn_xdr_schema *schema;
+} tn_xdr_schema_field;
+
+/**
+ * The decoded value of a TN_XDR_SCHEMA_VAR_ARRAY
+ */
+typedef struct tn_xdr_vector {
+    size_t len;
+    void *data;
+} tn_xdr_vector;
+
+#define TN_XDR_SCHEMA_ELEMENT(_descr, _ctype)                       \
+    {                                                               \
+        .kind = TN_XDR_SCHEMA_ELEMENT,                              \
+        .size = sizeof(_ctype),                                     \
+        .elt = &(_descr),                                           \
+        .count = 0,                                                 \
+        .fields = NULL,                                             \
+        .item = NULL                                                \
+    }
+
+#define TN_XDR_SCHEMA_FIELD(_ctype, _field, _schema)        \
+    {offsetof(_ctype, _field), &(_schema)}
+
+#define TN_XDR_SCHEMA_STRUCT(_ctype, _fields)                       \
+    {                                                               \
+        .kind = TN_XDR_SCHEMA_STRUCT,                               \
+        .size = sizeof(_ctype),                                     \
+        .elt = NULL,                                                \
+        .count = sizeof(_fields) / sizeof(*(_fields)),              \
+        .fields = (_fields),                                        \
+        .item = NULL                                                \
+    }
+
+#define TN_XDR_SCHEMA_ARRAY(_itemctype, _len, _item)                \
+    {                                                               \
+        .kind = TN_XDR_SCHEMA_ARRAY,                                \
+        .size = sizeof(_itemctype) * (_len),                        \
+        .elt = NULL,                                                \
+        .count = (_len),                                            \
+        .fields = NULL,                                             \
+        .item = &(_item)                                            \
+    }
+
+#define TN_XDR_SCHEMA_VAR_ARRAY(_item)                              \
+    {                                                               \
+        .kind = TN_XDR_SCHEMA_VAR_ARRAY,                            \
+        .size = sizeof(tn_xdr_vector),                              \
+        .elt = NULL,                                                \
+        .count = 0,                                                 \
+        .fields = NULL,                                             \
+        .item = &(_item)                                            \
+    }
+
+typedef struct tn_xdr_resume_frame {
+    const tn_xdr_schema *schema;
+    uint8_t *data;
+    /** The next field or item */
+    size_t index;
+    /** The number of items, once known */
+    size_t count;
+    /** The number of items allocated so far for variable-length arrays */
+    size_t allocated;
+} tn_xdr_resume_frame;
+
+/**
+ * The state of a resumable decoding: a stack of values being
+ * decoded, and the bytes received so far of an element which
+ * has not arrived completely
+ */
+typedef struct tn_xdr_resumable {
+    size_t depth;
+    size_t capacity;
+    tn_xdr_resume_frame *stack;
+    uint8_t *pending;
+    size_t pending_len;
+    size_t pending_capacity;
+    /**
+     * How many more bytes may be allocated, as in tn_xdr_stream;
+     * unlimited after tn_xdr_resumable_init()
+     * (see tn_xdr_resumable_set_budget())
+     */
+    size_t alloc_left;
+} tn_xdr_resumable;
+
+/**
+ * Starts decoding a value of @a schema into @a data
+ */
+warn_any_null_arg
+extern void tn_xdr_resumable_init(tn_xdr_resumable * restrict state,
+                                  const tn_xdr_schema * restrict schema,
+                                  void * restrict data);
+
+/**
+ * Limits the memory a resumable decoding may allocate to
+ * @a alloc bytes in total, as tn_xdr_set_budgets() does for streams
+ */
+warn_any_null_arg
+static inline void
+tn_xdr_resumable_set_budget(tn_xdr_resumable *state, size_t alloc)
+{
+    state->alloc_left = alloc;
+}
+
+/**
+ * Continues a resumable decoding with @a len more bytes
+ * from @a buf, e.g. as they arrive from a non-blocking socket,
+ * and stores the number of bytes consumed in @a used.
+ *
+ * @return 0 if the value is complete; then any bytes after @a used
+ * belong to whatever follows. EAGAIN if all the bytes have been
+ * consumed and more are needed. Other errors are fatal.
+ *
+ * Elements are retried from the start on each call until they are
+ * complete, so large opaque elements are better split into arrays
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_decode_resumable(tn_xdr_resumable * restrict state,
+                                         const void * restrict buf,
+                                         size_t len,
+                                         size_t * restrict used);
+
 warn_unused_result warn_any_null_arg
 static inline tn_status
 tn_xdr_encode_void(unused tn_xdr_stream * restrict stream,
@@ -379,8 +1127,8 @@ tn_xdr_decode_void(unused tn_xdr_stream * restrict stream,
     tn_xdr_encode_##_suffix(tn_xdr_stream * restrict stream,            \
                             const _type * restrict data)                \
     {                                                                   \
-        return tn_xdr_encode_##_xdrsuffix(stream,                       \
-                                          (_xdrtype *)data);            \
+        _xdrtype val = *data;                                           \
+        return tn_xdr_encode_##_xdrsuffix(stream, &val);                \
     }                                                                   \
     struct fake
 
@@ -474,6 +1222,545 @@ DEFINE_XDR_SMALL_UVALUE_DECODER(size_t, size_t, uint64, uint64_t, SIZE_MAX);
     }                                                                   \
     struct fake
 
+/** @name Compiled schemas
+ * Structures made of fixed-size fields may be described by an X-macro
+ * listing `_(type, field)` pairs, where `type` is one of the built-in
+ * scalar types below or another compiled structure:
+ *
+ *     #define POINT_FIELDS(_) _(int32, x) _(int32, y) _(double, weight)
+ *     TN_XDR_DEFINE_STRUCT(point, struct point, POINT_FIELDS);
+ *
+ * That defines tn_xdr_encode_point() and tn_xdr_decode_point(),
+ * which check the stream once for the whole record and then
+ * convert the fields in straight-line code, tn_xdr_sizeof_point() and
+ * the enum constant TN_XDR_SIZE_point with the encoded size.
+ * Streams in the compact encoding always take the field-by-field path.
+ * TN_XDR_STRUCT_DESCR(point, struct point) then gives
+ * an initializer for a tn_xdr_element_descr.
+ *
+ * Discriminated unions are described by `_(value, type, field)` arms;
+ * arm types need not be fixed-size
+ * @{
+ */
+#define TN_XDR_SIZE_int32 4
+#define TN_XDR_SIZE_uint32 4
+#define TN_XDR_SIZE_int64 8
+#define TN_XDR_SIZE_uint64 8
+#define TN_XDR_SIZE_float 4
+#define TN_XDR_SIZE_double 8
+#define TN_XDR_SIZE_bool 4
+#define TN_XDR_SIZE_int8 4
+#define TN_XDR_SIZE_uint8 4
+#define TN_XDR_SIZE_int16 4
+#define TN_XDR_SIZE_uint16 4
+
+#define DEFINE_XDR_FIXED_SIZEOF(_suffix, _type)                 \
+    warn_unused_result                                          \
+    hint_no_shared_state                                        \
+    static inline size_t                                        \
+    tn_xdr_sizeof_##_suffix(unused const _type *data)           \
+    {                                                           \
+        return TN_XDR_SIZE_##_suffix;                           \
+    }                                                           \
+    struct fake
+
+DEFINE_XDR_FIXED_SIZEOF(int32, int32_t);
+DEFINE_XDR_FIXED_SIZEOF(uint32, uint32_t);
+DEFINE_XDR_FIXED_SIZEOF(int64, int64_t);
+DEFINE_XDR_FIXED_SIZEOF(uint64, uint64_t);
+DEFINE_XDR_FIXED_SIZEOF(float, float);
+DEFINE_XDR_FIXED_SIZEOF(double, double);
+DEFINE_XDR_FIXED_SIZEOF(bool, bool);
+DEFINE_XDR_FIXED_SIZEOF(int8, int8_t);
+DEFINE_XDR_FIXED_SIZEOF(uint8, uint8_t);
+DEFINE_XDR_FIXED_SIZEOF(int16, int16_t);
+DEFINE_XDR_FIXED_SIZEOF(uint16, uint16_t);
+
+/*
+ * tn_xdr_put_X() and tn_xdr_get_X() convert a single value to or from
+ * TN_XDR_SIZE_X bytes in memory without any bounds checks
+ */
+warn_any_null_arg
+static inline void
+tn_xdr_put_uint32(uint8_t * restrict dest, const uint32_t * restrict data)
+{
+    uint32_t val = htonl(*data);
+    memcpy(dest, &val, sizeof(val));
+}
+
+warn_any_null_arg
+static inline tn_status
+tn_xdr_get_uint32(const uint8_t * restrict src, uint32_t * restrict data)
+{
+    uint32_t val;
+    memcpy(&val, src, sizeof(val));
+    *data = ntohl(val);
+    return 0;
+}
+
+warn_any_null_arg
+static inline void
+tn_xdr_put_uint64(uint8_t * restrict dest, const uint64_t * restrict data)
+{
+    uint32_t high = (uint32_t)(*data >> 32);
+    uint32_t low = (uint32_t)(*data & 0xffffffffu);
+
+    tn_xdr_put_uint32(dest, &high);
+    tn_xdr_put_uint32(dest + sizeof(high), &low);
+}
+
+warn_any_null_arg
+static inline tn_status
+tn_xdr_get_uint64(const uint8_t * restrict src, uint64_t * restrict data)
+{
+    uint32_t high;
+    uint32_t low;
+
+    (void)tn_xdr_get_uint32(src, &high);
+    (void)tn_xdr_get_uint32(src + sizeof(high), &low);
+    *data = ((uint64_t)high << 32) | low;
+    return 0;
+}
+
+#define DEFINE_XDR_PUTGET_AS(_suffix, _type, _xdrsuffix, _xdrtype)     \
+    warn_any_null_arg                                                   \
+    static inline void                                                  \
+    tn_xdr_put_##_suffix(uint8_t * restrict dest,                       \
+                         const _type * restrict data)                   \
+    {                                                                   \
+        _xdrtype val;                                                   \
+        memcpy(&val, data, sizeof(val));                                \
+        tn_xdr_put_##_xdrsuffix(dest, &val);                            \
+    }                                                                   \
+                                                                        \
+    warn_any_null_arg                                                   \
+    static inline tn_status                                             \
+    tn_xdr_get_##_suffix(const uint8_t * restrict src,                  \
+                         _type * restrict data)                         \
+    {                                                                   \
+        _xdrtype val;                                                   \
+        (void)tn_xdr_get_##_xdrsuffix(src, &val);                       \
+        memcpy(data, &val, sizeof(val));                                \
+        return 0;                                                       \
+    }                                                                   \
+    struct fake
+
+DEFINE_XDR_PUTGET_AS(int32, int32_t, uint32, uint32_t);
+DEFINE_XDR_PUTGET_AS(int64, int64_t, uint64, uint64_t);
+DEFINE_XDR_PUTGET_AS(float, float, uint32, uint32_t);
+DEFINE_XDR_PUTGET_AS(double, double, uint64, uint64_t);
+
+#define DEFINE_XDR_SMALL_VALUE_PUT(_suffix, _type, _xdrsuffix, _xdrtype) \
+    warn_any_null_arg                                                   \
+    static inline void                                                  \
+    tn_xdr_put_##_suffix(uint8_t * restrict dest,                       \
+                         const _type * restrict data)                   \
+    {                                                                   \
+        _xdrtype val = *data;                                           \
+        tn_xdr_put_##_xdrsuffix(dest, &val);                            \
+    }                                                                   \
+    struct fake
+
+#define DEFINE_XDR_SMALL_UVALUE_GET(_suffix, _type, _max)       \
+    warn_unused_result warn_any_null_arg                        \
+    static inline tn_status                                     \
+    tn_xdr_get_##_suffix(const uint8_t * restrict src,          \
+                         _type * restrict data)                 \
+    {                                                           \
+        uint32_t val;                                           \
+        (void)tn_xdr_get_uint32(src, &val);                     \
+        if (val > (_max))                                       \
+            return EOVERFLOW;                                   \
+        *data = (_type)val;                                     \
+        return 0;                                               \
+    }                                                           \
+    struct fake
+
+#define DEFINE_XDR_SMALL_SVALUE_GET(_suffix, _type, _min, _max)         \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_get_##_suffix(const uint8_t * restrict src,                  \
+                         _type * restrict data)                         \
+    {                                                                   \
+        int32_t val;                                                    \
+        (void)tn_xdr_get_int32(src, &val);                              \
+        if (val < (_min) || val > (_max))                               \
+            return EOVERFLOW;                                           \
+        *data = (_type)val;                                             \
+        return 0;                                                       \
+    }                                                                   \
+    struct fake
+
+DEFINE_XDR_SMALL_VALUE_PUT(bool, bool, int32, int32_t);
+DEFINE_XDR_SMALL_SVALUE_GET(bool, bool, 0, 1);
+
+DEFINE_XDR_SMALL_VALUE_PUT(int8, int8_t, int32, int32_t);
+DEFINE_XDR_SMALL_SVALUE_GET(int8, int8_t, INT8_MIN, INT8_MAX);
+
+DEFINE_XDR_SMALL_VALUE_PUT(int16, int16_t, int32, int32_t);
+DEFINE_XDR_SMALL_SVALUE_GET(int16, int16_t, INT16_MIN, INT16_MAX);
+
+DEFINE_XDR_SMALL_VALUE_PUT(uint8, uint8_t, uint32, uint32_t);
+DEFINE_XDR_SMALL_UVALUE_GET(uint8, uint8_t, UINT8_MAX);
+
+DEFINE_XDR_SMALL_VALUE_PUT(uint16, uint16_t, uint32, uint32_t);
+DEFINE_XDR_SMALL_UVALUE_GET(uint16, uint16_t, UINT16_MAX);
+
+#define TN_XDR_FIELD_SIZE(_type, _field) + TN_XDR_SIZE_##_type
+
+#define TN_XDR_FIELD_PUT(_type, _field)             \
+    tn_xdr_put_##_type(dest, &data->_field);        \
+    dest += TN_XDR_SIZE_##_type;
+
+#define TN_XDR_FIELD_GET(_type, _field)             \
+    rc = tn_xdr_get_##_type(src, &data->_field);    \
+    if (rc != 0)                                    \
+        return rc;                                  \
+    src += TN_XDR_SIZE_##_type;
+
+#define TN_XDR_FIELD_ENCODE(_type, _field)                  \
+    rc = tn_xdr_encode_##_type(stream, &data->_field);      \
+    if (rc != 0)                                            \
+        return rc;
+
+#define TN_XDR_FIELD_DECODE(_type, _field)                  \
+    rc = tn_xdr_decode_##_type(stream, &data->_field);      \
+    if (rc != 0)                                            \
+        return rc;
+
+#define TN_XDR_DEFINE_ELEMENT_THUNKS(_name, _ctype)                     \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_encode_##_name##_elt(tn_xdr_stream * restrict stream,        \
+                                const void * restrict data)             \
+    {                                                                   \
+        return tn_xdr_encode_##_name(stream, (const _ctype *)data);     \
+    }                                                                   \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_decode_##_name##_elt(tn_xdr_stream * restrict stream,        \
+                                void * restrict data)                   \
+    {                                                                   \
+        return tn_xdr_decode_##_name(stream, (_ctype *)data);           \
+    }                                                                   \
+    struct fake
+
+#define TN_XDR_DEFINE_STRUCT(_name, _ctype, _fields)                    \
+    enum { TN_XDR_SIZE_##_name = 0 _fields(TN_XDR_FIELD_SIZE) };        \
+    enum { TN_XDR_FIXED_SIZE_##_name = TN_XDR_SIZE_##_name };           \
+                                                                        \
+    DEFINE_XDR_FIXED_SIZEOF(_name, _ctype);                             \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_measure_##_name##_elt(unused const void * restrict data,     \
+                                 size_t * restrict size)                \
+    {                                                                   \
+        *size += TN_XDR_SIZE_##_name;                                   \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    warn_any_null_arg                                                   \
+    static inline void                                                  \
+    tn_xdr_put_##_name(uint8_t * restrict dest,                         \
+                       const _ctype * restrict data)                    \
+    {                                                                   \
+        _fields(TN_XDR_FIELD_PUT)                                       \
+    }                                                                   \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_get_##_name(const uint8_t * restrict src,                    \
+                       _ctype * restrict data)                          \
+    {                                                                   \
+        tn_status rc;                                                   \
+        _fields(TN_XDR_FIELD_GET)                                       \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_encode_##_name(tn_xdr_stream * restrict stream,              \
+                          const _ctype * restrict data)                 \
+    {                                                                   \
+        tn_status rc;                                                   \
+                                                                        \
+        if (!stream->compact)                                           \
+        {                                                               \
+            if (tn_xdr_write_room(stream) >= TN_XDR_SIZE_##_name)       \
+            {                                                           \
+                tn_xdr_put_##_name(stream->cur, data);                  \
+                stream->cur += TN_XDR_SIZE_##_name;                     \
+                return 0;                                               \
+            }                                                           \
+            if (tn_xdr_stream_left(stream) < TN_XDR_SIZE_##_name)       \
+                return ENOSPC;                                          \
+        }                                                               \
+        _fields(TN_XDR_FIELD_ENCODE)                                    \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_decode_##_name(tn_xdr_stream * restrict stream,              \
+                          _ctype * restrict data)                       \
+    {                                                                   \
+        tn_status rc;                                                   \
+                                                                        \
+        if (!stream->compact)                                           \
+        {                                                               \
+            if ((size_t)(stream->end - stream->cur) >=                  \
+                TN_XDR_SIZE_##_name)                                    \
+            {                                                           \
+                rc = tn_xdr_get_##_name(stream->cur, data);             \
+                if (rc == 0)                                            \
+                    stream->cur += TN_XDR_SIZE_##_name;                 \
+                return rc;                                              \
+            }                                                           \
+            if (tn_xdr_stream_left(stream) < TN_XDR_SIZE_##_name)       \
+                return ENOMSG;                                          \
+        }                                                               \
+        _fields(TN_XDR_FIELD_DECODE)                                    \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    TN_XDR_DEFINE_ELEMENT_THUNKS(_name, _ctype)
+
+#define TN_XDR_ARM_ENCODE(_value, _type, _field)                \
+    case (_value):                                              \
+        rc = tn_xdr_encode_uint32(stream, &(uint32_t){_value}); \
+        if (rc != 0)                                            \
+            return rc;                                          \
+        return tn_xdr_encode_##_type(stream, &data->_field);
+
+#define TN_XDR_ARM_DECODE(_value, _type, _field)                \
+    case (_value):                                              \
+        rc = tn_xdr_decode_##_type(stream, &data->_field);      \
+        break;
+
+#define TN_XDR_ARM_SIZEOF(_value, _type, _field)                \
+    case (_value):                                              \
+        *size += sizeof(uint32_t) +                             \
+            tn_xdr_sizeof_##_type(&data->_field);               \
+        return 0;
+
+#define TN_XDR_DEFINE_UNION(_name, _ctype, _discr_field, _arms)         \
+    enum { TN_XDR_FIXED_SIZE_##_name = 0 };                             \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_measure_##_name(const _ctype * restrict data,                \
+                           size_t * restrict size)                      \
+    {                                                                   \
+        switch (data->_discr_field)                                     \
+        {                                                               \
+            _arms(TN_XDR_ARM_SIZEOF)                                    \
+            default:                                                    \
+                return EINVAL;                                          \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    /* 0 for an invalid discriminant */                                 \
+    warn_unused_result warn_any_null_arg                                \
+    static inline size_t                                                \
+    tn_xdr_sizeof_##_name(const _ctype * restrict data)                 \
+    {                                                                   \
+        size_t size = 0;                                                \
+        return tn_xdr_measure_##_name(data, &size) == 0 ? size : 0;     \
+    }                                                                   \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_measure_##_name##_elt(const void * restrict data,            \
+                                 size_t * restrict size)                \
+    {                                                                   \
+        return tn_xdr_measure_##_name((const _ctype *)data, size);      \
+    }                                                                   \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_encode_##_name(tn_xdr_stream * restrict stream,              \
+                          const _ctype * restrict data)                 \
+    {                                                                   \
+        tn_status rc;                                                   \
+                                                                        \
+        switch (data->_discr_field)                                     \
+        {                                                               \
+            _arms(TN_XDR_ARM_ENCODE)                                    \
+            default:                                                    \
+                return EINVAL;                                          \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    warn_unused_result warn_any_null_arg                                \
+    static inline tn_status                                             \
+    tn_xdr_decode_##_name(tn_xdr_stream * restrict stream,              \
+                          _ctype * restrict data)                       \
+    {                                                                   \
+        uint32_t discr;                                                 \
+        tn_status rc = tn_xdr_decode_uint32(stream, &discr);            \
+                                                                        \
+        if (rc != 0)                                                    \
+            return rc;                                                  \
+        switch (discr)                                                  \
+        {                                                               \
+            _arms(TN_XDR_ARM_DECODE)                                    \
+            default:                                                    \
+                return EPROTO;                                          \
+        }                                                               \
+        if (rc == 0)                                                    \
+            data->_discr_field = discr;                                 \
+        return rc;                                                      \
+    }                                                                   \
+                                                                        \
+    TN_XDR_DEFINE_ELEMENT_THUNKS(_name, _ctype)
+
+/**
+ * An initializer for a tn_xdr_element_descr of a compiled
+ * structure or union
+ */
+#define TN_XDR_STRUCT_DESCR(_name, _ctype)          \
+    {                                               \
+        .elsize = sizeof(_ctype),                   \
+        .encode = tn_xdr_encode_##_name##_elt,      \
+        .decode = tn_xdr_decode_##_name##_elt,      \
+        .measure = tn_xdr_measure_##_name##_elt,    \
+        .fixed_size = TN_XDR_FIXED_SIZE_##_name     \
+    }
+
+/**@}*/
+
+/** @name Indexed containers
+ *
+ * A container holds many independently encoded records:
+ * a header, the records, each starting at a multiple of the
+ * container alignment, an index of record ids, names, offsets and
+ * lengths, and a fixed-size trailer which locates and checksums
+ * the index. Containers are read from streams which have the whole
+ * container in their window, typically tn_xdr_mmap_stream(), so
+ * any record can be decoded without touching the others.
+ * @{
+ */
+
+/** The default record alignment of containers */
+#define TN_XDR_CONTAINER_ALIGN 16
+
+/** The largest record alignment of containers */
+#define TN_XDR_CONTAINER_MAX_ALIGN 4096
+
+typedef struct tn_xdr_container_entry {
+    uint32_t id;
+    /** Never NULL, but may be empty */
+    const char *name;
+    uint64_t offset;
+    uint64_t length;
+} tn_xdr_container_entry;
+
+typedef struct tn_xdr_container_writer {
+    tn_xdr_stream *stream;
+    size_t origin;
+    size_t align;
+    size_t count;
+    size_t capacity;
+    tn_xdr_container_entry *entries;
+    bool in_record;
+} tn_xdr_container_writer;
+
+/**
+ * Starts writing a container to @a stream at its current position,
+ * with records aligned to @a align bytes, which must be a power of
+ * two between 4 and TN_XDR_CONTAINER_MAX_ALIGN, or 0 for
+ * TN_XDR_CONTAINER_ALIGN
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_container_begin(
+        tn_xdr_container_writer * restrict writer,
+        tn_xdr_stream * restrict stream,
+        size_t align);
+
+/**
+ * Starts a new record, which is then encoded into `writer->stream`
+ * and ended with tn_xdr_container_end_record().
+ * @a name may be NULL. Ids and names should be unique, lookups
+ * find the first record with a given one
+ */
+warn_unused_result
+warn_null_args(1)
+extern tn_status tn_xdr_container_start_record(
+        tn_xdr_container_writer * restrict writer,
+        uint32_t id,
+        const char * restrict name);
+
+warn_any_null_arg
+extern void tn_xdr_container_end_record(
+        tn_xdr_container_writer *writer);
+
+/**
+ * Writes the index and the trailer, and flushes the stream
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_container_finish(tn_xdr_container_writer *writer);
+
+typedef struct tn_xdr_container {
+    tn_xdr_stream file;
+    size_t count;
+    tn_xdr_container_entry *entries;
+    /** Hash tables of entry indices + 1 */
+    size_t mask;
+    uint32_t *by_id;
+    uint32_t *by_name;
+} tn_xdr_container;
+
+/**
+ * Opens a container which fills the rest of @a stream. Only
+ * the index is decoded, within the budgets of @a stream.
+ *
+ * @return ENOTSUP if the window of @a stream does not hold
+ * the whole container, EPROTO if the container is malformed,
+ * EBADMSG if the index checksum does not match
+ */
+warn_unused_result
+warn_any_null_arg
+extern tn_status tn_xdr_container_open(
+        tn_xdr_container * restrict container,
+        const tn_xdr_stream * restrict stream);
+
+/**
+ * @return The entry of the record @a id or NULL
+ */
+warn_unused_result
+warn_any_null_arg
+hint_no_side_effects
+extern const tn_xdr_container_entry *tn_xdr_container_find_id(
+        const tn_xdr_container *container,
+        uint32_t id);
+
+/**
+ * @return The entry of the record @a name or NULL
+ */
+warn_unused_result
+warn_any_null_arg
+hint_no_side_effects
+extern const tn_xdr_container_entry *tn_xdr_container_find_name(
+        const tn_xdr_container * restrict container,
+        const char * restrict name);
+
+/**
+ * Returns a read-only stream over a single record, sharing
+ * the memory of the container
+ */
+warn_unused_result
+warn_any_null_arg
+hint_no_side_effects
+extern tn_xdr_stream tn_xdr_container_record(
+        const tn_xdr_container * restrict container,
+        const tn_xdr_container_entry * restrict entry);
+
+/**@}*/
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */